@@ -5,7 +5,10 @@
 #include "spdk/event.h"
 #include "spdk/log.h"
 #include "spdk/string.h"
+#include "spdk/util.h"
 #include "spdk/bdev_zone.h"
+#include "spdk/crc32.h"
+#include "spdk/histogram_data.h"
 
 struct request_context_t {
     char *bdev_name;
@@ -15,13 +18,35 @@ struct request_context_t {
     char *buff;
     uint32_t buff_size;
     struct spdk_bdev_io_wait_entry bdev_io_wait;
+    /* next zone to submit in the current phase, kept across -ENOMEM retries */
+    uint64_t zone_next;
 };
-uint64_t g_tick;
+/* A read owns its buffer until it completes, so reads in flight don't
+ * overwrite each other. Contexts and buffers come from mempools on the
+ * app core's NUMA node.
+ */
+struct io_ctx_t {
+    struct request_context_t *req_context;
+    uint64_t offset_blocks;
+    /* appends: which piece of the zone's -o bytes this is */
+    uint64_t piece;
+    void *buf_elem;
+    void *buf;
+};
+#define IO_POOL_SIZE 16
+struct spdk_mempool *g_ctx_pool = NULL;
+struct spdk_mempool *g_buf_pool = NULL;
+uint32_t g_buf_align = 1;
+/* start of the flow after the zone report, for its wall time */
+uint64_t g_flow_tick;
 /* info about bdev device */
 uint64_t g_num_blk = 0;
 uint32_t g_block_size = 0;
 /* info about zone */
-struct spdk_bdev_zone_info zone_info = {0};
+/* report of every zone, indexed by zone number, kept current as phases complete */
+struct spdk_bdev_zone_info *g_zones = NULL;
+/* zones fetched per spdk_bdev_get_zone_info() call */
+#define ZONE_REPORT_BATCH 1024
 uint64_t g_num_zone = 0;
 uint64_t g_zone_capacity = 0;
 uint64_t g_zone_sz_blk = 0;
@@ -29,21 +54,114 @@ uint32_t g_max_open_zone = 0;
 uint32_t g_max_active_zone = 0;
 uint32_t g_max_append_blk = 0;
 uint64_t g_num_io = 0;
+/* logical write size, split into appends of at most g_append_blk blocks */
+uint64_t g_io_size = 0;
+uint64_t g_io_blk = 1;
+uint64_t g_append_blk = 1;
+uint64_t g_append_per_zone = 1;
+/* -V: every appended block starts with this header, the CRC covers the rest
+ * of the block. The pieces of one zone's append are in flight together and
+ * may land in any order, so a block is checked against where the append log
+ * says its piece landed, not against its submit order.
+ */
+struct verify_hdr_t {
+    uint32_t crc;
+    uint32_t magic;
+    uint64_t zone;          /* zone number the piece was appended to */
+    uint32_t seq;           /* piece index, in submit order */
+    uint32_t block;         /* block index within the piece */
+};
+#define VERIFY_MAGIC 0x5a5eb10c
+bool g_verify = false;
+uint64_t g_verify_blocks = 0;
+uint64_t g_verify_mismatches = 0;
+/* zone resets kept in flight, the rest wait for one of them to complete */
+uint32_t g_reset_qd = 4;
+/* -s: run the flow phase by phase, each phase waits for all zones of the last */
+bool g_serial = false;
+/* -A: zone management benchmark instead of the fixed flow, one bit per action */
+uint32_t g_bench_mask = 0;
+uint64_t g_bench_count = 1000;
+uint32_t g_bench_qd = 1;
+uint64_t g_bench_zones = 16;
 
 static void
 usage(void)
 {
     printf(" -b <bdev> name of the bdev to use\n");
+    printf(" -o <bytes> bytes appended to each zone, split into appends no larger\n");
+    printf("            than the max zone append size (default one write unit)\n");
+    printf(" -r <n>     zone resets kept in flight (default 4)\n");
+    printf(" -V         stamp appended blocks with a CRC32C and check them on read\n");
+    printf(" -s         run the flow phase by phase instead of pipelined per zone\n");
+    printf(" -A <list>  benchmark zone management actions instead of the fixed flow,\n");
+    printf("            comma separated: open,close,finish,reset,reset-all,offline\n");
+    printf("            or all (everything but offline, which is irreversible)\n");
+    printf(" -n <n>     times each action runs (default 1000)\n");
+    printf(" -q <n>     actions kept in flight (default 1)\n");
+    printf(" -z <n>     zones the benchmark uses, from zone #0 (default 16)\n");
 }
 
 static char *g_bdev_name = "Malloc0"; /* Default bdev name if without -b */
+static int bench_parse_actions(const char *arg);
+
 static int
 parse_arg(int ch, char *arg)
 {
+    long val;
+
     switch (ch) {
     case 'b':
         g_bdev_name = arg;
         break;
+    case 'o':
+        val = spdk_strtol(arg, 10);
+        if (val <= 0) {
+            fprintf(stderr, "Invalid io size: %s\n", arg);
+            return -EINVAL;
+        }
+        g_io_size = val;
+        break;
+    case 'r':
+        val = spdk_strtol(arg, 10);
+        if (val <= 0) {
+            fprintf(stderr, "Invalid reset queue depth: %s\n", arg);
+            return -EINVAL;
+        }
+        g_reset_qd = val;
+        break;
+    case 'V':
+        g_verify = true;
+        break;
+    case 's':
+        g_serial = true;
+        break;
+    case 'A':
+        return bench_parse_actions(arg);
+    case 'n':
+        val = spdk_strtol(arg, 10);
+        if (val <= 0) {
+            fprintf(stderr, "Invalid action count: %s\n", arg);
+            return -EINVAL;
+        }
+        g_bench_count = val;
+        break;
+    case 'q':
+        val = spdk_strtol(arg, 10);
+        if (val <= 0) {
+            fprintf(stderr, "Invalid queue depth: %s\n", arg);
+            return -EINVAL;
+        }
+        g_bench_qd = val;
+        break;
+    case 'z':
+        val = spdk_strtol(arg, 10);
+        if (val <= 0) {
+            fprintf(stderr, "Invalid zone count: %s\n", arg);
+            return -EINVAL;
+        }
+        g_bench_zones = val;
+        break;
     default:
         return -EINVAL;
     }
@@ -76,9 +194,423 @@ appstop_success(struct request_context_t *req_context)
     spdk_app_stop(0);
 }
 
+static const char *
+zone_state_name(enum spdk_bdev_zone_state state)
+{
+    switch (state) {
+    case SPDK_BDEV_ZONE_STATE_EMPTY:
+        return "empty";
+    case SPDK_BDEV_ZONE_STATE_IMP_OPEN:
+        return "implicit open";
+    case SPDK_BDEV_ZONE_STATE_EXP_OPEN:
+        return "explicit open";
+    case SPDK_BDEV_ZONE_STATE_CLOSED:
+        return "closed";
+    case SPDK_BDEV_ZONE_STATE_FULL:
+        return "full";
+    case SPDK_BDEV_ZONE_STATE_READ_ONLY:
+        return "read only";
+    case SPDK_BDEV_ZONE_STATE_OFFLINE:
+        return "offline";
+    default:
+        return "unknown";
+    }
+}
+
+/* Print zones [first, first + count) from the zone table, no device round trip */
+static void
+zone_table_print(uint64_t first, uint64_t count)
+{
+    struct spdk_bdev_zone_info *zone;
+
+    for (uint64_t i = first; i < first + count && i < g_num_zone; i++) {
+        zone = &g_zones[i];
+        printf("zone #%lu: %s, write pointer +0x%lx, capacity %lu blocks\n", i,
+               zone_state_name(zone->state), zone->write_pointer - zone->zone_id,
+               zone->capacity);
+    }
+}
+
+/* io ctx start */
+static struct io_ctx_t *
+io_ctx_get(struct request_context_t *req_context)
+{
+    struct io_ctx_t *ctx;
+
+    ctx = spdk_mempool_get(g_ctx_pool);
+    if (!ctx) {
+        return NULL;
+    }
+    ctx->buf_elem = spdk_mempool_get(g_buf_pool);
+    if (!ctx->buf_elem) {
+        spdk_mempool_put(g_ctx_pool, ctx);
+        return NULL;
+    }
+    ctx->req_context = req_context;
+    ctx->buf = (void *)SPDK_ALIGN_CEIL((uintptr_t)ctx->buf_elem, g_buf_align);
+    return ctx;
+}
+
+static void
+io_ctx_put(struct io_ctx_t *ctx)
+{
+    spdk_mempool_put(g_buf_pool, ctx->buf_elem);
+    spdk_mempool_put(g_ctx_pool, ctx);
+}
+/* io ctx end */
+
+/* append log start */
+/* Where every append piece landed, indexed by zone * g_append_per_zone +
+ * piece, UINT64_MAX until it completes. The pieces of a zone are in flight
+ * together, so the device may place them in any order; the flow prints how
+ * many landed out of submit order instead of every location.
+ */
+#define APPEND_LOG_ZONES 5
+uint64_t *g_append_log = NULL;
+uint64_t g_appends = 0;
+uint64_t g_appends_reordered = 0;
+uint64_t g_append_max_displacement = 0;
+
+static int
+append_log_init(void)
+{
+    g_append_log = malloc(APPEND_LOG_ZONES * g_append_per_zone * sizeof(uint64_t));
+    if (!g_append_log) {
+        return -ENOMEM;
+    }
+    memset(g_append_log, 0xff, APPEND_LOG_ZONES * g_append_per_zone * sizeof(uint64_t));
+    return 0;
+}
+
+/* Store where the piece landed; false if the device put it outside its zone */
+static bool
+append_log_complete(uint64_t zone, uint64_t piece, uint64_t num_blocks, uint64_t location)
+{
+    uint64_t zone_id = zone * g_zone_sz_blk;
+    uint64_t expected = piece * g_append_blk;
+    uint64_t landed;
+
+    if (location < zone_id || location + num_blocks > zone_id + g_zone_capacity) {
+        SPDK_ERRLOG("append to zone #%lu landed at 0x%lx, outside the zone\n", zone, location);
+        return false;
+    }
+    landed = location - zone_id;
+    if (zone < APPEND_LOG_ZONES) {
+        g_append_log[zone * g_append_per_zone + piece] = landed;
+    }
+    g_appends++;
+    if (landed != expected) {
+        g_appends_reordered++;
+        g_append_max_displacement = spdk_max(g_append_max_displacement,
+                                             landed > expected ? landed - expected : expected - landed);
+    }
+    return true;
+}
+
+/* The data of one piece; with -V a copy in the context's buffer, stamped for its zone */
+static void *
+append_piece_buf(struct io_ctx_t *ctx, uint64_t zone, uint64_t num_blocks)
+{
+    char *data = ctx->req_context->buff + ctx->piece * g_append_blk * g_block_size;
+    struct verify_hdr_t *hdr;
+    char *block;
+
+    if (!g_verify) {
+        return data;
+    }
+    memcpy(ctx->buf, data, num_blocks * g_block_size);
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        block = (char *)ctx->buf + i * g_block_size;
+        hdr = (struct verify_hdr_t *)block;
+        hdr->magic = VERIFY_MAGIC;
+        hdr->zone = zone;
+        hdr->seq = ctx->piece;
+        hdr->block = i;
+        hdr->crc = spdk_crc32c_update(block + sizeof(hdr->crc),
+                                      g_block_size - sizeof(hdr->crc), ~0u);
+    }
+    return ctx->buf;
+}
+
+static void
+append_log_print(void)
+{
+    printf("[append] %lu appends, %lu landed out of submit order, max displacement %lu blocks\n",
+           g_appends, g_appends_reordered, g_append_max_displacement);
+}
+/* append log end */
+
+/* zone state start */
+/* Host model of every zone's state, applied when a command is submitted so
+ * commands still in flight count against the device's open and active
+ * limits. A write or open that would cross a limit first closes (open limit)
+ * or finishes (active limit) the least recently used zone with nothing in
+ * flight and no pieces of a write left to submit.
+ */
+struct zone_sm_t {
+    uint64_t last_use;      /* tick of the last write or open */
+    uint32_t inflight;      /* writes and opens not completed yet */
+    bool held;              /* the flow still has pieces of a write for it */
+};
+struct zone_sm_t *g_zone_sm = NULL;
+uint32_t g_open_cnt = 0;
+uint32_t g_active_cnt = 0;
+uint64_t g_sm_closes = 0;
+uint64_t g_sm_finishes = 0;
+/* one close or finish at a time, whoever had to wait for it resumes after,
+ * in the order they started waiting
+ */
+bool g_sm_evicting = false;
+#define ZONE_SM_MAX_WAITERS 8
+struct zone_sm_waiter_t {
+    spdk_bdev_io_wait_cb cb_fn;
+    void *cb_arg;
+};
+struct zone_sm_waiter_t g_sm_waiters[ZONE_SM_MAX_WAITERS];
+uint32_t g_sm_num_waiters = 0;
+
+static bool
+zone_is_open(enum spdk_bdev_zone_state state)
+{
+    return state == SPDK_BDEV_ZONE_STATE_IMP_OPEN || state == SPDK_BDEV_ZONE_STATE_EXP_OPEN;
+}
+
+static bool
+zone_is_active(enum spdk_bdev_zone_state state)
+{
+    return zone_is_open(state) || state == SPDK_BDEV_ZONE_STATE_CLOSED;
+}
+
+static void
+zone_sm_set(uint64_t zone, enum spdk_bdev_zone_state state)
+{
+    struct spdk_bdev_zone_info *info = &g_zones[zone];
+
+    g_open_cnt += (int)zone_is_open(state) - (int)zone_is_open(info->state);
+    g_active_cnt += (int)zone_is_active(state) - (int)zone_is_active(info->state);
+    info->state = state;
+}
+
+/* Count the open and active zones of a fresh zone report */
+static int
+zone_sm_init(void)
+{
+    g_zone_sm = calloc(g_num_zone, sizeof(struct zone_sm_t));
+    if (!g_zone_sm) {
+        return -ENOMEM;
+    }
+    for (uint64_t i = 0; i < g_num_zone; i++) {
+        g_open_cnt += zone_is_open(g_zones[i].state);
+        g_active_cnt += zone_is_active(g_zones[i].state);
+    }
+    return 0;
+}
+
+static void
+zone_sm_write(uint64_t zone, uint64_t num_blocks)
+{
+    struct spdk_bdev_zone_info *info = &g_zones[zone];
+
+    info->write_pointer += num_blocks;
+    g_zone_sm[zone].last_use = spdk_get_ticks();
+    if (info->write_pointer >= info->zone_id + info->capacity) {
+        zone_sm_set(zone, SPDK_BDEV_ZONE_STATE_FULL);
+    } else if (!zone_is_open(info->state)) {
+        zone_sm_set(zone, SPDK_BDEV_ZONE_STATE_IMP_OPEN);
+    }
+}
+
+static void
+zone_sm_action(uint64_t zone, enum spdk_bdev_zone_action action)
+{
+    struct spdk_bdev_zone_info *info = &g_zones[zone];
+
+    switch (action) {
+    case SPDK_BDEV_ZONE_OPEN:
+        if (info->state == SPDK_BDEV_ZONE_STATE_EMPTY || info->state == SPDK_BDEV_ZONE_STATE_CLOSED ||
+            info->state == SPDK_BDEV_ZONE_STATE_IMP_OPEN) {
+            zone_sm_set(zone, SPDK_BDEV_ZONE_STATE_EXP_OPEN);
+        }
+        g_zone_sm[zone].last_use = spdk_get_ticks();
+        break;
+    case SPDK_BDEV_ZONE_CLOSE:
+        if (zone_is_open(info->state)) {
+            /* a zone closed with no data goes back to empty */
+            zone_sm_set(zone, info->write_pointer == info->zone_id ?
+                        SPDK_BDEV_ZONE_STATE_EMPTY : SPDK_BDEV_ZONE_STATE_CLOSED);
+        }
+        break;
+    case SPDK_BDEV_ZONE_FINISH:
+        if (info->state == SPDK_BDEV_ZONE_STATE_EMPTY || zone_is_active(info->state)) {
+            info->write_pointer = info->zone_id + info->capacity;
+            zone_sm_set(zone, SPDK_BDEV_ZONE_STATE_FULL);
+        }
+        break;
+    case SPDK_BDEV_ZONE_RESET:
+        info->write_pointer = info->zone_id;
+        zone_sm_set(zone, SPDK_BDEV_ZONE_STATE_EMPTY);
+        break;
+    case SPDK_BDEV_ZONE_OFFLINE:
+        zone_sm_set(zone, SPDK_BDEV_ZONE_STATE_OFFLINE);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Keep or stop keeping the zone out of victim selection while a write is split */
+static void
+zone_sm_hold(uint64_t zone, bool held)
+{
+    g_zone_sm[zone].held = held;
+}
+
+/* Queue resume_fn unless it already waits; a flow retries all it can from one call */
+static int
+zone_sm_wait(spdk_bdev_io_wait_cb cb_fn, void *cb_arg)
+{
+    for (uint32_t i = 0; i < g_sm_num_waiters; i++) {
+        if (g_sm_waiters[i].cb_fn == cb_fn && g_sm_waiters[i].cb_arg == cb_arg) {
+            return 0;
+        }
+    }
+    if (g_sm_num_waiters == ZONE_SM_MAX_WAITERS) {
+        return -ENOSPC;
+    }
+    g_sm_waiters[g_sm_num_waiters].cb_fn = cb_fn;
+    g_sm_waiters[g_sm_num_waiters].cb_arg = cb_arg;
+    g_sm_num_waiters++;
+    return 0;
+}
+
+/* Resume every waiter, oldest first; one that still can't go queues itself again */
+static void
+zone_sm_wake(void)
+{
+    struct zone_sm_waiter_t waiters[ZONE_SM_MAX_WAITERS];
+    uint32_t num_waiters = g_sm_num_waiters;
+
+    memcpy(waiters, g_sm_waiters, sizeof(waiters[0]) * num_waiters);
+    g_sm_num_waiters = 0;
+    for (uint32_t i = 0; i < num_waiters; i++) {
+        waiters[i].cb_fn(waiters[i].cb_arg);
+    }
+}
+
+/* A write or open of zone completed */
+static void
+zone_sm_io_done(uint64_t zone)
+{
+    if (--g_zone_sm[zone].inflight == 0 && !g_sm_evicting) {
+        /* the zone may be the victim someone is waiting for */
+        zone_sm_wake();
+    }
+}
+
+/* Least recently used zone that is open (or active) and idle, -1 if none */
+static int64_t
+zone_sm_victim(uint64_t target, bool open_only)
+{
+    int64_t victim = -1;
+
+    for (uint64_t i = 0; i < g_num_zone; i++) {
+        if (i == target || g_zone_sm[i].inflight || g_zone_sm[i].held ||
+            !(open_only ? zone_is_open(g_zones[i].state) : zone_is_active(g_zones[i].state))) {
+            continue;
+        }
+        if (victim < 0 || g_zone_sm[i].last_use < g_zone_sm[victim].last_use) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+static void
+zone_sm_evict_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct request_context_t *req_context = cb_arg;
+
+    spdk_bdev_free_io(bdev_io);
+    g_sm_evicting = false;
+
+    if (!success) {
+        SPDK_ERRLOG("bdev io close/finish of the least recently used zone error: %d\n", EIO);
+        appstop_error(req_context);
+        return;
+    }
+    zone_sm_wake();
+}
+
+/* Make room before a write or open of zone. Returns 0 if it can go out now,
+ * -EAGAIN if resume_fn will be called once room was made, or the error of
+ * submitting the close / finish.
+ */
+static int
+zone_sm_admit(struct request_context_t *req_context, uint64_t zone, spdk_bdev_io_wait_cb resume_fn)
+{
+    enum spdk_bdev_zone_state state = g_zones[zone].state;
+    enum spdk_bdev_zone_action action;
+    int64_t victim;
+    int rc;
+
+    if (g_sm_evicting) {
+        goto wait;
+    }
+    if (!zone_is_active(state) && g_max_active_zone && g_active_cnt >= g_max_active_zone) {
+        /* only a finish gives an active zone back */
+        victim = zone_sm_victim(zone, false);
+        action = SPDK_BDEV_ZONE_FINISH;
+    } else if (!zone_is_open(state) && g_max_open_zone && g_open_cnt >= g_max_open_zone) {
+        victim = zone_sm_victim(zone, true);
+        action = SPDK_BDEV_ZONE_CLOSE;
+    } else {
+        return 0;
+    }
+    if (victim < 0) {
+        /* every candidate has I/O in flight, the next completion retries */
+        goto wait;
+    }
+
+    rc = spdk_bdev_zone_management(req_context->bdev_desc, req_context->bdev_io_channel,
+                                   victim * g_zone_sz_blk, action,
+                                   zone_sm_evict_complete, req_context);
+    if (rc) {
+        return rc;
+    }
+    zone_sm_action(victim, action);
+    if (action == SPDK_BDEV_ZONE_CLOSE) {
+        g_sm_closes++;
+    } else {
+        g_sm_finishes++;
+    }
+    g_sm_evicting = true;
+wait:
+    rc = zone_sm_wait(resume_fn, req_context);
+    return rc ? rc : -EAGAIN;
+}
+
+static void
+zone_sm_print(void)
+{
+    printf("[zone state] open %u/%u, active %u/%u, %lu closes and %lu finishes to stay in limits\n",
+           g_open_cnt, g_max_open_zone, g_active_cnt, g_max_active_zone,
+           g_sm_closes, g_sm_finishes);
+}
+/* zone state end */
+
 /* close zone start */
 uint64_t close_complete = 0;
 
+static void
+close_zone_done(struct request_context_t *req_context)
+{
+    printf("Close complete: %.3f ms\n",
+           (double)(spdk_get_ticks() - g_flow_tick) * 1000 / spdk_get_ticks_hz());
+    zone_table_print(0, 15);
+    zone_sm_print();
+    appstop_success(req_context);
+}
+
 static void
 close_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 {
@@ -94,146 +626,291 @@ close_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
     }
 
     if (close_complete == 5) {
-        printf("Close complete\n");
-        appstop_success(req_context);
+        close_zone_done(req_context);
     }
 }
 
 static void
-close_zone(void *arg)
+close_zone_submit(void *arg)
 {
     struct request_context_t *req_context = arg;
     int rc = 0;
 
-    printf("Close zone #10 ~ zone #14...\n");
-
-    for (uint64_t zone = 10; zone < 15; zone++) {
+    for (; req_context->zone_next < 15; req_context->zone_next++) {
+        if (!zone_is_open(g_zones[req_context->zone_next].state)) {
+            /* already closed to make room for another zone */
+            close_complete++;
+            continue;
+        }
         rc = spdk_bdev_zone_management(req_context->bdev_desc, req_context->bdev_io_channel,
-                       zone * g_zone_sz_blk, SPDK_BDEV_ZONE_CLOSE, 
+                       req_context->zone_next * g_zone_sz_blk, SPDK_BDEV_ZONE_CLOSE, 
                        close_zone_complete, req_context);
         if (rc == -ENOMEM) {
             SPDK_NOTICELOG("Queueing io\n");
-            queue_io_wait_with_cb(req_context, close_zone);
+            /* resume from this zone once a bdev_io is freed */
+            queue_io_wait_with_cb(req_context, close_zone_submit);
+            return;
         } else if (rc) {
             SPDK_ERRLOG("%s error while writing to bdev: %d\n", spdk_strerror(-rc), rc);
             appstop_error(req_context);
+            return;
         }
+        zone_sm_action(req_context->zone_next, SPDK_BDEV_ZONE_CLOSE);
     }
-}  
+    if (close_complete == 5) {
+        close_zone_done(req_context);
+    }
+}
+
+static void
+close_zone(void *arg)
+{
+    struct request_context_t *req_context = arg;
+
+    printf("Close zone #10 ~ zone #14...\n");
+
+    req_context->zone_next = 10;
+    close_zone_submit(req_context);
+}
 /* close zone end */
 
 /* open zone start */
 uint64_t open_complete = 0;
+/* the context pool ran dry, the next open completion resumes submission */
+bool open_pool_wait = false;
+
+static void open_zone_submit(void *arg);
 
 static void 
 open_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 {
-    struct request_context_t *req_context = cb_arg;
+    struct io_ctx_t *ctx = cb_arg;
+    struct request_context_t *req_context = ctx->req_context;
+    uint64_t zone = ctx->offset_blocks / g_zone_sz_blk;
 
     spdk_bdev_free_io(bdev_io);
+    io_ctx_put(ctx);
 
     if (success) {
         open_complete++;
     } else {
         SPDK_ERRLOG("bdev io read error\n");
         appstop_error(req_context);
+        return;
     }
+    zone_sm_io_done(zone);
 
     if (open_complete == 10) {
         printf("Open complete\n");
         //appstop_success(req_context);
         close_zone(req_context);
+    } else if (open_pool_wait) {
+        open_pool_wait = false;
+        open_zone_submit(req_context);
     }
 
 }
 
 static void
-open_zone(void *arg)
+open_zone_submit(void *arg)
 {
     struct request_context_t *req_context = arg;
+    struct io_ctx_t *ctx;
     int rc = 0;
 
-    printf("Open zone #5 ~ zone #14...\n");
-
-    for (uint64_t zone = 5; zone < 15; zone++) {
-        rc = spdk_bdev_zone_management(req_context->bdev_desc, req_context->bdev_io_channel,
-                       zone * g_zone_sz_blk, SPDK_BDEV_ZONE_OPEN, 
-                       open_zone_complete, req_context);
-        if (rc == -ENOMEM) {
+    for (; req_context->zone_next < 15; req_context->zone_next++) {
+        /* past the open limit the least recently used zone is closed first */
+        rc = zone_sm_admit(req_context, req_context->zone_next, open_zone_submit);
+        if (rc == 0) {
+            ctx = io_ctx_get(req_context);
+            if (!ctx) {
+                open_pool_wait = true;
+                return;
+            }
+            ctx->offset_blocks = req_context->zone_next * g_zone_sz_blk;
+            rc = spdk_bdev_zone_management(req_context->bdev_desc, req_context->bdev_io_channel,
+                           ctx->offset_blocks, SPDK_BDEV_ZONE_OPEN, 
+                           open_zone_complete, ctx);
+            if (rc) {
+                io_ctx_put(ctx);
+            }
+        }
+        if (rc == -EAGAIN) {
+            return;
+        } else if (rc == -ENOMEM) {
             SPDK_NOTICELOG("Queueing io\n");
-            queue_io_wait_with_cb(req_context, open_zone);
+            queue_io_wait_with_cb(req_context, open_zone_submit);
+            return;
         } else if (rc) {
             SPDK_ERRLOG("%s error while writing to bdev: %d\n", spdk_strerror(-rc), rc);
             appstop_error(req_context);
+            return;
         }
+        zone_sm_action(req_context->zone_next, SPDK_BDEV_ZONE_OPEN);
+        g_zone_sm[req_context->zone_next].inflight++;
     }
-}  
+}
+
+static void
+open_zone(void *arg)
+{
+    struct request_context_t *req_context = arg;
+
+    printf("Open zone #5 ~ zone #14...\n");
+
+    req_context->zone_next = 5;
+    open_zone_submit(req_context);
+}
 /* open zone end */
 
 /* read zone start */ 
 uint64_t rz_complete = 0;
+/* the pools ran dry, the next read completion resumes submission */
+bool rz_pool_wait = false;
+
+static void read_zone_submit(void *arg);
+
+/* Check one block read back from lba */
+static bool
+verify_block(const char *block, uint64_t lba)
+{
+    const struct verify_hdr_t *hdr = (const struct verify_hdr_t *)block;
+    uint64_t zone = lba / g_zone_sz_blk;
+    uint64_t landed;
+
+    if (hdr->magic != VERIFY_MAGIC || hdr->zone != zone || zone >= APPEND_LOG_ZONES ||
+        hdr->seq >= g_append_per_zone ||
+        hdr->crc != spdk_crc32c_update(block + sizeof(hdr->crc),
+                                       g_block_size - sizeof(hdr->crc), ~0u)) {
+        return false;
+    }
+    /* the append log says where the device put the piece */
+    landed = g_append_log[zone * g_append_per_zone + hdr->seq];
+    return landed != UINT64_MAX && landed + hdr->block == lba % g_zone_sz_blk;
+}
+
+static void
+read_zone_verify(struct io_ctx_t *ctx)
+{
+    uint64_t bad = 0;
+
+    for (uint64_t i = 0; i < g_io_blk; i++) {
+        if (!verify_block((char *)ctx->buf + i * g_block_size, ctx->offset_blocks + i)) {
+            bad++;
+        }
+    }
+    printf("read 0x%lx: %lu/%lu blocks ok, %s", ctx->offset_blocks, g_io_blk - bad, g_io_blk,
+           (char *)ctx->buf + sizeof(struct verify_hdr_t));
+    g_verify_blocks += g_io_blk;
+    g_verify_mismatches += bad;
+}
 
 static void
 read_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 {
-    struct request_context_t *req_context = cb_arg;
+    struct io_ctx_t *ctx = cb_arg;
+    struct request_context_t *req_context = ctx->req_context;
 
     spdk_bdev_free_io(bdev_io);
 
     if (success) {
         rz_complete++;
-        printf("%s", req_context->buff);
+        if (g_verify) {
+            read_zone_verify(ctx);
+        } else {
+            printf("read 0x%lx: %s", ctx->offset_blocks, (char *)ctx->buf);
+        }
     } else {
         SPDK_ERRLOG("bdev io read error\n");
         appstop_error(req_context);
     }
 
+    io_ctx_put(ctx);
+
     if (rz_complete == g_num_io) {
         printf("Read complete\n");
+        if (g_verify) {
+            printf("[verify] %lu blocks, %lu mismatches\n", g_verify_blocks, g_verify_mismatches);
+        }
         //appstop_success(req_context);
         open_zone(req_context);
+    } else if (rz_pool_wait) {
+        rz_pool_wait = false;
+        read_zone_submit(req_context);
     }
 
 }
 
 static void
-read_zone(void *arg)
+read_zone_submit(void *arg)
 {
     struct request_context_t *req_context = arg;
     int rc = 0;
 
-    printf("Read zone #0 ~ zone #4...\n");
-   
-    uint64_t num_blocks = 1;
-    uint64_t offset_blocks = 0;
-    for (uint64_t zone = 0; zone < g_num_io; zone++) {
-        offset_blocks = zone * g_zone_sz_blk; 
+    uint64_t num_blocks = g_io_blk;
+    struct io_ctx_t *ctx;
+    for (; req_context->zone_next < g_num_io; req_context->zone_next++) {
+        ctx = io_ctx_get(req_context);
+        if (!ctx) {
+            rz_pool_wait = true;
+            return;
+        }
+        ctx->offset_blocks = req_context->zone_next * g_zone_sz_blk; 
         // Zero the buffer so that we can use it for reading 
-        memset(req_context->buff, 0, req_context->buff_size);
-        printf("read: offset_blocks = 0x%lx\n", offset_blocks);
+        memset(ctx->buf, 0, req_context->buff_size);
+        printf("read: offset_blocks = 0x%lx\n", ctx->offset_blocks);
         rc = spdk_bdev_read_blocks(req_context->bdev_desc, req_context->bdev_io_channel,
-                                req_context->buff, offset_blocks, num_blocks, 
-                                read_zone_complete, req_context);
+                                ctx->buf, ctx->offset_blocks, num_blocks, 
+                                read_zone_complete, ctx);
         if (rc == -ENOMEM) {
             SPDK_NOTICELOG("Queueing io\n");
-            queue_io_wait_with_cb(req_context, read_zone);
+            io_ctx_put(ctx);
+            queue_io_wait_with_cb(req_context, read_zone_submit);
+            return;
         } else if (rc) {
             SPDK_ERRLOG("%s error while writing to bdev: %d\n", spdk_strerror(-rc), rc);
+            io_ctx_put(ctx);
             appstop_error(req_context);
+            return;
         }
     }
-}  
+}
+
+static void
+read_zone(void *arg)
+{
+    struct request_context_t *req_context = arg;
+
+    printf("Read zone #0 ~ zone #4...\n");
+
+    req_context->zone_next = 0;
+    read_zone_submit(req_context);
+}
 /* read zone end */
 
 /* append zone start */
 uint64_t az_complete = 0;
+/* the context pool ran dry, the next append completion resumes submission */
+bool az_pool_wait = false;
+
+static void append_zone_submit(void *arg);
 
 static void
 append_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 {
-    struct request_context_t *req_context = cb_arg;
+    struct io_ctx_t *ctx = cb_arg;
+    struct request_context_t *req_context = ctx->req_context;
+    uint64_t zone = ctx->offset_blocks / g_zone_sz_blk;
+    uint64_t piece = ctx->piece;
+    uint64_t num_blocks = spdk_min(g_append_blk, g_io_blk - piece * g_append_blk);
 
+    if (success) {
+        /* the device picks the LBA, read it before the bdev_io goes back to the pool */
+        success = append_log_complete(zone, piece, num_blocks,
+                                      spdk_bdev_io_get_append_location(bdev_io));
+    }
     spdk_bdev_free_io(bdev_io);
+    io_ctx_put(ctx);
 
     if (success) {
         az_complete++;
@@ -242,46 +919,97 @@ append_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
         appstop_error(req_context);
         return;
     }
+    zone_sm_io_done(zone);
     
-    if (az_complete == g_num_io) {
+    if (az_complete == g_num_io * g_append_per_zone) {
         printf("Append complete...\n");
+        append_log_print();
         read_zone(req_context);
        // appstop_success(req_context);
+    } else if (az_pool_wait) {
+        az_pool_wait = false;
+        append_zone_submit(req_context);
     }
 }
 
 static void
-append_zone(void *arg)
+append_zone_submit(void *arg)
 {
     struct request_context_t *req_context = arg;
+    struct io_ctx_t *ctx;
     int rc = 0;
 
-    printf("Append & implicit open zone #0 ~ zone #4...\n");
     uint64_t zone_id = 0;
     uint64_t num_blocks = 1;
     uint64_t offset_blocks = 0;
-    g_num_io = 5;
+    uint64_t zone, piece;
 
-    for (uint64_t zone = 0; zone < g_num_io; zone++) {
+    /* zone_next walks every append: g_append_per_zone pieces for each zone */
+    for (; req_context->zone_next < g_num_io * g_append_per_zone; req_context->zone_next++) {
+        zone = req_context->zone_next / g_append_per_zone;
+        piece = req_context->zone_next % g_append_per_zone;
         offset_blocks = zone * g_zone_sz_blk + 87; // 87 is a random number
         zone_id =spdk_bdev_get_zone_id(req_context->bdev, offset_blocks);
-        printf("append: offset_blocks = 0x%lx, zone_id=0x%lx\n", offset_blocks, zone_id);
-        rc = spdk_bdev_zone_append(req_context->bdev_desc, req_context->bdev_io_channel,
-                                req_context->buff, zone_id, num_blocks, 
-                                append_zone_complete, req_context);
-        if (rc == -ENOMEM) {
+        num_blocks = spdk_min(g_append_blk, g_io_blk - piece * g_append_blk);
+        /* an append implicitly opens the zone, keep it under the open limit */
+        rc = zone_sm_admit(req_context, zone, append_zone_submit);
+        if (rc == 0) {
+            ctx = io_ctx_get(req_context);
+            if (!ctx) {
+                az_pool_wait = true;
+                return;
+            }
+            ctx->offset_blocks = zone_id;
+            ctx->piece = piece;
+            if (piece == 0) {
+                printf("append: offset_blocks = 0x%lx, zone_id=0x%lx\n", offset_blocks, zone_id);
+            }
+            rc = spdk_bdev_zone_append(req_context->bdev_desc, req_context->bdev_io_channel,
+                                    append_piece_buf(ctx, zone, num_blocks),
+                                    zone_id, num_blocks, 
+                                    append_zone_complete, ctx);
+            if (rc) {
+                io_ctx_put(ctx);
+            }
+        }
+        if (rc == -EAGAIN) {
+            return;
+        } else if (rc == -ENOMEM) {
             SPDK_NOTICELOG("Queueing io\n");
-            queue_io_wait_with_cb(req_context, append_zone);
+            queue_io_wait_with_cb(req_context, append_zone_submit);
+            return;
         } else if (rc) {
             SPDK_ERRLOG("%s error while writing to bdev: %d\n", spdk_strerror(-rc), rc);
             appstop_error(req_context);
+            return;
         }   
+        zone_sm_write(zone, num_blocks);
+        g_zone_sm[zone].inflight++;
+        /* closing the zone between its pieces would fail the next append */
+        zone_sm_hold(zone, piece + 1 < g_append_per_zone);
     }
 }
+
+static void
+append_zone(void *arg)
+{
+    struct request_context_t *req_context = arg;
+
+    printf("Append & implicit open zone #0 ~ zone #4...\n");
+    g_num_io = 5;
+
+    req_context->zone_next = 0;
+    append_zone_submit(req_context);
+}
 /* append zone end */
 
 /* reset zone start */
 uint64_t reset_complete = 0;
+uint32_t reset_outstanding = 0;
+/* a reset is parked on bdev_io_wait, completions must not submit meanwhile */
+bool reset_io_wait = false;
+
+static void reset_zone_submit(void *arg);
 
 static void
 reset_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
@@ -289,6 +1017,7 @@ reset_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
     struct request_context_t *req_context = cb_arg;
 
     spdk_bdev_free_io(bdev_io);
+    reset_outstanding--;
     
     if (success) {
 		reset_complete++;
@@ -301,34 +1030,827 @@ reset_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
     if (reset_complete == 15) {
         printf("Reset zone complete\n");
         append_zone(req_context);
-    }    
+    } else if (!reset_io_wait) {
+        /* a slot under the cap opened up */
+        reset_zone_submit(req_context);
+    }
 }
 
 static void
-reset_zone(void *arg)
+reset_zone_resume(void *arg)
 {
-    struct request_context_t *req_context = arg;
-    int rc = 0;
+    reset_io_wait = false;
+    reset_zone_submit(arg);
+}
 
-    printf("Reset zone #0 ~ zone #14...\n");
+static void
+reset_zone_submit(void *arg)
+{
+    struct request_context_t *req_context = arg;
+    int rc = 0;
 
-    for (uint64_t zone = 0; zone < 15; zone++) {
+    for (; req_context->zone_next < 15 && reset_outstanding < g_reset_qd;
+         req_context->zone_next++) {
         rc = spdk_bdev_zone_management(req_context->bdev_desc, req_context->bdev_io_channel,
-                       zone * g_zone_sz_blk, SPDK_BDEV_ZONE_RESET, 
+                       req_context->zone_next * g_zone_sz_blk, SPDK_BDEV_ZONE_RESET, 
                        reset_zone_complete, req_context);
 
         if (rc == -ENOMEM) {
             SPDK_NOTICELOG("Queueing io\n");
-            queue_io_wait_with_cb(req_context, reset_zone);
+            reset_io_wait = true;
+            queue_io_wait_with_cb(req_context, reset_zone_resume);
+            return;
         } else if (rc) {
             SPDK_ERRLOG("%s error while resetting zone: %d\n", spdk_strerror(-rc), rc);
             appstop_error(req_context);
+            return;
         }
+        zone_sm_action(req_context->zone_next, SPDK_BDEV_ZONE_RESET);
+        reset_outstanding++;
     }
 }
+
+static void
+reset_zone(void *arg)
+{
+    struct request_context_t *req_context = arg;
+
+    printf("Reset zone #0 ~ zone #14, %u at a time...\n", g_reset_qd);
+
+    req_context->zone_next = 0;
+    reset_zone_submit(req_context);
+}
 /* reset zone end */
 
+/* pipeline start */
+/* Default flow: every zone walks its own stages as soon as its previous
+ * stage completes, instead of waiting for all zones at each phase (-s):
+ *
+ *   zone #0 ~ #4:    reset, append, read
+ *   zone #5 ~ #9:    reset, open
+ *   zone #10 ~ #14:  reset, open, close
+ *
+ * Resets stay under -r, appends and opens under the zone limits (see zone
+ * state), and contexts come from the I/O pool. Anything that has to wait is
+ * retried by pipe_kick() on the next completion.
+ */
+enum pipe_stage {
+    PIPE_RESET,
+    PIPE_APPEND,
+    PIPE_READ,
+    PIPE_OPEN,
+    PIPE_CLOSE,
+    PIPE_DONE,
+};
+#define PIPE_ZONES 15
+
+struct pipe_zone_t {
+    const enum pipe_stage *stages;
+    uint32_t stage_idx;
+    /* commands of the current stage submitted and completed */
+    uint64_t submitted;
+    uint64_t completed;
+};
+
+static const enum pipe_stage g_pipe_read_stages[] = {PIPE_RESET, PIPE_APPEND, PIPE_READ, PIPE_DONE};
+static const enum pipe_stage g_pipe_open_stages[] = {PIPE_RESET, PIPE_OPEN, PIPE_DONE};
+static const enum pipe_stage g_pipe_close_stages[] = {PIPE_RESET, PIPE_OPEN, PIPE_CLOSE, PIPE_DONE};
+
+struct pipe_zone_t g_pipe[PIPE_ZONES];
+uint32_t g_pipe_done = 0;
+/* a command is parked on bdev_io_wait, completions must not submit meanwhile */
+bool g_pipe_io_wait = false;
+
+static void pipe_kick(void *arg);
+
+static enum pipe_stage
+pipe_stage(uint64_t zone)
+{
+    return g_pipe[zone].stages[g_pipe[zone].stage_idx];
+}
+
+static uint64_t
+pipe_stage_cmds(enum pipe_stage stage)
+{
+    return stage == PIPE_APPEND ? g_append_per_zone : 1;
+}
+
+static void
+pipe_done(struct request_context_t *req_context)
+{
+    printf("Pipeline complete: %.3f ms\n",
+           (double)(spdk_get_ticks() - g_flow_tick) * 1000 / spdk_get_ticks_hz());
+    append_log_print();
+    if (g_verify) {
+        printf("[verify] %lu blocks, %lu mismatches\n", g_verify_blocks, g_verify_mismatches);
+    }
+    zone_table_print(0, PIPE_ZONES);
+    zone_sm_print();
+    appstop_success(req_context);
+}
+
+/* The zone finished its current stage, move it on */
+static void
+pipe_stage_next(uint64_t zone)
+{
+    struct pipe_zone_t *pz = &g_pipe[zone];
+
+    pz->stage_idx++;
+    pz->submitted = 0;
+    pz->completed = 0;
+    if (pipe_stage(zone) == PIPE_DONE) {
+        g_pipe_done++;
+    }
+}
+
+static void
+pipe_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct io_ctx_t *ctx = cb_arg;
+    struct request_context_t *req_context = ctx->req_context;
+    uint64_t zone = ctx->offset_blocks / g_zone_sz_blk;
+    enum pipe_stage stage = pipe_stage(zone);
+
+    if (success && stage == PIPE_APPEND) {
+        success = append_log_complete(zone, ctx->piece,
+                                      spdk_min(g_append_blk, g_io_blk - ctx->piece * g_append_blk),
+                                      spdk_bdev_io_get_append_location(bdev_io));
+    }
+    spdk_bdev_free_io(bdev_io);
+
+    if (!success) {
+        SPDK_ERRLOG("bdev io error in zone #%lu\n", zone);
+        io_ctx_put(ctx);
+        appstop_error(req_context);
+        return;
+    }
+    if (stage == PIPE_READ) {
+        if (g_verify) {
+            read_zone_verify(ctx);
+        } else {
+            printf("read 0x%lx: %s", ctx->offset_blocks, (char *)ctx->buf);
+        }
+    }
+    io_ctx_put(ctx);
+
+    if (stage == PIPE_RESET) {
+        reset_outstanding--;
+    } else if (stage == PIPE_APPEND || stage == PIPE_OPEN) {
+        zone_sm_io_done(zone);
+    }
+    if (++g_pipe[zone].completed == pipe_stage_cmds(stage)) {
+        pipe_stage_next(zone);
+    }
+
+    if (g_pipe_done == PIPE_ZONES) {
+        pipe_done(req_context);
+    } else {
+        pipe_kick(req_context);
+    }
+}
+
+/* Submit the next command of zone's current stage */
+static int
+pipe_submit(struct request_context_t *req_context, uint64_t zone)
+{
+    struct pipe_zone_t *pz = &g_pipe[zone];
+    enum pipe_stage stage = pipe_stage(zone);
+    uint64_t lba = zone * g_zone_sz_blk;
+    uint64_t num_blocks = 0;
+    struct io_ctx_t *ctx;
+    int rc = 0;
+
+    switch (stage) {
+    case PIPE_RESET:
+        if (reset_outstanding >= g_reset_qd) {
+            return -EAGAIN;
+        }
+        break;
+    case PIPE_APPEND:
+        num_blocks = spdk_min(g_append_blk, g_io_blk - pz->submitted * g_append_blk);
+        /* fall through */
+    case PIPE_OPEN:
+        rc = zone_sm_admit(req_context, zone, pipe_kick);
+        if (rc) {
+            return rc;
+        }
+        break;
+    case PIPE_CLOSE:
+        if (!zone_is_open(g_zones[zone].state)) {
+            /* already closed to make room for another zone */
+            pipe_stage_next(zone);
+            return 0;
+        }
+        break;
+    default:
+        break;
+    }
+
+    ctx = io_ctx_get(req_context);
+    if (!ctx) {
+        return -EAGAIN;
+    }
+    ctx->offset_blocks = lba;
+    ctx->piece = pz->submitted;
+    switch (stage) {
+    case PIPE_RESET:
+        rc = spdk_bdev_zone_management(req_context->bdev_desc, req_context->bdev_io_channel,
+                                       lba, SPDK_BDEV_ZONE_RESET, pipe_complete, ctx);
+        break;
+    case PIPE_APPEND:
+        rc = spdk_bdev_zone_append(req_context->bdev_desc, req_context->bdev_io_channel,
+                                   append_piece_buf(ctx, zone, num_blocks),
+                                   lba, num_blocks, pipe_complete, ctx);
+        break;
+    case PIPE_READ:
+        memset(ctx->buf, 0, req_context->buff_size);
+        rc = spdk_bdev_read_blocks(req_context->bdev_desc, req_context->bdev_io_channel,
+                                   ctx->buf, lba, g_io_blk, pipe_complete, ctx);
+        break;
+    case PIPE_OPEN:
+        rc = spdk_bdev_zone_management(req_context->bdev_desc, req_context->bdev_io_channel,
+                                       lba, SPDK_BDEV_ZONE_OPEN, pipe_complete, ctx);
+        break;
+    case PIPE_CLOSE:
+        rc = spdk_bdev_zone_management(req_context->bdev_desc, req_context->bdev_io_channel,
+                                       lba, SPDK_BDEV_ZONE_CLOSE, pipe_complete, ctx);
+        break;
+    default:
+        rc = -EINVAL;
+        break;
+    }
+    if (rc) {
+        io_ctx_put(ctx);
+        return rc;
+    }
+
+    pz->submitted++;
+    switch (stage) {
+    case PIPE_RESET:
+        zone_sm_action(zone, SPDK_BDEV_ZONE_RESET);
+        reset_outstanding++;
+        break;
+    case PIPE_APPEND:
+        zone_sm_write(zone, num_blocks);
+        g_zone_sm[zone].inflight++;
+        zone_sm_hold(zone, pz->submitted < g_append_per_zone);
+        break;
+    case PIPE_OPEN:
+        zone_sm_action(zone, SPDK_BDEV_ZONE_OPEN);
+        g_zone_sm[zone].inflight++;
+        break;
+    case PIPE_CLOSE:
+        zone_sm_action(zone, SPDK_BDEV_ZONE_CLOSE);
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+static void
+pipe_kick_resume(void *arg)
+{
+    g_pipe_io_wait = false;
+    pipe_kick(arg);
+}
+
+/* Submit whatever every zone can run now */
+static void
+pipe_kick(void *arg)
+{
+    struct request_context_t *req_context = arg;
+    int rc;
+
+    if (g_pipe_io_wait) {
+        /* pipe_kick_resume() submits everything once the bdev_io is back */
+        return;
+    }
+    for (uint64_t zone = 0; zone < PIPE_ZONES; zone++) {
+        while (pipe_stage(zone) != PIPE_DONE &&
+               g_pipe[zone].submitted < pipe_stage_cmds(pipe_stage(zone))) {
+            rc = pipe_submit(req_context, zone);
+            if (rc == -EAGAIN) {
+                /* out of a shared resource, the other zones may still go */
+                break;
+            } else if (rc == -ENOMEM) {
+                SPDK_NOTICELOG("Queueing io\n");
+                g_pipe_io_wait = true;
+                queue_io_wait_with_cb(req_context, pipe_kick_resume);
+                return;
+            } else if (rc) {
+                SPDK_ERRLOG("%s error in zone #%lu: %d\n", spdk_strerror(-rc), zone, rc);
+                appstop_error(req_context);
+                return;
+            }
+        }
+    }
+    if (g_pipe_done == PIPE_ZONES) {
+        /* every remaining stage was a close with nothing to close */
+        pipe_done(req_context);
+    }
+}
+
+static void
+pipeline(struct request_context_t *req_context)
+{
+    printf("Pipeline zone #0 ~ zone #%u...\n", PIPE_ZONES - 1);
+
+    g_num_io = 5;
+    for (uint64_t zone = 0; zone < PIPE_ZONES; zone++) {
+        g_pipe[zone].stages = zone < 5 ? g_pipe_read_stages :
+                              zone < 10 ? g_pipe_open_stages : g_pipe_close_stages;
+    }
+    pipe_kick(req_context);
+}
+/* pipeline end */
+
+
+/* zone mgmt bench start */
+/* -A: each selected action runs -n times over zones #0 ~ #(-z - 1), -q at a
+ * time. Actions that need the zone in another state get an untimed prep step
+ * before them and an untimed undo step after, so every round starts and ends
+ * with the zones empty:
+ *
+ *   open:      open,            close (undo)
+ *   close:     open (prep),     close
+ *   finish:    finish,          reset (undo)
+ *   reset:     finish (prep),   reset
+ *   reset-all: finish (prep),   reset of every zone at once, timed as one op
+ *   offline:   offline of the last -n zones, they stay offline
+ */
+enum bench_action {
+    BENCH_OPEN,
+    BENCH_CLOSE,
+    BENCH_FINISH,
+    BENCH_RESET,
+    BENCH_RESET_ALL,
+    BENCH_OFFLINE,
+    BENCH_COUNT,
+};
+
+struct bench_action_t {
+    const char *name;
+    enum spdk_bdev_zone_action action;
+    bool has_prep;
+    enum spdk_bdev_zone_action prep;
+    bool has_undo;
+    enum spdk_bdev_zone_action undo;
+    /* the whole round is a single sample, all zones in flight */
+    bool whole_batch;
+    /* zones are not reusable afterwards, the device may also refuse */
+    bool consumes;
+};
+
+static const struct bench_action_t g_bench_actions[BENCH_COUNT] = {
+    [BENCH_OPEN] = {"open", SPDK_BDEV_ZONE_OPEN, false, 0, true, SPDK_BDEV_ZONE_CLOSE, false, false},
+    [BENCH_CLOSE] = {"close", SPDK_BDEV_ZONE_CLOSE, true, SPDK_BDEV_ZONE_OPEN, false, 0, false, false},
+    [BENCH_FINISH] = {"finish", SPDK_BDEV_ZONE_FINISH, false, 0, true, SPDK_BDEV_ZONE_RESET, false, false},
+    [BENCH_RESET] = {"reset", SPDK_BDEV_ZONE_RESET, true, SPDK_BDEV_ZONE_FINISH, false, 0, false, false},
+    [BENCH_RESET_ALL] = {"reset-all", SPDK_BDEV_ZONE_RESET, true, SPDK_BDEV_ZONE_FINISH, false, 0, true, false},
+    [BENCH_OFFLINE] = {"offline", SPDK_BDEV_ZONE_OFFLINE, false, 0, false, 0, false, true},
+};
+
+enum bench_step {
+    BENCH_STEP_INIT,        /* reset the whole range once before the first action */
+    BENCH_STEP_PREP,
+    BENCH_STEP_TIMED,
+    BENCH_STEP_UNDO,
+};
+
+struct bench_stats_t {
+    struct spdk_histogram_data *histogram;
+    uint64_t count;
+    uint64_t failed;
+    uint64_t total_ticks;
+    uint64_t max_ticks;
+    /* wall time of the timed steps, ops/s is measured against it */
+    uint64_t busy_ticks;
+};
+
+struct bench_io_t {
+    struct request_context_t *req_context;
+    uint64_t zone;
+    uint64_t submit_tick;
+};
+
+struct bench_t {
+    /* BENCH_COUNT during the initial reset, before the first action */
+    enum bench_action action;
+    enum bench_step step;
+    /* timed ops still to run for the current action */
+    uint64_t remaining;
+    /* zones of the current round */
+    uint64_t first;
+    uint64_t batch;
+    uint64_t next;
+    uint64_t completed;
+    uint32_t outstanding;
+    bool io_wait;
+    uint64_t step_tick;
+};
+
+struct bench_t g_bench;
+struct bench_stats_t g_bench_stats[BENCH_COUNT];
+struct bench_io_t *g_bench_ios = NULL;
+
+static void bench_step_submit(void *arg);
+static void bench_step_start(struct request_context_t *req_context);
+
+struct latency_pctl_ctx {
+    const double *pctl;
+    uint64_t *ticks;
+    uint32_t num_pctl;
+    uint32_t idx;
+};
+
+static void
+latency_pctl_cb(void *ctx, uint64_t start, uint64_t end, uint64_t count,
+                uint64_t total, uint64_t so_far)
+{
+    struct latency_pctl_ctx *pctl_ctx = ctx;
+
+    /* so_far includes this bucket, so its upper bound covers every percentile reached */
+    while (pctl_ctx->idx < pctl_ctx->num_pctl &&
+           (double)so_far >= total * pctl_ctx->pctl[pctl_ctx->idx] / 100) {
+        pctl_ctx->ticks[pctl_ctx->idx++] = end;
+    }
+}
+
+/* Fill ticks[i] with the pctl[i] percentile of stats */
+static void
+latency_percentiles(const struct bench_stats_t *stats, const double *pctl, uint64_t *ticks,
+                    uint32_t num_pctl)
+{
+    struct latency_pctl_ctx ctx;
+
+    for (uint32_t i = 0; i < num_pctl; i++) {
+        ticks[i] = stats->max_ticks;
+    }
+    ctx.pctl = pctl;
+    ctx.ticks = ticks;
+    ctx.num_pctl = num_pctl;
+    ctx.idx = 0;
+    spdk_histogram_data_iterate(stats->histogram, latency_pctl_cb, &ctx);
+}
+
+static int
+bench_parse_actions(const char *arg)
+{
+    char *list, *tok, *save = NULL;
+    int rc = 0, a;
+
+    list = strdup(arg);
+    if (!list) {
+        return -ENOMEM;
+    }
+    for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if (!strcmp(tok, "all")) {
+            /* offline is destructive, it only runs when named */
+            g_bench_mask |= (1u << BENCH_COUNT) - 1 - (1u << BENCH_OFFLINE);
+            continue;
+        }
+        for (a = 0; a < BENCH_COUNT; a++) {
+            if (!strcmp(tok, g_bench_actions[a].name)) {
+                g_bench_mask |= 1u << a;
+                break;
+            }
+        }
+        if (a == BENCH_COUNT) {
+            fprintf(stderr, "Unknown zone action: %s\n", tok);
+            rc = -EINVAL;
+            break;
+        }
+    }
+    free(list);
+    if (rc == 0 && g_bench_mask == 0) {
+        fprintf(stderr, "No zone action in -A: %s\n", arg);
+        rc = -EINVAL;
+    }
+    return rc;
+}
+
+static void
+bench_print(void)
+{
+    static const double pctl[] = {50, 99, 99.9};
+    uint64_t ticks[SPDK_COUNTOF(pctl)];
+    double us_per_tick = 1000.0 * 1000.0 / spdk_get_ticks_hz();
+    struct bench_stats_t *stats;
+
+    printf("[zone mgmt] %lu zones, qd %u, latency in us\n", g_bench_zones, g_bench_qd);
+    printf("%10s %10s %8s %10s %10s %10s %10s %10s %10s\n", "action", "count", "failed",
+           "ops/s", "avg", "p50", "p99", "p99.9", "max");
+    for (int a = 0; a < BENCH_COUNT; a++) {
+        stats = &g_bench_stats[a];
+        if (!(g_bench_mask & (1u << a)) || (stats->count == 0 && stats->failed == 0)) {
+            continue;
+        }
+        if (stats->count == 0) {
+            /* every one refused, nothing to time */
+            printf("%10s %10lu %8lu %10s %10s %10s %10s %10s %10s\n", g_bench_actions[a].name,
+                   stats->count, stats->failed, "-", "-", "-", "-", "-", "-");
+            continue;
+        }
+        latency_percentiles(stats, pctl, ticks, SPDK_COUNTOF(pctl));
+        printf("%10s %10lu %8lu %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+               g_bench_actions[a].name, stats->count, stats->failed,
+               stats->count * spdk_get_ticks_hz() / (double)spdk_max(stats->busy_ticks, 1),
+               (double)stats->total_ticks / stats->count * us_per_tick,
+               ticks[0] * us_per_tick, ticks[1] * us_per_tick, ticks[2] * us_per_tick,
+               stats->max_ticks * us_per_tick);
+    }
+}
+
+static void
+bench_record(struct bench_stats_t *stats, uint64_t ticks)
+{
+    spdk_histogram_data_tally(stats->histogram, ticks);
+    stats->count++;
+    stats->total_ticks += ticks;
+    stats->max_ticks = spdk_max(stats->max_ticks, ticks);
+}
+
+static void
+bench_done(struct request_context_t *req_context)
+{
+    printf("Zone management benchmark complete\n");
+    bench_print();
+    appstop_success(req_context);
+}
+
+/* How many of the first batch zones can be open at once, next to the zones
+ * already open or active outside of them
+ */
+static uint64_t
+bench_open_room(uint64_t batch)
+{
+    uint32_t open = g_open_cnt, active = g_active_cnt;
+
+    for (uint64_t i = 0; i < batch; i++) {
+        open -= zone_is_open(g_zones[i].state);
+        active -= zone_is_active(g_zones[i].state);
+    }
+    if (g_max_open_zone) {
+        batch = spdk_min(batch, g_max_open_zone - spdk_min(open, g_max_open_zone));
+    }
+    if (g_max_active_zone) {
+        batch = spdk_min(batch, g_max_active_zone - spdk_min(active, g_max_active_zone));
+    }
+    return batch;
+}
+
+/* Start the next round of the current action, or move on to the next action */
+static void
+bench_round_start(struct request_context_t *req_context)
+{
+    const struct bench_action_t *act;
+    int a;
+
+    while (g_bench.remaining == 0) {
+        /* the initial reset hands over to the first action of the mask */
+        a = g_bench.action == BENCH_COUNT ? 0 : g_bench.action + 1;
+        while (a < BENCH_COUNT && !(g_bench_mask & (1u << a))) {
+            a++;
+        }
+        g_bench.action = a;
+        if (g_bench.action == BENCH_COUNT) {
+            bench_done(req_context);
+            return;
+        }
+        g_bench.remaining = g_bench_count;
+        printf("Zone %s x%lu...\n", g_bench_actions[g_bench.action].name, g_bench_count);
+    }
+
+    act = &g_bench_actions[g_bench.action];
+    g_bench.first = 0;
+    if (act->whole_batch) {
+        g_bench.batch = g_bench_zones;
+    } else if (act->consumes) {
+        g_bench.first = g_bench_zones - g_bench.remaining;
+        g_bench.batch = g_bench.remaining;
+    } else {
+        g_bench.batch = spdk_min(g_bench_zones, g_bench.remaining);
+        if (g_bench.action == BENCH_OPEN || g_bench.action == BENCH_CLOSE) {
+            /* explicitly opened zones count against the open and active limits */
+            g_bench.batch = bench_open_room(g_bench.batch);
+            if (g_bench.batch == 0) {
+                SPDK_ERRLOG("no zone can be opened: %u/%u open, %u/%u active outside the round\n",
+                            g_open_cnt, g_max_open_zone, g_active_cnt, g_max_active_zone);
+                appstop_error(req_context);
+                return;
+            }
+        }
+    }
+    g_bench.step = act->has_prep ? BENCH_STEP_PREP : BENCH_STEP_TIMED;
+    bench_step_start(req_context);
+}
+
+/* The action of the current step, NULL during the initial reset */
+static const struct bench_action_t *
+bench_cur_action(void)
+{
+    return g_bench.action < BENCH_COUNT ? &g_bench_actions[g_bench.action] : NULL;
+}
+
+static struct bench_stats_t *
+bench_cur_stats(void)
+{
+    return g_bench.action < BENCH_COUNT ? &g_bench_stats[g_bench.action] : NULL;
+}
+
+static void
+bench_step_done(struct request_context_t *req_context)
+{
+    const struct bench_action_t *act = bench_cur_action();
+    struct bench_stats_t *stats = bench_cur_stats();
+    uint64_t ticks = spdk_get_ticks() - g_bench.step_tick;
+
+    switch (g_bench.step) {
+    case BENCH_STEP_INIT:
+        bench_round_start(req_context);
+        return;
+    case BENCH_STEP_PREP:
+        g_bench.step = BENCH_STEP_TIMED;
+        bench_step_start(req_context);
+        return;
+    case BENCH_STEP_TIMED:
+        stats->busy_ticks += ticks;
+        if (act->whole_batch) {
+            bench_record(stats, ticks);
+            g_bench.remaining--;
+        } else {
+            g_bench.remaining -= g_bench.batch;
+        }
+        if (act->has_undo) {
+            g_bench.step = BENCH_STEP_UNDO;
+            bench_step_start(req_context);
+            return;
+        }
+        break;
+    case BENCH_STEP_UNDO:
+        break;
+    }
+    bench_round_start(req_context);
+}
+
+static enum spdk_bdev_zone_action
+bench_step_action(void)
+{
+    const struct bench_action_t *act = bench_cur_action();
+
+    switch (g_bench.step) {
+    case BENCH_STEP_PREP:
+        return act->prep;
+    case BENCH_STEP_TIMED:
+        return act->action;
+    case BENCH_STEP_UNDO:
+        return act->undo;
+    case BENCH_STEP_INIT:
+    default:
+        return SPDK_BDEV_ZONE_RESET;
+    }
+}
+
+static void
+bench_io_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct bench_io_t *io = cb_arg;
+    struct request_context_t *req_context = io->req_context;
+    const struct bench_action_t *act = bench_cur_action();
+    struct bench_stats_t *stats = bench_cur_stats();
+    bool timed = g_bench.step == BENCH_STEP_TIMED;
+
+    spdk_bdev_free_io(bdev_io);
+    g_bench.outstanding--;
+    g_bench.completed++;
+
+    if (timed && success && !act->whole_batch) {
+        bench_record(stats, spdk_get_ticks() - io->submit_tick);
+    }
+    if (success) {
+        /* untimed steps move zones too, keep the host zone table in step */
+        zone_sm_action(io->zone, bench_step_action());
+    } else if (timed && act->consumes) {
+        /* devices only take zones offline from read only, count a refusal */
+        stats->failed++;
+    } else {
+        SPDK_ERRLOG("zone %s of zone #%lu failed\n",
+                    timed ? act->name : "prep/undo", io->zone);
+        appstop_error(req_context);
+        return;
+    }
+
+    if (g_bench.completed == g_bench.batch) {
+        bench_step_done(req_context);
+    } else if (!g_bench.io_wait) {
+        bench_step_submit(req_context);
+    }
+}
+
+static void
+bench_step_resume(void *arg)
+{
+    g_bench.io_wait = false;
+    bench_step_submit(arg);
+}
+
+static void
+bench_step_submit(void *arg)
+{
+    struct request_context_t *req_context = arg;
+    const struct bench_action_t *act = bench_cur_action();
+    enum spdk_bdev_zone_action action = bench_step_action();
+    uint32_t qd = g_bench_qd;
+    struct bench_io_t *io;
+    int rc = 0;
+
+    if (g_bench.step == BENCH_STEP_TIMED && act->whole_batch) {
+        qd = g_bench.batch;
+    }
+    for (; g_bench.next < g_bench.batch && g_bench.outstanding < qd; g_bench.next++) {
+        io = &g_bench_ios[g_bench.next];
+        io->req_context = req_context;
+        io->zone = g_bench.first + g_bench.next;
+        io->submit_tick = spdk_get_ticks();
+        rc = spdk_bdev_zone_management(req_context->bdev_desc, req_context->bdev_io_channel,
+                                       io->zone * g_zone_sz_blk, action,
+                                       bench_io_complete, io);
+        if (rc == -ENOMEM) {
+            SPDK_NOTICELOG("Queueing io\n");
+            g_bench.io_wait = true;
+            queue_io_wait_with_cb(req_context, bench_step_resume);
+            return;
+        } else if (rc) {
+            SPDK_ERRLOG("%s error while managing zone: %d\n", spdk_strerror(-rc), rc);
+            appstop_error(req_context);
+            return;
+        }
+        g_bench.outstanding++;
+    }
+}
+
+static void
+bench_step_start(struct request_context_t *req_context)
+{
+    g_bench.next = 0;
+    g_bench.completed = 0;
+    g_bench.step_tick = spdk_get_ticks();
+    bench_step_submit(req_context);
+}
+
+static void
+bench_start(struct request_context_t *req_context)
+{
+    if (g_bench_zones > g_num_zone) {
+        SPDK_ERRLOG("-z %lu is more than the %lu zones of the bdev\n", g_bench_zones, g_num_zone);
+        appstop_error(req_context);
+        return;
+    }
+    if ((g_bench_mask & (1u << BENCH_OFFLINE)) && g_bench_count > g_bench_zones) {
+        SPDK_ERRLOG("offline needs -n %lu zones, only %lu in range (-z)\n",
+                    g_bench_count, g_bench_zones);
+        appstop_error(req_context);
+        return;
+    }
+    for (uint64_t i = 0; i < g_bench_zones; i++) {
+        if (g_zones[i].state == SPDK_BDEV_ZONE_STATE_OFFLINE ||
+            g_zones[i].state == SPDK_BDEV_ZONE_STATE_READ_ONLY) {
+            SPDK_ERRLOG("zone #%lu is %s, pick a range without it\n", i,
+                        zone_state_name(g_zones[i].state));
+            appstop_error(req_context);
+            return;
+        }
+    }
+
+    g_bench_ios = calloc(g_bench_zones, sizeof(struct bench_io_t));
+    if (!g_bench_ios) {
+        SPDK_ERRLOG("Failed to allocate benchmark contexts\n");
+        appstop_error(req_context);
+        return;
+    }
+    for (int a = 0; a < BENCH_COUNT; a++) {
+        g_bench_stats[a].histogram = spdk_histogram_data_alloc();
+        if (!g_bench_stats[a].histogram) {
+            SPDK_ERRLOG("Failed to allocate latency histogram\n");
+            appstop_error(req_context);
+            return;
+        }
+    }
+
+    printf("Reset zone #0 ~ zone #%lu before the benchmark...\n", g_bench_zones - 1);
+    g_bench.action = BENCH_COUNT;
+    g_bench.remaining = 0;
+    g_bench.first = 0;
+    g_bench.batch = g_bench_zones;
+    g_bench.step = BENCH_STEP_INIT;
+    bench_step_start(req_context);
+}
+/* zone mgmt bench end */
+
 /* get zone info start */
+static void get_zone_info_batch(void *arg);
+
 static void
 get_zone_info_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 {
@@ -336,55 +1858,93 @@ get_zone_info_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 
     /* Complete the I/O */
     spdk_bdev_free_io(bdev_io);
-    
-    if (success) {
-        printf("Get zone info complete\n");
-
-        g_zone_capacity = zone_info.capacity;
-        g_num_zone = spdk_bdev_get_num_zones(req_context->bdev);
-        g_zone_sz_blk = spdk_bdev_get_zone_size(req_context->bdev);
-        g_max_open_zone = spdk_bdev_get_max_open_zones(req_context->bdev);
-        g_max_active_zone = spdk_bdev_get_max_active_zones(req_context->bdev);
-        g_max_append_blk = spdk_bdev_get_max_zone_append_size(req_context->bdev);
-        printf("[zone info]\n");
-        printf("num zone: %lu zones\n", g_num_zone);
-        printf("zone size: %lu blocks\n", g_zone_sz_blk);
-        printf("zone capacity: %lu blocks\n", g_zone_capacity);
-        printf("max open zone: %u zones\n", g_max_open_zone);
-        printf("max active zone: %u zones\n", g_max_active_zone);
-        printf("max append size: %u blocks\n", g_max_append_blk);
 
-    } else {
-        SPDK_ERRLOG("bdev io reset zone error: %d\n", EIO);
+    if (!success) {
+        SPDK_ERRLOG("bdev io get zone info error: %d\n", EIO);
+        appstop_error(req_context);
+        return;
+    }
+
+    req_context->zone_next += spdk_min(ZONE_REPORT_BATCH, g_num_zone - req_context->zone_next);
+    if (req_context->zone_next < g_num_zone) {
+        get_zone_info_batch(req_context);
+        return;
+    }
+
+    printf("Get zone info complete\n");
+    for (uint64_t i = 0; i < g_num_zone; i++) {
+        g_zone_capacity = spdk_max(g_zone_capacity, g_zones[i].capacity);
+    }
+    printf("[zone info]\n");
+    printf("num zone: %lu zones\n", g_num_zone);
+    printf("zone size: %lu blocks\n", g_zone_sz_blk);
+    printf("zone capacity: %lu blocks (largest)\n", g_zone_capacity);
+    printf("max open zone: %u zones\n", g_max_open_zone);
+    printf("max active zone: %u zones\n", g_max_active_zone);
+    printf("max append size: %u blocks\n", g_max_append_blk);
+    zone_table_print(0, 15);
+    if (zone_sm_init()) {
+        SPDK_ERRLOG("Failed to allocate zone state table\n");
         appstop_error(req_context);
         return;
-    } 
-    reset_zone(req_context); 
+    }
+
+    if (g_bench_mask) {
+        bench_start(req_context);
+        return;
+    }
+    g_flow_tick = spdk_get_ticks();
+    if (g_serial) {
+        reset_zone(req_context);
+    } else {
+        pipeline(req_context);
+    }
 }
 
 static void
-get_zone_info(void *arg)
+get_zone_info_batch(void *arg)
 {
     struct request_context_t *req_context = arg;
     int rc = 0;
 
-    printf("Get zone info...\n");
-
-    /* get first zone to know zone capacity */
-    uint64_t zone_id = 0x4000;
-    size_t num_zones = 1;
+    /* each batch lands directly in its slice of the zone table */
     rc = spdk_bdev_get_zone_info(req_context->bdev_desc, req_context->bdev_io_channel,
-                                zone_id, num_zones, &zone_info,
+                                req_context->zone_next * g_zone_sz_blk,
+                                spdk_min(ZONE_REPORT_BATCH, g_num_zone - req_context->zone_next),
+                                &g_zones[req_context->zone_next],
                                 get_zone_info_complete, req_context);
-    
+
     if (rc == -ENOMEM) {
         SPDK_NOTICELOG("Queueing io\n");
-        queue_io_wait_with_cb(req_context, get_zone_info);
+        queue_io_wait_with_cb(req_context, get_zone_info_batch);
     } else if (rc) {
         SPDK_ERRLOG("%s error while get zone_info: %d\n", spdk_strerror(-rc), rc);
         appstop_error(req_context);
     }
 }
+
+static void
+get_zone_info(void *arg)
+{
+    struct request_context_t *req_context = arg;
+
+    printf("Get zone info...\n");
+
+    g_num_zone = spdk_bdev_get_num_zones(req_context->bdev);
+    g_zone_sz_blk = spdk_bdev_get_zone_size(req_context->bdev);
+    g_max_open_zone = spdk_bdev_get_max_open_zones(req_context->bdev);
+    g_max_active_zone = spdk_bdev_get_max_active_zones(req_context->bdev);
+    g_max_append_blk = spdk_bdev_get_max_zone_append_size(req_context->bdev);
+
+    g_zones = calloc(g_num_zone, sizeof(struct spdk_bdev_zone_info));
+    if (!g_zones) {
+        SPDK_ERRLOG("Failed to allocate zone table\n");
+        appstop_error(req_context);
+        return;
+    }
+    req_context->zone_next = 0;
+    get_zone_info_batch(req_context);
+}
 /* get zone info end */
 
 
@@ -432,11 +1992,38 @@ appstart(void *arg)
     g_num_blk = spdk_bdev_get_num_blocks(req_context->bdev);
     g_block_size = spdk_bdev_get_block_size(req_context->bdev);
 
+    /* Size the appends: the -o bytes written to each zone are split into
+     * appends of at most the max zone append size, both multiples of the
+     * write unit.
+     */
+    uint32_t write_unit = spdk_bdev_get_write_unit_size(req_context->bdev);
+    uint32_t max_append = spdk_bdev_get_max_zone_append_size(req_context->bdev);
+    if (g_io_size == 0) {
+        g_io_size = (uint64_t)g_block_size * write_unit;
+    }
+    if (g_io_size % ((uint64_t)g_block_size * write_unit)) {
+        SPDK_ERRLOG("io size %lu is not a multiple of the write unit (%u bytes)\n",
+                    g_io_size, g_block_size * write_unit);
+        appstop_error(req_context);
+        return;
+    }
+    g_io_blk = g_io_size / g_block_size;
+    g_append_blk = g_io_blk;
+    if (max_append && g_append_blk > max_append) {
+        g_append_blk = spdk_max(max_append / write_unit, 1) * write_unit;
+    }
+    g_append_per_zone = SPDK_CEIL_DIV(g_io_blk, g_append_blk);
+    if (append_log_init() != 0) {
+        SPDK_ERRLOG("Failed to allocate append log\n");
+        appstop_error(req_context);
+        return;
+    }
+
     /* Allocate memory for the write buffer.
      * Initialize the write buffer with the string "Hello World!"
      */
     uint32_t buf_align = spdk_bdev_get_buf_align(req_context->bdev);
-    req_context->buff_size = g_block_size * spdk_bdev_get_write_unit_size(req_context->bdev);
+    req_context->buff_size = g_block_size * g_io_blk;
     req_context->buff = spdk_zmalloc(req_context->buff_size, buf_align, NULL,
                     SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
 
@@ -446,6 +2033,28 @@ appstart(void *arg)
         return;
     }
     snprintf(req_context->buff, req_context->buff_size, "%s", "Hello World!\n");
+    if (g_verify) {
+        /* the text moves behind the header, which append_piece_buf() fills in per zone */
+        for (uint64_t i = 0; i < g_io_blk; i++) {
+            char *block = req_context->buff + i * g_block_size;
+
+            snprintf(block + sizeof(struct verify_hdr_t), g_block_size - sizeof(struct verify_hdr_t),
+                     "%s", "Hello World!\n");
+        }
+    }
+
+    /* Read buffers, one per read in flight */
+    g_buf_align = buf_align;
+    g_ctx_pool = spdk_mempool_create("iocmd_ctx", IO_POOL_SIZE, sizeof(struct io_ctx_t), 0,
+                                     spdk_env_get_socket_id(spdk_env_get_current_core()));
+    g_buf_pool = spdk_mempool_create("iocmd_buf", IO_POOL_SIZE,
+                                     req_context->buff_size + buf_align - 1, 0,
+                                     spdk_env_get_socket_id(spdk_env_get_current_core()));
+    if (!g_ctx_pool || !g_buf_pool) {
+        SPDK_ERRLOG("Failed to allocate I/O pools\n");
+        appstop_error(req_context);
+        return;
+    }
 
     get_zone_info(req_context);
 
@@ -457,6 +2066,7 @@ appstart(void *arg)
      * read x5              (zone #0 ~ zone #4)
      * zone send open x5    (zone #5 ~ zone #9)
      * zone send close x5   (zone #10 ~ zone #14)
+     * with -s each step waits for the last, otherwise each zone moves on alone
      */
 }
 
@@ -471,7 +2081,7 @@ main(int argc, char **argv)
     opts.name = "bdev_iocmd";
 
     /* Parse built-in SPDK command line parameters to enable spdk trace*/
-    if ((rc = spdk_app_parse_args(argc, argv, &opts, "b:", NULL, parse_arg,
+    if ((rc = spdk_app_parse_args(argc, argv, &opts, "b:o:r:VsA:n:q:z:", NULL, parse_arg,
                       usage)) != SPDK_APP_PARSE_ARGS_SUCCESS) {
         exit(rc);
     }
@@ -483,6 +2093,21 @@ main(int argc, char **argv)
     }
 
     spdk_free(req_context.buff);
+    if (g_buf_pool) {
+        spdk_mempool_free(g_buf_pool);
+    }
+    if (g_ctx_pool) {
+        spdk_mempool_free(g_ctx_pool);
+    }
+    for (int a = 0; a < BENCH_COUNT; a++) {
+        if (g_bench_stats[a].histogram) {
+            spdk_histogram_data_free(g_bench_stats[a].histogram);
+        }
+    }
+    free(g_bench_ios);
+    free(g_zone_sm);
+    free(g_zones);
+    free(g_append_log);
     spdk_app_fini();
     return rc;
 }
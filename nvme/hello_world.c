@@ -6,13 +6,15 @@
 #include "spdk/env.h"
 #include "spdk/string.h"
 #include "spdk/log.h"
-
-#include "spdk/event.h"
+#include "spdk/util.h"
+#include "spdk/histogram_data.h"
 
 struct ctrlr_entry {
 	struct spdk_nvme_ctrlr		*ctrlr;
 	TAILQ_ENTRY(ctrlr_entry)	link;
 	char				name[1024];
+	/* the benchmark's data buffers are in the CMB */
+	bool				cmb_mapped;
 };
 
 struct ns_entry {
@@ -20,6 +22,10 @@ struct ns_entry {
 	struct spdk_nvme_ns	*ns;
 	TAILQ_ENTRY(ns_entry)	link;
 	struct spdk_nvme_qpair	*qpair;
+	/* zone append benchmark, see bench_ns_setup() */
+	bool			bench;
+	uint32_t		sector_size;
+	uint32_t		io_lbas;
 };
 
 static TAILQ_HEAD(, ctrlr_entry) g_controllers = TAILQ_HEAD_INITIALIZER(g_controllers);
@@ -27,6 +33,24 @@ static TAILQ_HEAD(, ns_entry) g_namespaces = TAILQ_HEAD_INITIALIZER(g_namespaces
 static struct spdk_nvme_transport_id g_trid = {};
 
 static bool g_vmd = false;
+static const char *g_core_mask = NULL;
+
+/* -B: zone append benchmark instead of hello world */
+static bool g_bench = false;
+/* -N: benchmark every ZNS namespace of every controller, not just the first */
+static bool g_bench_all_ns = false;
+static uint32_t g_queue_depth = 32;
+static uint32_t g_io_size = 4096;
+static uint32_t g_time_sec = 10;
+static uint32_t g_zones_per_core = 4;
+static uint32_t g_max_completions = 32;
+static uint32_t g_read_pct = 0;
+/* -P: adaptive polling, sleep up to this long between empty polls, 0 spins */
+static uint32_t g_poll_max_us = 0;
+/* -D: ring the submission doorbell once per poll instead of once per command */
+static bool g_delay_doorbell = false;
+/* -C: data buffers in host memory and/or the controller memory buffer, one bit each */
+static uint32_t g_buf_modes = 1;
 
 static void
 register_ns(struct spdk_nvme_ctrlr *ctrlr, struct spdk_nvme_ns *ns)
@@ -45,6 +69,7 @@ register_ns(struct spdk_nvme_ctrlr *ctrlr, struct spdk_nvme_ns *ns)
 
 	entry->ctrlr = ctrlr;
 	entry->ns = ns;
+	entry->bench = false;
 	TAILQ_INSERT_TAIL(&g_namespaces, entry, link);
 
 	printf("  Namespace ID: %d size: %juGB\n", spdk_nvme_ns_get_id(ns),
@@ -148,7 +173,7 @@ reset_zone_complete(void *arg, const struct spdk_nvme_cpl *completion)
 }
 
 static void
-reset_zone_and_wait_for_completion(struct hello_world_sequence *sequence)
+reset_zone(struct hello_world_sequence *sequence)
 {
 	if (spdk_nvme_zns_reset_zone(sequence->ns_entry->ns, sequence->ns_entry->qpair,
 				     0, /* starting LBA of the zone to reset */
@@ -158,26 +183,55 @@ reset_zone_and_wait_for_completion(struct hello_world_sequence *sequence)
 		fprintf(stderr, "starting reset zone I/O failed\n");
 		exit(1);
 	}
-	while (!sequence->is_completed) {
-		spdk_nvme_qpair_process_completions(sequence->ns_entry->qpair, 0);
-	}
-	sequence->is_completed = 0;
+}
+
+/*
+ * Poll the qpair of every namespace whose sequence hasn't completed yet,
+ *  until none is left.  All namespaces, on all controllers, make progress
+ *  together from this one thread.
+ */
+static void
+wait_for_completions(struct hello_world_sequence *sequences, uint32_t count)
+{
+	uint32_t pending;
+
+	do {
+		pending = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			if (!sequences[i].is_completed) {
+				spdk_nvme_qpair_process_completions(sequences[i].ns_entry->qpair, 0);
+				pending++;
+			}
+		}
+	} while (pending);
 }
 
 static void
 hello_world(void)
 {
 	struct ns_entry			*ns_entry;
-	struct hello_world_sequence	sequence;
+	struct hello_world_sequence	*sequences, *sequence;
+	uint32_t			count = 0, started = 0;
 	int				rc;
 	size_t				sz;
 
 	TAILQ_FOREACH(ns_entry, &g_namespaces, link) {
+		count++;
+	}
+	sequences = calloc(count, sizeof(*sequences));
+	if (sequences == NULL) {
+		printf("ERROR: sequence allocation failed\n");
+		return;
+	}
+
+	TAILQ_FOREACH(ns_entry, &g_namespaces, link) {
+		sequence = &sequences[started];
 		/*
 		 * Allocate an I/O qpair that we can use to submit read/write requests
 		 *  to namespaces on the controller.  NVMe controllers typically support
 		 *  many qpairs per controller.  Any I/O qpair allocated for a controller
-		 *  can submit I/O to any namespace on that controller.
+		 *  can submit I/O to any namespace on that controller.  Each namespace
+		 *  gets its own qpair here so its I/O is tracked on its own.
 		 *
 		 * The SPDK NVMe driver provides no synchronization for qpair accesses -
 		 *  the application must ensure only a single thread submits I/O to a
@@ -188,53 +242,75 @@ hello_world(void)
 		ns_entry->qpair = spdk_nvme_ctrlr_alloc_io_qpair(ns_entry->ctrlr, NULL, 0);
 		if (ns_entry->qpair == NULL) {
 			printf("ERROR: spdk_nvme_ctrlr_alloc_io_qpair() failed\n");
-			return;
+			goto out;
 		}
+		sequence->ns_entry = ns_entry;
+		started++;
 
 		/*
 		 * Use spdk_dma_zmalloc to allocate a 4KB zeroed buffer.  This memory
 		 * will be pinned, which is required for data buffers used for SPDK NVMe
-		 * I/O operations.
+		 * I/O operations.  A controller has one CMB, so only the first of its
+		 * namespaces can put its buffer there.
 		 */
-		sequence.using_cmb_io = 1;
-		sequence.buf = spdk_nvme_ctrlr_map_cmb(ns_entry->ctrlr, &sz);
-		if (sequence.buf == NULL || sz < 0x1000) {
-			sequence.using_cmb_io = 0;
-			sequence.buf = spdk_zmalloc(0x1000, 0x1000, NULL, SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
+		sequence->using_cmb_io = 1;
+		for (uint32_t i = 0; i + 1 < started; i++) {
+			if (sequences[i].using_cmb_io && sequences[i].ns_entry->ctrlr == ns_entry->ctrlr) {
+				sequence->using_cmb_io = 0;
+			}
+		}
+		sequence->buf = NULL;
+		if (sequence->using_cmb_io) {
+			sequence->buf = spdk_nvme_ctrlr_map_cmb(ns_entry->ctrlr, &sz);
+		}
+		if (sequence->buf == NULL || sz < 0x1000) {
+			sequence->using_cmb_io = 0;
+			sequence->buf = spdk_zmalloc(0x1000, 0x1000, NULL, SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
 		}
-		if (sequence.buf == NULL) {
+		if (sequence->buf == NULL) {
 			printf("ERROR: write buffer allocation failed\n");
-			return;
+			goto out;
 		}
-		if (sequence.using_cmb_io) {
-			printf("INFO: using controller memory buffer for IO\n");
+		if (sequence->using_cmb_io) {
+			printf("INFO: using controller memory buffer for IO on namespace %u\n",
+			       spdk_nvme_ns_get_id(ns_entry->ns));
 		} else {
-			printf("INFO: using host memory buffer for IO\n");
+			printf("INFO: using host memory buffer for IO on namespace %u\n",
+			       spdk_nvme_ns_get_id(ns_entry->ns));
 		}
-		sequence.is_completed = 0;
-		sequence.ns_entry = ns_entry;
 
 		/*
 		 * If the namespace is a Zoned Namespace, rather than a regular
 		 * NVM namespace, we need to reset the first zone, before we
 		 * write to it. This not needed for regular NVM namespaces.
+		 * The resets of all namespaces are in flight at the same time.
 		 */
 		if (spdk_nvme_ns_get_csi(ns_entry->ns) == SPDK_NVME_CSI_ZNS) {
-			reset_zone_and_wait_for_completion(&sequence);
+			sequence->is_completed = 0;
+			reset_zone(sequence);
+		} else {
+			sequence->is_completed = 1;
 		}
+	}
+	wait_for_completions(sequences, count);
+
+	for (uint32_t i = 0; i < count; i++) {
+		sequence = &sequences[i];
+		ns_entry = sequence->ns_entry;
+		sequence->is_completed = 0;
 
 		/*
-		 * Print "Hello world!" to sequence.buf.  We will write this data to LBA
+		 * Print "Hello world!" to sequence->buf.  We will write this data to LBA
 		 *  0 on the namespace, and then later read it back into a separate buffer
 		 *  to demonstrate the full I/O path.
 		 */
-		snprintf(sequence.buf, 0x1000, "%s", "Hello world!\n");
+		snprintf(sequence->buf, 0x1000, "%s", "Hello world!\n");
 
 		/*
 		 * Write the data buffer to LBA 0 of this namespace.  "write_complete" and
-		 *  "&sequence" are specified as the completion callback function and
+		 *  "sequence" are specified as the completion callback function and
 		 *  argument respectively.  write_complete() will be called with the
-		 *  value of &sequence as a parameter when the write I/O is completed.
+		 *  value of sequence as a parameter when the write I/O is completed.
 		 *  This allows users to potentially specify different completion
 		 *  callback routines for each I/O, as well as pass a unique handle
 		 *  as an argument so the application knows which I/O has completed.
@@ -244,242 +320,2157 @@ hello_world(void)
 		 *  It is the responsibility of the application to trigger the polling
 		 *  process.
 		 */
-		rc = spdk_nvme_ns_cmd_write(ns_entry->ns, ns_entry->qpair, sequence.buf,
+		rc = spdk_nvme_ns_cmd_write(ns_entry->ns, ns_entry->qpair, sequence->buf,
 					    0, /* LBA start */
 					    1, /* number of LBAs */
-					    write_complete, &sequence, 0);
+					    write_complete, sequence, 0);
 		if (rc != 0) {
 			fprintf(stderr, "starting write I/O failed\n");
 			exit(1);
 		}
+	}
 
-		/*
-		 * Poll for completions.  0 here means process all available completions.
-		 *  In certain usage models, the caller may specify a positive integer
-		 *  instead of 0 to signify the maximum number of completions it should
-		 *  process.  This function will never block - if there are no
-		 *  completions pending on the specified qpair, it will return immediately.
-		 *
-		 * When the write I/O completes, write_complete() will submit a new I/O
-		 *  to read LBA 0 into a separate buffer, specifying read_complete() as its
-		 *  completion routine.  When the read I/O completes, read_complete() will
-		 *  print the buffer contents and set sequence.is_completed = 1.  That will
-		 *  break this loop and then exit the program.
-		 */
-		while (!sequence.is_completed) {
-			spdk_nvme_qpair_process_completions(ns_entry->qpair, 0);
-		}
+	/*
+	 * Poll for completions.  0 here means process all available completions.
+	 *  In certain usage models, the caller may specify a positive integer
+	 *  instead of 0 to signify the maximum number of completions it should
+	 *  process.  This function will never block - if there are no
+	 *  completions pending on the specified qpair, it will return immediately.
+	 *
+	 * When a write I/O completes, write_complete() will submit a new I/O
+	 *  to read LBA 0 into a separate buffer, specifying read_complete() as its
+	 *  completion routine.  When the read I/O completes, read_complete() will
+	 *  print the buffer contents and set sequence->is_completed = 1.  Once
+	 *  every namespace got there, wait_for_completions() returns.
+	 */
+	wait_for_completions(sequences, count);
 
-		/*
-		 * Free the I/O qpair.  This typically is done when an application exits.
-		 *  But SPDK does support freeing and then reallocating qpairs during
-		 *  operation.  It is the responsibility of the caller to ensure all
-		 *  pending I/O are completed before trying to free the qpair.
-		 */
-		spdk_nvme_ctrlr_free_io_qpair(ns_entry->qpair);
+out:
+	/*
+	 * Free the I/O qpairs.  This typically is done when an application exits.
+	 *  But SPDK does support freeing and then reallocating qpairs during
+	 *  operation.  It is the responsibility of the caller to ensure all
+	 *  pending I/O are completed before trying to free the qpair.
+	 */
+	for (uint32_t i = 0; i < started; i++) {
+		spdk_nvme_ctrlr_free_io_qpair(sequences[i].ns_entry->qpair);
 	}
+	free(sequences);
 }
 
-static bool
-probe_cb(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
-	 struct spdk_nvme_ctrlr_opts *opts)
+/*
+ * Zone append benchmark (-B).
+ *
+ * One thread per core in the core mask.  A core runs one worker per
+ *  benchmarked ZNS namespace, the first one found or with -N every one on
+ *  every attached controller, and polls all of its workers in turn.  Each
+ *  worker has its own I/O qpair and its own set of zones on its namespace:
+ *  core N gets zones [N * zones_per_core, (N + 1) * zones_per_core).  Every
+ *  worker keeps g_queue_depth I/Os in flight: zone appends, moving to its
+ *  next zone when one is fully handed out and resetting a zone once all I/O
+ *  to it has completed, and with -R that percentage of reads of data
+ *  already written.  Completions are reaped at most g_max_completions per
+ *  spdk_nvme_qpair_process_completions() call.  Nothing here goes through
+ *  the bdev layer or an SPDK thread, so this is the driver's baseline.
+ *  Results are reported per core, per namespace and in total.
+ *
+ * The data buffers come from host DMA memory, from the controller memory
+ *  buffer of each controller, or (-C both) the same run is done once with
+ *  each.
+ *
+ * With -P the core adapts to its load instead of spinning: every pass over
+ *  its qpairs that reaps nothing doubles a sleep of up to -P us before the
+ *  next one, every pass that reaps halves it, and each qpair's completion
+ *  budget grows while its polls come back full and shrinks while they come
+ *  back mostly empty.  With -D commands submitted from completion callbacks
+ *  share one doorbell write at the end of the poll.
+ */
+enum bench_op {
+	BENCH_OP_APPEND,
+	BENCH_OP_READ,
+	BENCH_OP_COUNT,
+};
+static const char *g_bench_op_name[BENCH_OP_COUNT] = { "append", "read" };
+
+enum bench_buf {
+	BENCH_BUF_HOST,
+	BENCH_BUF_CMB,
+	BENCH_BUF_COUNT,
+};
+static const char *g_bench_buf_name[BENCH_BUF_COUNT] = { "host memory", "controller memory buffer" };
+
+struct bench_worker;
+
+struct bench_zone {
+	struct bench_worker	*worker;
+	uint64_t		zslba;
+	uint64_t		zcap;
+	/* LBAs handed out to appends, the device picks where they land */
+	uint64_t		submitted;
+	/* LBAs whose appends completed, reads stay below this */
+	uint64_t		written;
+	uint32_t		outstanding;
+	bool			ready;
+};
+
+struct bench_task {
+	struct bench_worker	*worker;
+	struct bench_zone	*zone;
+	enum bench_op		op;
+	void			*buf;
+	/* reads only, appends go to the zone start */
+	uint64_t		lba;
+	uint32_t		lba_count;
+	uint64_t		submit_tsc;
+	TAILQ_ENTRY(bench_task)	link;
+};
+
+struct bench_op_stats {
+	uint64_t			ios;
+	uint64_t			bytes;
+	uint64_t			total_tsc;
+	uint64_t			max_tsc;
+	struct spdk_histogram_data	*histogram;
+};
+
+struct bench_core;
+
+/* One namespace driven from one core */
+struct bench_worker {
+	struct bench_core	*core;
+	struct ns_entry		*ns_entry;
+	struct spdk_nvme_qpair	*qpair;
+	struct bench_zone	*zones;
+	uint32_t		num_zones;
+	uint32_t		first_zone;
+	uint32_t		cur_zone;
+	struct bench_task	*tasks;
+	/* tasks waiting for a zone to come back from reset */
+	TAILQ_HEAD(, bench_task) idle_tasks;
+	uint32_t		outstanding;
+	uint32_t		resets_outstanding;
+	uint64_t		resets;
+	struct bench_op_stats	stats[BENCH_OP_COUNT];
+	uint64_t		start_tsc;
+	uint64_t		end_tsc;
+	/* adaptive completion budget, see bench_budget_adapt() */
+	uint32_t		budget;
+	unsigned int		seed;
+	bool			stop;
+	int			rc;
+	TAILQ_ENTRY(bench_worker) link;
+	TAILQ_ENTRY(bench_worker) core_link;
+};
+
+struct bench_core {
+	uint32_t		lcore;
+	TAILQ_HEAD(, bench_worker) workers;
+	uint64_t		start_tsc;
+	uint64_t		end_tsc;
+	/* time in passes that reaped something, and CPU time the thread used */
+	uint64_t		busy_tsc;
+	uint64_t		cpu_usec;
+	uint64_t		polls;
+	uint64_t		sleeps;
+	/* adaptive polling state, see bench_poll_sleep() */
+	uint32_t		sleep_us;
+	TAILQ_ENTRY(bench_core)	link;
+};
+
+static TAILQ_HEAD(, bench_core) g_cores = TAILQ_HEAD_INITIALIZER(g_cores);
+static TAILQ_HEAD(, bench_worker) g_workers = TAILQ_HEAD_INITIALIZER(g_workers);
+
+static void bench_task_submit(struct bench_task *task);
+
+static void
+bench_reset_done(void *arg, const struct spdk_nvme_cpl *completion)
 {
-	printf("Attaching to %s\n", trid->traddr);
+	struct bench_zone	*zone = arg;
+	struct bench_worker	*worker = zone->worker;
+	struct bench_task	*task;
 
-	return true;
+	worker->resets_outstanding--;
+	if (spdk_nvme_cpl_is_error(completion)) {
+		spdk_nvme_qpair_print_completion(worker->qpair, (struct spdk_nvme_cpl *)completion);
+		fprintf(stderr, "Reset of zone 0x%jx failed\n", zone->zslba);
+		worker->rc = -EIO;
+		worker->stop = true;
+		return;
+	}
+	zone->submitted = 0;
+	zone->written = 0;
+	zone->ready = true;
+	worker->resets++;
+
+	/* the zone is writable again, wake whoever was waiting for one */
+	while (!worker->stop && (task = TAILQ_FIRST(&worker->idle_tasks)) != NULL) {
+		TAILQ_REMOVE(&worker->idle_tasks, task, link);
+		task->zone = NULL;
+		bench_task_submit(task);
+		if (task->zone == NULL) {
+			/* it went straight back to waiting */
+			break;
+		}
+	}
 }
 
 static void
-attach_cb(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
-	  struct spdk_nvme_ctrlr *ctrlr, const struct spdk_nvme_ctrlr_opts *opts)
+bench_zone_reset(struct bench_zone *zone)
 {
-	int nsid;
-	struct ctrlr_entry *entry;
-	struct spdk_nvme_ns *ns;
-	const struct spdk_nvme_ctrlr_data *cdata;
+	struct bench_worker *worker = zone->worker;
+	int rc;
 
-	entry = malloc(sizeof(struct ctrlr_entry));
-	if (entry == NULL) {
-		perror("ctrlr_entry malloc");
-		exit(1);
+	zone->ready = false;
+	rc = spdk_nvme_zns_reset_zone(worker->ns_entry->ns, worker->qpair, zone->zslba, false,
+				      bench_reset_done, zone);
+	if (rc != 0) {
+		fprintf(stderr, "starting reset zone I/O failed: %s\n", spdk_strerror(-rc));
+		worker->rc = rc;
+		worker->stop = true;
+		return;
 	}
+	worker->resets_outstanding++;
+}
 
-	printf("Attached to %s\n", trid->traddr);
+static void
+bench_io_done(void *arg, const struct spdk_nvme_cpl *completion)
+{
+	struct bench_task	*task = arg;
+	struct bench_worker	*worker = task->worker;
+	struct bench_zone	*zone = task->zone;
+	struct bench_op_stats	*stats = &worker->stats[task->op];
+	uint64_t		tsc = spdk_get_ticks() - task->submit_tsc;
 
-	/*
-	 * spdk_nvme_ctrlr is the logical abstraction in SPDK for an NVMe
-	 *  controller.  During initialization, the IDENTIFY data for the
-	 *  controller is read using an NVMe admin command, and that data
-	 *  can be retrieved using spdk_nvme_ctrlr_get_data() to get
-	 *  detailed information on the controller.  Refer to the NVMe
-	 *  specification for more details on IDENTIFY for NVMe controllers.
-	 */
-	cdata = spdk_nvme_ctrlr_get_data(ctrlr);
+	worker->outstanding--;
+	zone->outstanding--;
+	if (spdk_nvme_cpl_is_error(completion)) {
+		spdk_nvme_qpair_print_completion(worker->qpair, (struct spdk_nvme_cpl *)completion);
+		fprintf(stderr, "I/O error status: %s\n", spdk_nvme_cpl_get_status_string(&completion->status));
+		worker->rc = -EIO;
+		worker->stop = true;
+		return;
+	}
+	stats->ios++;
+	stats->bytes += (uint64_t)task->lba_count * worker->ns_entry->sector_size;
+	stats->total_tsc += tsc;
+	stats->max_tsc = spdk_max(stats->max_tsc, tsc);
+	spdk_histogram_data_tally(stats->histogram, tsc);
+	if (task->op == BENCH_OP_APPEND) {
+		zone->written += task->lba_count;
+	}
 
-	snprintf(entry->name, sizeof(entry->name), "%-20.20s (%-20.20s)", cdata->mn, cdata->sn);
+	if (!worker->stop && zone->submitted == zone->zcap && zone->outstanding == 0) {
+		bench_zone_reset(zone);
+	}
+	bench_task_submit(task);
+}
 
-	entry->ctrlr = ctrlr;
-	TAILQ_INSERT_TAIL(&g_controllers, entry, link);
+/* Pick a zone with written data and a random bs-aligned chunk below what completed */
+static bool
+bench_task_prep_read(struct bench_task *task)
+{
+	struct bench_worker	*worker = task->worker;
+	struct bench_zone	*zone;
+	uint32_t		io_lbas = worker->ns_entry->io_lbas;
+	uint32_t		start = rand_r(&worker->seed) % worker->num_zones;
+	uint64_t		chunk;
 
-	/*
-	 * Each controller has one or more namespaces.  An NVMe namespace is basically
-	 *  equivalent to a SCSI LUN.  The controller's IDENTIFY data tells us how
-	 *  many namespaces exist on the controller.  For Intel(R) P3X00 controllers,
-	 *  it will just be one namespace.
-	 *
-	 * Note that in NVMe, namespace IDs start at 1, not 0.
-	 */
-	for (nsid = spdk_nvme_ctrlr_get_first_active_ns(ctrlr); nsid != 0;
-	     nsid = spdk_nvme_ctrlr_get_next_active_ns(ctrlr, nsid)) {
-		ns = spdk_nvme_ctrlr_get_ns(ctrlr, nsid);
-		if (ns == NULL) {
+	for (uint32_t i = 0; i < worker->num_zones; i++) {
+		zone = &worker->zones[(start + i) % worker->num_zones];
+		/* a full zone is queued for reset, let its reads drain */
+		if (!zone->ready || zone->written == 0 || zone->submitted == zone->zcap) {
 			continue;
 		}
-		register_ns(ctrlr, ns);
+		chunk = rand_r(&worker->seed) % SPDK_CEIL_DIV(zone->written, io_lbas);
+		task->zone = zone;
+		task->op = BENCH_OP_READ;
+		task->lba = zone->zslba + chunk * io_lbas;
+		task->lba_count = spdk_min(io_lbas, zone->written - chunk * io_lbas);
+		return true;
 	}
+	return false;
 }
 
 static void
-cleanup(void)
+bench_task_submit(struct bench_task *task)
 {
-	struct ns_entry *ns_entry, *tmp_ns_entry;
-	struct ctrlr_entry *ctrlr_entry, *tmp_ctrlr_entry;
-	struct spdk_nvme_detach_ctx *detach_ctx = NULL;
+	struct bench_worker	*worker = task->worker;
+	struct bench_zone	*zone = NULL;
+	int			rc;
 
-	TAILQ_FOREACH_SAFE(ns_entry, &g_namespaces, link, tmp_ns_entry) {
-		TAILQ_REMOVE(&g_namespaces, ns_entry, link);
-		free(ns_entry);
+	if (worker->stop) {
+		return;
+	}
+	if (g_read_pct && (uint32_t)(rand_r(&worker->seed) % 100) < g_read_pct &&
+	    bench_task_prep_read(task)) {
+		zone = task->zone;
+		task->submit_tsc = spdk_get_ticks();
+		rc = spdk_nvme_ns_cmd_read(worker->ns_entry->ns, worker->qpair, task->buf, task->lba,
+					   task->lba_count, bench_io_done, task, 0);
+		goto submitted;
 	}
 
-	TAILQ_FOREACH_SAFE(ctrlr_entry, &g_controllers, link, tmp_ctrlr_entry) {
-		TAILQ_REMOVE(&g_controllers, ctrlr_entry, link);
-		spdk_nvme_detach_async(ctrlr_entry->ctrlr, &detach_ctx);
-		free(ctrlr_entry);
+	for (uint32_t i = 0; i < worker->num_zones; i++) {
+		zone = &worker->zones[worker->cur_zone];
+		if (zone->ready && zone->submitted < zone->zcap) {
+			break;
+		}
+		worker->cur_zone = (worker->cur_zone + 1) % worker->num_zones;
+		zone = NULL;
+	}
+	if (zone == NULL) {
+		TAILQ_INSERT_TAIL(&worker->idle_tasks, task, link);
+		return;
 	}
 
-	if (detach_ctx) {
-		spdk_nvme_detach_poll(detach_ctx);
+	task->zone = zone;
+	task->op = BENCH_OP_APPEND;
+	task->lba_count = spdk_min(worker->ns_entry->io_lbas, zone->zcap - zone->submitted);
+	task->submit_tsc = spdk_get_ticks();
+	rc = spdk_nvme_zns_zone_append(worker->ns_entry->ns, worker->qpair, task->buf, zone->zslba,
+				       task->lba_count, bench_io_done, task, 0);
+	if (rc == 0) {
+		zone->submitted += task->lba_count;
+		if (zone->submitted == zone->zcap) {
+			worker->cur_zone = (worker->cur_zone + 1) % worker->num_zones;
+		}
+	}
+
+submitted:
+	if (rc != 0) {
+		fprintf(stderr, "starting %s I/O failed: %s\n", g_bench_op_name[task->op],
+			spdk_strerror(-rc));
+		worker->rc = rc;
+		worker->stop = true;
+		return;
 	}
+	zone->outstanding++;
+	worker->outstanding++;
 }
 
 static void
-usage()
+bench_report_done(void *arg, const struct spdk_nvme_cpl *completion)
 {
-	printf("options:\n");
-	printf("\t[-d DPDK huge memory size in MB]\n");
-	printf("\t[-g use single file descriptor for DPDK memory segments]\n");
-	printf("\t[-i shared memory group ID]\n");
-	printf("\t[-r remote NVMe over Fabrics target address]\n");
-	printf("\t[-V enumerate VMD]\n");
-#ifdef DEBUG
-	printf("\t[-L enable debug logging]\n");
-#else
-	printf("\t[-L enable debug logging (flag disabled, must reconfigure with --enable-debug)]\n");
-#endif
-}
+	int *status = arg;
 
+	*status = spdk_nvme_cpl_is_error(completion) ? 2 : 1;
+}
 
+/* Read the worker's zone descriptors, offline and read only zones get no capacity */
 static int
-parse_args(int argc, char **argv)
+bench_report_zones(struct bench_worker *worker)
 {
-/*
-	int op, rc;
-	
+	struct spdk_nvme_zns_zone_report	*report;
+	struct spdk_nvme_zns_zone_desc		*desc;
+	uint64_t				zone_size;
+	size_t					size;
+	int					status = 0;
+	int					rc;
 
-	spdk_nvme_trid_populate_transport(&g_trid, SPDK_NVME_TRANSPORT_PCIE);
-	snprintf(g_trid.subnqn, sizeof(g_trid.subnqn), "%s", SPDK_NVMF_DISCOVERY_NQN);
+	zone_size = spdk_nvme_zns_ns_get_zone_size_sectors(worker->ns_entry->ns);
+	size = sizeof(*report) + worker->num_zones * sizeof(*desc);
+	report = spdk_zmalloc(size, 0x1000, NULL, spdk_env_get_socket_id(worker->core->lcore),
+			      SPDK_MALLOC_DMA);
+	if (report == NULL) {
+		return -ENOMEM;
+	}
+	rc = spdk_nvme_zns_report_zones(worker->ns_entry->ns, worker->qpair, report, size,
+					worker->first_zone * zone_size, SPDK_NVME_ZRA_LIST_ALL, true,
+					bench_report_done, &status);
+	if (rc != 0) {
+		spdk_free(report);
+		return rc;
+	}
+	while (status == 0) {
+		spdk_nvme_qpair_process_completions(worker->qpair, 0);
+	}
+	if (status != 1 || report->nr_zones < worker->num_zones) {
+		spdk_free(report);
+		return -EIO;
+	}
 
-	while ((op = getopt(argc, argv, "d:gi:r:L:V")) != -1) {
-		switch (op) {
-		case 'V':
-			g_vmd = true;
-			break;
-		case 'i':
-			env_opts->shm_id = spdk_strtol(optarg, 10);
-			if (env_opts->shm_id < 0) {
-				fprintf(stderr, "Invalid shared memory ID\n");
-				return env_opts->shm_id;
-			}
-			break;
-		case 'g':
-			env_opts->hugepage_single_segments = true;
-			break;
-		case 'r':
-			if (spdk_nvme_transport_id_parse(&g_trid, optarg) != 0) {
-				fprintf(stderr, "Error parsing transport address\n");
-				return 1;
-			}
-			break;
-		case 'd':
-			env_opts->mem_size = spdk_strtol(optarg, 10);
-			if (env_opts->mem_size < 0) {
-				fprintf(stderr, "Invalid DPDK memory size\n");
-				return env_opts->mem_size;
-			}
-			break;
-		case 'L':
-			rc = spdk_log_set_flag(optarg);
-			if (rc < 0) {
-				fprintf(stderr, "unknown flag\n");
-				usage(argv[0]);
-				exit(EXIT_FAILURE);
-			}
-#ifdef DEBUG
-			spdk_log_set_print_level(SPDK_LOG_DEBUG);
-#endif
-			break;
-		default:
-			usage();
-			return 1;
+	for (uint32_t i = 0; i < worker->num_zones; i++) {
+		desc = &report->descs[i];
+		worker->zones[i].worker = worker;
+		worker->zones[i].zslba = desc->zslba;
+		if (desc->zs != SPDK_NVME_ZONE_STATE_RONLY && desc->zs != SPDK_NVME_ZONE_STATE_OFFLINE) {
+			worker->zones[i].zcap = desc->zcap;
 		}
-	}*/
-
+	}
+	spdk_free(report);
 	return 0;
 }
 
-/*
-static void
-usage(void)
+/* Allocate the worker's qpair and bring its zones to empty, outside the measured window */
+static int
+bench_worker_init(struct bench_worker *worker)
 {
-	printf("[--------- test ---------]\n");
+	struct spdk_nvme_io_qpair_opts opts;
+
+	spdk_nvme_ctrlr_get_default_io_qpair_opts(worker->ns_entry->ctrlr, &opts, sizeof(opts));
+	opts.io_queue_requests = spdk_max(opts.io_queue_requests, g_queue_depth * 2);
+	opts.delay_cmd_submit = g_delay_doorbell;
+	worker->qpair = spdk_nvme_ctrlr_alloc_io_qpair(worker->ns_entry->ctrlr, &opts, sizeof(opts));
+	if (worker->qpair == NULL) {
+		fprintf(stderr, "ERROR: spdk_nvme_ctrlr_alloc_io_qpair() failed on core %u\n",
+			worker->core->lcore);
+		return -ENOMEM;
+	}
+
+	worker->rc = bench_report_zones(worker);
+	if (worker->rc != 0) {
+		fprintf(stderr, "Zone report failed on core %u\n", worker->core->lcore);
+		return worker->rc;
+	}
+
+	for (uint32_t i = 0; i < worker->num_zones; i++) {
+		if (worker->zones[i].zcap) {
+			bench_zone_reset(&worker->zones[i]);
+		}
+	}
+	while (worker->resets_outstanding) {
+		spdk_nvme_qpair_process_completions(worker->qpair, 0);
+	}
+	worker->resets = 0;
+	return worker->rc;
 }
 
+static uint64_t
+bench_thread_cpu_usec(void)
+{
+	struct rusage ru;
 
-static int
-parse_arg(int argc, char *argv)
+	if (getrusage(RUSAGE_THREAD, &ru) != 0) {
+		return 0;
+	}
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+	       ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/* Adjust the qpair's completion budget to what its last poll reaped */
+static void
+bench_budget_adapt(struct bench_worker *worker, int32_t reaped)
 {
-	return 0;
+	if (reaped <= 0) {
+		return;
+	}
+	if ((uint32_t)reaped >= worker->budget) {
+		worker->budget = spdk_min(worker->budget * 2, g_queue_depth);
+	} else if ((uint32_t)reaped < worker->budget / 4) {
+		worker->budget = spdk_max(worker->budget / 2, 1);
+	}
 }
-*/
 
-int
-main(int argc, char **argv)
+/* Adjust the sleep before the core's next pass over its qpairs to what this pass reaped */
+static void
+bench_poll_sleep(struct bench_core *core, uint64_t reaped, bool stopping)
 {
-	int rc;
-	struct spdk_env_opts opts;
+	struct timespec ts;
 
-	/*
-	 * SPDK relies on an abstraction around the local environment
-	 * named env that handles memory allocation and PCI device operations.
-	 * This library must be initialized first.
-	 *
-	 */
-	spdk_env_opts_init(&opts);
-	/*
-	rc = parse_args(argc, argv, &opts);
-	if (rc != 0) {
-		return rc;
+	if (reaped == 0) {
+		core->sleep_us = core->sleep_us ? spdk_min(core->sleep_us * 2, g_poll_max_us) : 1;
+	} else {
+		core->sleep_us /= 2;
 	}
-	*/
-	rc = spdk_app_parse_args(argc, argv, &opts, "", NULL, parse_args, usage);
-	if (rc != SPDK_APP_PARSE_ARGS_SUCCESS) {
-		exit(rc);
+	if (core->sleep_us && !stopping) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = core->sleep_us * 1000L;
+		nanosleep(&ts, NULL);
+		core->sleeps++;
 	}
+}
 
-	opts.name = "hello_world";
-	if (spdk_env_init(&opts) < 0) {
-		fprintf(stderr, "Unable to initialize SPDK env\n");
-		return 1;
+static int
+bench_work_fn(void *arg)
+{
+	struct bench_core	*core = arg;
+	struct bench_worker	*worker;
+	uint64_t		end_tsc, poll_tsc, now, reaped_total;
+	int32_t			reaped;
+	bool			busy, stopping;
+
+	TAILQ_FOREACH(worker, &core->workers, core_link) {
+		worker->rc = bench_worker_init(worker);
+		if (worker->rc != 0) {
+			worker->stop = true;
+		}
+	}
+
+	core->cpu_usec = bench_thread_cpu_usec();
+	core->start_tsc = spdk_get_ticks();
+	end_tsc = core->start_tsc + (uint64_t)g_time_sec * spdk_get_ticks_hz();
+	TAILQ_FOREACH(worker, &core->workers, core_link) {
+		if (worker->rc != 0) {
+			continue;
+		}
+		worker->budget = g_max_completions ? g_max_completions : g_queue_depth;
+		worker->start_tsc = core->start_tsc;
+		for (uint32_t i = 0; i < g_queue_depth; i++) {
+			bench_task_submit(&worker->tasks[i]);
+		}
+	}
+
+	/* one pass polls every qpair of the core once */
+	do {
+		busy = false;
+		reaped_total = 0;
+		poll_tsc = spdk_get_ticks();
+		stopping = poll_tsc >= end_tsc;
+		TAILQ_FOREACH(worker, &core->workers, core_link) {
+			/* never started, or drained */
+			if (worker->start_tsc == 0 || worker->end_tsc != 0) {
+				continue;
+			}
+			if (stopping) {
+				worker->stop = true;
+			}
+			reaped = spdk_nvme_qpair_process_completions(worker->qpair,
+					g_poll_max_us ? worker->budget : g_max_completions);
+			if (reaped > 0) {
+				reaped_total += reaped;
+			}
+			if (g_poll_max_us) {
+				bench_budget_adapt(worker, reaped);
+			}
+			if (worker->stop && !worker->outstanding && !worker->resets_outstanding) {
+				worker->end_tsc = spdk_get_ticks();
+				continue;
+			}
+			busy = true;
+		}
+		now = spdk_get_ticks();
+		core->polls++;
+		if (reaped_total) {
+			core->busy_tsc += now - poll_tsc;
+		}
+		if (g_poll_max_us && busy) {
+			bench_poll_sleep(core, reaped_total, stopping);
+		}
+	} while (busy);
+	core->end_tsc = spdk_get_ticks();
+	core->cpu_usec = bench_thread_cpu_usec() - core->cpu_usec;
+
+	TAILQ_FOREACH(worker, &core->workers, core_link) {
+		if (worker->qpair) {
+			spdk_nvme_ctrlr_free_io_qpair(worker->qpair);
+			worker->qpair = NULL;
+		}
+	}
+	return 0;
+}
+
+struct bench_pctl_ctx {
+	double		pctl;
+	uint64_t	tsc;
+};
+
+static void
+bench_pctl_cb(void *ctx, uint64_t start, uint64_t end, uint64_t count,
+	      uint64_t total, uint64_t so_far)
+{
+	struct bench_pctl_ctx *pctl_ctx = ctx;
+
+	if (pctl_ctx->tsc == UINT64_MAX && (double)so_far >= total * pctl_ctx->pctl / 100) {
+		pctl_ctx->tsc = end;
+	}
+}
+
+static double
+bench_pctl_us(const struct spdk_histogram_data *histogram, double pctl, uint64_t max_tsc)
+{
+	struct bench_pctl_ctx ctx = { .pctl = pctl, .tsc = UINT64_MAX };
+
+	spdk_histogram_data_iterate(histogram, bench_pctl_cb, &ctx);
+	if (ctx.tsc == UINT64_MAX) {
+		ctx.tsc = max_tsc;
+	}
+	return (double)ctx.tsc * 1000 * 1000 / spdk_get_ticks_hz();
+}
+
+static void
+bench_stats_add(struct bench_op_stats *total, const struct bench_op_stats *stats)
+{
+	total->ios += stats->ios;
+	total->bytes += stats->bytes;
+	total->total_tsc += stats->total_tsc;
+	total->max_tsc = spdk_max(total->max_tsc, stats->max_tsc);
+	if (total->histogram) {
+		spdk_histogram_data_merge(total->histogram, stats->histogram);
+	}
+}
+
+/* Sum the op stats of the workers on one namespace, or of all workers with ns_entry NULL */
+static double
+bench_stats_sum(struct ns_entry *ns_entry, struct bench_op_stats *total, uint64_t *resets)
+{
+	struct bench_worker	*worker;
+	double			sec, max_sec = 0;
+
+	*resets = 0;
+	for (int op = 0; op < BENCH_OP_COUNT; op++) {
+		total[op].histogram = spdk_histogram_data_alloc();
+	}
+	TAILQ_FOREACH(worker, &g_workers, link) {
+		if (worker->end_tsc == 0 || (ns_entry != NULL && worker->ns_entry != ns_entry)) {
+			continue;
+		}
+		sec = (double)(worker->end_tsc - worker->start_tsc) / spdk_get_ticks_hz();
+		max_sec = spdk_max(max_sec, sec);
+		*resets += worker->resets;
+		for (int op = 0; op < BENCH_OP_COUNT; op++) {
+			bench_stats_add(&total[op], &worker->stats[op]);
+		}
+	}
+	return max_sec;
+}
+
+static void
+bench_stats_free(struct bench_op_stats *total)
+{
+	for (int op = 0; op < BENCH_OP_COUNT; op++) {
+		if (total[op].histogram) {
+			spdk_histogram_data_free(total[op].histogram);
+		}
+	}
+}
+
+static void
+bench_print(enum bench_buf buf_mode)
+{
+	struct bench_core	*core;
+	struct bench_worker	*worker;
+	struct ns_entry		*ns_entry;
+	struct bench_op_stats	total[BENCH_OP_COUNT] = {};
+	struct bench_op_stats	*stats;
+	double			us_per_tsc = 1000.0 * 1000.0 / spdk_get_ticks_hz();
+	double			sec, max_sec;
+	uint64_t		appends, reads, bytes, resets;
+	uint64_t		ios, total_ios = 0, total_cpu_usec = 0;
+	char			name[64];
+
+	printf("[%s] polling: %s, doorbell per %s\n", g_bench_buf_name[buf_mode],
+	       g_poll_max_us ? "adaptive" : "spin", g_delay_doorbell ? "poll" : "command");
+	printf("%-8s %12s %12s %10s %8s %8s %10s %10s %8s\n", "core", "append IOPS", "read IOPS",
+	       "MiB/s", "cpu %", "busy %", "cyc/IO", "cpl/poll", "resets");
+	TAILQ_FOREACH(core, &g_cores, link) {
+		if (core->end_tsc == 0) {
+			continue;
+		}
+		appends = reads = bytes = resets = 0;
+		TAILQ_FOREACH(worker, &core->workers, core_link) {
+			appends += worker->stats[BENCH_OP_APPEND].ios;
+			reads += worker->stats[BENCH_OP_READ].ios;
+			bytes += worker->stats[BENCH_OP_APPEND].bytes + worker->stats[BENCH_OP_READ].bytes;
+			resets += worker->resets;
+		}
+		sec = (double)(core->end_tsc - core->start_tsc) / spdk_get_ticks_hz();
+		ios = appends + reads;
+		/* CPU time the thread really used, in TSC cycles, over the I/Os it did */
+		printf("%-8u %12.0f %12.0f %10.2f %8.1f %8.1f %10.0f %10.2f %8ju\n", core->lcore,
+		       appends / sec, reads / sec, (double)bytes / sec / (1024 * 1024),
+		       (double)core->cpu_usec / 10000 / sec,
+		       (double)core->busy_tsc * 100 / (core->end_tsc - core->start_tsc),
+		       ios ? (double)core->cpu_usec * spdk_get_ticks_hz() / 1000000 / ios : 0,
+		       core->polls ? (double)ios / core->polls : 0, resets);
+		total_ios += ios;
+		total_cpu_usec += core->cpu_usec;
+	}
+
+	/* per namespace: what each device delivered with every core driving it */
+	printf("%-24s %12s %12s %10s %10s %10s %8s\n", "namespace", "append IOPS", "read IOPS",
+	       "MiB/s", "append p99", "read p99", "resets");
+	TAILQ_FOREACH(ns_entry, &g_namespaces, link) {
+		if (!ns_entry->bench) {
+			continue;
+		}
+		max_sec = bench_stats_sum(ns_entry, total, &resets);
+		if (max_sec > 0) {
+			snprintf(name, sizeof(name), "%s/%u",
+				 spdk_nvme_ctrlr_get_transport_id(ns_entry->ctrlr)->traddr,
+				 spdk_nvme_ns_get_id(ns_entry->ns));
+			printf("%-24s %12.0f %12.0f %10.2f %10.2f %10.2f %8ju\n", name,
+			       total[BENCH_OP_APPEND].ios / max_sec, total[BENCH_OP_READ].ios / max_sec,
+			       (double)(total[BENCH_OP_APPEND].bytes + total[BENCH_OP_READ].bytes) /
+			       max_sec / (1024 * 1024),
+			       total[BENCH_OP_APPEND].histogram ?
+			       bench_pctl_us(total[BENCH_OP_APPEND].histogram, 99, total[BENCH_OP_APPEND].max_tsc) : 0,
+			       total[BENCH_OP_READ].histogram ?
+			       bench_pctl_us(total[BENCH_OP_READ].histogram, 99, total[BENCH_OP_READ].max_tsc) : 0,
+			       resets);
+		}
+		bench_stats_free(total);
+		memset(total, 0, sizeof(total));
+	}
+
+	max_sec = bench_stats_sum(NULL, total, &resets);
+	if (total_ios && max_sec > 0) {
+		printf("Total: %.0f IOPS on %.2f cores, %.0f cycles per I/O\n", total_ios / max_sec,
+		       (double)total_cpu_usec / 1000000 / max_sec,
+		       (double)total_cpu_usec * spdk_get_ticks_hz() / 1000000 / total_ios);
+	}
+	if (g_read_pct && total_ios) {
+		/* a read that finds no zone with completed data left goes out as an append */
+		printf("Read mix: %u%% requested, %.1f%% achieved\n", g_read_pct,
+		       (double)total[BENCH_OP_READ].ios * 100 /
+		       (total[BENCH_OP_READ].ios + total[BENCH_OP_APPEND].ios));
+	}
+	printf("%-8s %12s %10s %10s %10s %10s\n", "op", "IOPS", "MiB/s", "avg us", "p99 us", "max us");
+	for (int op = 0; op < BENCH_OP_COUNT; op++) {
+		stats = &total[op];
+		if (stats->ios && stats->histogram && max_sec > 0) {
+			printf("%-8s %12.0f %10.2f %10.2f %10.2f %10.2f\n", g_bench_op_name[op],
+			       stats->ios / max_sec, (double)stats->bytes / max_sec / (1024 * 1024),
+			       (double)stats->total_tsc / stats->ios * us_per_tsc,
+			       bench_pctl_us(stats->histogram, 99, stats->max_tsc),
+			       stats->max_tsc * us_per_tsc);
+		}
+	}
+	bench_stats_free(total);
+}
+
+static void
+bench_free_workers(void)
+{
+	struct bench_worker *worker, *tmp;
+	struct bench_core *core, *tmp_core;
+
+	TAILQ_FOREACH_SAFE(worker, &g_workers, link, tmp) {
+		TAILQ_REMOVE(&g_workers, worker, link);
+		for (int op = 0; op < BENCH_OP_COUNT; op++) {
+			if (worker->stats[op].histogram) {
+				spdk_histogram_data_free(worker->stats[op].histogram);
+			}
+		}
+		free(worker->tasks);
+		free(worker->zones);
+		free(worker);
+	}
+	TAILQ_FOREACH_SAFE(core, &g_cores, link, tmp_core) {
+		TAILQ_REMOVE(&g_cores, core, link);
+		free(core);
+	}
+}
+
+static struct bench_worker *
+bench_alloc_worker(struct bench_core *core, struct ns_entry *ns_entry, uint32_t first_zone)
+{
+	struct bench_worker *worker;
+
+	worker = calloc(1, sizeof(*worker));
+	if (worker == NULL) {
+		return NULL;
+	}
+	TAILQ_INSERT_TAIL(&g_workers, worker, link);
+	TAILQ_INSERT_TAIL(&core->workers, worker, core_link);
+	TAILQ_INIT(&worker->idle_tasks);
+	worker->core = core;
+	worker->ns_entry = ns_entry;
+	worker->first_zone = first_zone;
+	worker->num_zones = g_zones_per_core;
+	worker->seed = core->lcore + 1;
+	worker->zones = calloc(worker->num_zones, sizeof(struct bench_zone));
+	worker->tasks = calloc(g_queue_depth, sizeof(struct bench_task));
+	if (worker->zones == NULL || worker->tasks == NULL) {
+		return NULL;
+	}
+	for (int op = 0; op < BENCH_OP_COUNT; op++) {
+		worker->stats[op].histogram = spdk_histogram_data_alloc();
+		if (worker->stats[op].histogram == NULL) {
+			return NULL;
+		}
+	}
+	for (uint32_t i = 0; i < g_queue_depth; i++) {
+		worker->tasks[i].worker = worker;
+	}
+	return worker;
+}
+
+static size_t
+bench_buf_size(struct bench_worker *worker)
+{
+	return SPDK_ALIGN_CEIL((size_t)worker->ns_entry->io_lbas * worker->ns_entry->sector_size, 0x1000);
+}
+
+/*
+ * Hand every task its data buffer: a pinned host buffer on the worker's
+ *  socket, or a 4 KiB aligned slice of the controller memory buffer of the
+ *  controller the worker's namespace is on.
+ */
+static int
+bench_alloc_bufs(enum bench_buf buf_mode)
+{
+	struct ctrlr_entry	*ctrlr_entry;
+	struct bench_worker	*worker;
+	size_t			cmb_size, need;
+	char			*cmb;
+
+	if (buf_mode == BENCH_BUF_CMB) {
+		TAILQ_FOREACH(ctrlr_entry, &g_controllers, link) {
+			need = 0;
+			TAILQ_FOREACH(worker, &g_workers, link) {
+				if (worker->ns_entry->ctrlr == ctrlr_entry->ctrlr) {
+					need += bench_buf_size(worker) * g_queue_depth;
+				}
+			}
+			if (need == 0) {
+				continue;
+			}
+			cmb = spdk_nvme_ctrlr_map_cmb(ctrlr_entry->ctrlr, &cmb_size);
+			if (cmb == NULL || cmb_size < need) {
+				fprintf(stderr, "CMB of %zu bytes on %s can't hold the %zu bytes of buffers\n",
+					cmb == NULL ? 0 : cmb_size, ctrlr_entry->name, need);
+				if (cmb != NULL) {
+					spdk_nvme_ctrlr_unmap_cmb(ctrlr_entry->ctrlr);
+				}
+				return -ENOMEM;
+			}
+			ctrlr_entry->cmb_mapped = true;
+			TAILQ_FOREACH(worker, &g_workers, link) {
+				if (worker->ns_entry->ctrlr != ctrlr_entry->ctrlr) {
+					continue;
+				}
+				for (uint32_t i = 0; i < g_queue_depth; i++) {
+					worker->tasks[i].buf = cmb;
+					cmb += bench_buf_size(worker);
+					memset(worker->tasks[i].buf, 0x5a, bench_buf_size(worker));
+				}
+			}
+		}
+		return 0;
+	}
+
+	TAILQ_FOREACH(worker, &g_workers, link) {
+		for (uint32_t i = 0; i < g_queue_depth; i++) {
+			worker->tasks[i].buf = spdk_zmalloc(bench_buf_size(worker), 0x1000, NULL,
+							    spdk_env_get_socket_id(worker->core->lcore),
+							    SPDK_MALLOC_DMA);
+			if (worker->tasks[i].buf == NULL) {
+				return -ENOMEM;
+			}
+			memset(worker->tasks[i].buf, 0x5a, bench_buf_size(worker));
+		}
+	}
+	return 0;
+}
+
+static void
+bench_free_bufs(enum bench_buf buf_mode)
+{
+	struct ctrlr_entry	*ctrlr_entry;
+	struct bench_worker	*worker;
+
+	if (buf_mode == BENCH_BUF_CMB) {
+		TAILQ_FOREACH(ctrlr_entry, &g_controllers, link) {
+			if (ctrlr_entry->cmb_mapped) {
+				spdk_nvme_ctrlr_unmap_cmb(ctrlr_entry->ctrlr);
+				ctrlr_entry->cmb_mapped = false;
+			}
+		}
+		return;
+	}
+	TAILQ_FOREACH(worker, &g_workers, link) {
+		for (uint32_t i = 0; i < g_queue_depth; i++) {
+			spdk_free(worker->tasks[i].buf);
+		}
+	}
+}
+
+static int
+bench_run(enum bench_buf buf_mode)
+{
+	struct bench_core	*core, *main_core = NULL;
+	struct bench_worker	*worker;
+	struct ns_entry		*ns_entry;
+	uint32_t		lcore, index = 0, num_ns = 0;
+	int			rc = 0;
+
+	SPDK_ENV_FOREACH_CORE(lcore) {
+		core = calloc(1, sizeof(*core));
+		if (core == NULL) {
+			fprintf(stderr, "ERROR: core allocation failed\n");
+			bench_free_workers();
+			return 1;
+		}
+		TAILQ_INIT(&core->workers);
+		core->lcore = lcore;
+		TAILQ_INSERT_TAIL(&g_cores, core, link);
+		num_ns = 0;
+		TAILQ_FOREACH(ns_entry, &g_namespaces, link) {
+			if (!ns_entry->bench) {
+				continue;
+			}
+			num_ns++;
+			if (bench_alloc_worker(core, ns_entry, index * g_zones_per_core) == NULL) {
+				fprintf(stderr, "ERROR: worker allocation failed\n");
+				bench_free_workers();
+				return 1;
+			}
+		}
+		index++;
+	}
+	if (bench_alloc_bufs(buf_mode) != 0) {
+		fprintf(stderr, "ERROR: %s buffer allocation failed\n", g_bench_buf_name[buf_mode]);
+		bench_free_bufs(buf_mode);
+		bench_free_workers();
+		return 1;
+	}
+
+	printf("Zone append benchmark, %s: %u cores x %u namespaces, qd %u, %u bytes, %u%% reads, "
+	       "%u zones per core, %u s\n", g_bench_buf_name[buf_mode], spdk_env_get_core_count(), num_ns,
+	       g_queue_depth, g_io_size, g_read_pct, g_zones_per_core, g_time_sec);
+	TAILQ_FOREACH(core, &g_cores, link) {
+		if (core->lcore == spdk_env_get_current_core()) {
+			main_core = core;
+			continue;
+		}
+		if (spdk_env_thread_launch_pinned(core->lcore, bench_work_fn, core) < 0) {
+			fprintf(stderr, "Unable to start worker on core %u\n", core->lcore);
+			rc = 1;
+		}
+	}
+	if (main_core) {
+		bench_work_fn(main_core);
+	}
+	spdk_env_thread_wait_all();
+
+	TAILQ_FOREACH(worker, &g_workers, link) {
+		if (worker->rc != 0) {
+			rc = 1;
+		}
+	}
+	bench_print(buf_mode);
+	bench_free_bufs(buf_mode);
+	bench_free_workers();
+	return rc;
+}
+
+/* Check the I/O size against the namespace and work out its LBAs per I/O */
+static int
+bench_ns_setup(struct ns_entry *ns_entry)
+{
+	uint32_t max_append, max_open, max_active;
+	uint64_t open_zones;
+
+	ns_entry->sector_size = spdk_nvme_ns_get_sector_size(ns_entry->ns);
+	if (g_io_size % ns_entry->sector_size) {
+		fprintf(stderr, "io size %u is not a multiple of the sector size %u of namespace %u\n",
+			g_io_size, ns_entry->sector_size, spdk_nvme_ns_get_id(ns_entry->ns));
+		return 1;
+	}
+	ns_entry->io_lbas = g_io_size / ns_entry->sector_size;
+	max_append = spdk_nvme_zns_ctrlr_get_max_zone_append_size(ns_entry->ctrlr) / ns_entry->sector_size;
+	if (max_append && ns_entry->io_lbas > max_append) {
+		printf("INFO: io size capped at the max zone append size, %u LBAs on namespace %u\n",
+		       max_append, spdk_nvme_ns_get_id(ns_entry->ns));
+		ns_entry->io_lbas = max_append;
+	}
+	if ((uint64_t)spdk_env_get_core_count() * g_zones_per_core >
+	    spdk_nvme_zns_ns_get_num_zones(ns_entry->ns)) {
+		fprintf(stderr, "%u cores x %u zones is more than the %ju zones of namespace %u\n",
+			spdk_env_get_core_count(), g_zones_per_core,
+			spdk_nvme_zns_ns_get_num_zones(ns_entry->ns), spdk_nvme_ns_get_id(ns_entry->ns));
+		return 1;
+	}
+	/* a worker's full zone may still drain while it appends to the next one */
+	max_open = spdk_nvme_zns_ns_get_max_open_zones(ns_entry->ns);
+	max_active = spdk_nvme_zns_ns_get_max_active_zones(ns_entry->ns);
+	open_zones = 2 * (uint64_t)spdk_env_get_core_count();
+	if ((max_open && open_zones > max_open) || (max_active && open_zones > max_active)) {
+		fprintf(stderr, "%u cores keep up to %ju zones open, namespace %u allows %u open and "
+			"%u active zones\n", spdk_env_get_core_count(), open_zones,
+			spdk_nvme_ns_get_id(ns_entry->ns), max_open, max_active);
+		return 1;
+	}
+	ns_entry->bench = true;
+	return 0;
+}
+
+static int
+bench(void)
+{
+	struct ns_entry		*ns_entry;
+	uint32_t		num_ns = 0;
+	int			rc = 0;
+
+	TAILQ_FOREACH(ns_entry, &g_namespaces, link) {
+		if (spdk_nvme_ns_get_csi(ns_entry->ns) != SPDK_NVME_CSI_ZNS) {
+			continue;
+		}
+		if (bench_ns_setup(ns_entry) != 0) {
+			return 1;
+		}
+		if (++num_ns == 1 && !g_bench_all_ns) {
+			break;
+		}
+	}
+	if (num_ns == 0) {
+		fprintf(stderr, "no ZNS namespace found\n");
+		return 1;
+	}
+
+	/* with -C both the same workload runs on host memory first, then on the CMB */
+	for (int buf_mode = 0; buf_mode < BENCH_BUF_COUNT; buf_mode++) {
+		if (g_buf_modes & (1u << buf_mode)) {
+			rc |= bench_run(buf_mode);
+		}
+	}
+	return rc;
+}
+
+/*
+ * Zone scan (-S).
+ *
+ * Reads the zone descriptors of every ZNS namespace in one pass. The
+ * namespace is cut into chunks of as many zones as one report of the
+ * largest transfer the namespace allows can hold, and -S qpairs each keep
+ * a report in flight, taking the next chunk as theirs completes. The
+ * result is a zone table plus per-state counts and a fullness histogram.
+ */
+#define SCAN_FULLNESS_BUCKETS	10
+
+struct scan_zone {
+	uint64_t	zslba;
+	uint64_t	zcap;
+	uint64_t	wp;
+	uint8_t		zs;
+};
+
+struct scan_ctx;
+
+struct scan_qpair {
+	struct scan_ctx		*scan;
+	struct spdk_nvme_qpair	*qpair;
+	struct spdk_nvme_zns_zone_report *report;
+	/* zones [next_zone, end_zone) of the chunk this qpair is working on */
+	uint64_t		next_zone;
+	uint64_t		end_zone;
+	bool			busy;
+};
+
+struct scan_ctx {
+	struct ns_entry		*ns_entry;
+	struct scan_zone	*zones;
+	uint64_t		num_zones;
+	uint64_t		zone_size;
+	uint64_t		next_chunk;
+	uint32_t		zones_per_report;
+	size_t			report_size;
+	uint64_t		zones_done;
+	uint64_t		state_count[16];
+	/* [0] empty, [1..10] more than (i - 1) * 10% written, read only and offline left out */
+	uint64_t		fullness[SCAN_FULLNESS_BUCKETS + 1];
+	int			rc;
+};
+
+static uint32_t g_scan_qpairs = 0;
+
+static const char *
+scan_state_name(uint8_t zs)
+{
+	switch (zs) {
+	case SPDK_NVME_ZONE_STATE_EMPTY:
+		return "empty";
+	case SPDK_NVME_ZONE_STATE_IOPEN:
+		return "implicit open";
+	case SPDK_NVME_ZONE_STATE_EOPEN:
+		return "explicit open";
+	case SPDK_NVME_ZONE_STATE_CLOSED:
+		return "closed";
+	case SPDK_NVME_ZONE_STATE_RONLY:
+		return "read only";
+	case SPDK_NVME_ZONE_STATE_FULL:
+		return "full";
+	case SPDK_NVME_ZONE_STATE_OFFLINE:
+		return "offline";
+	default:
+		return "unknown";
+	}
+}
+
+/* Copy a zone descriptor into the table and count it */
+static void
+scan_parse_desc(struct scan_ctx *scan, uint64_t index, const struct spdk_nvme_zns_zone_desc *desc)
+{
+	struct scan_zone	*zone = &scan->zones[index];
+	uint64_t		written;
+
+	zone->zslba = desc->zslba;
+	zone->zcap = desc->zcap;
+	zone->wp = desc->wp;
+	zone->zs = desc->zs;
+	scan->state_count[desc->zs & 0xf]++;
+
+	switch (desc->zs) {
+	case SPDK_NVME_ZONE_STATE_RONLY:
+	case SPDK_NVME_ZONE_STATE_OFFLINE:
+		return;
+	case SPDK_NVME_ZONE_STATE_FULL:
+		written = desc->zcap;
+		break;
+	case SPDK_NVME_ZONE_STATE_EMPTY:
+		written = 0;
+		break;
+	default:
+		written = desc->wp - desc->zslba;
+		break;
+	}
+	if (written == 0 || desc->zcap == 0) {
+		scan->fullness[0]++;
+	} else {
+		scan->fullness[1 + spdk_min((written * SCAN_FULLNESS_BUCKETS - 1) / desc->zcap,
+					    SCAN_FULLNESS_BUCKETS - 1)]++;
+	}
+}
+
+static void scan_submit(struct scan_qpair *sq);
+
+static void
+scan_report_done(void *arg, const struct spdk_nvme_cpl *completion)
+{
+	struct scan_qpair	*sq = arg;
+	struct scan_ctx		*scan = sq->scan;
+	uint64_t		count;
+
+	sq->busy = false;
+	if (spdk_nvme_cpl_is_error(completion)) {
+		spdk_nvme_qpair_print_completion(sq->qpair, (struct spdk_nvme_cpl *)completion);
+		fprintf(stderr, "Zone report at zone %ju failed\n", sq->next_zone);
+		scan->rc = -EIO;
+		return;
+	}
+
+	count = spdk_min(sq->report->nr_zones, sq->end_zone - sq->next_zone);
+	if (count == 0) {
+		fprintf(stderr, "Zone report at zone %ju came back empty\n", sq->next_zone);
+		scan->rc = -EIO;
+		return;
+	}
+	for (uint64_t i = 0; i < count; i++) {
+		scan_parse_desc(scan, sq->next_zone + i, &sq->report->descs[i]);
+	}
+	scan->zones_done += count;
+	/* a short report leaves the rest of the chunk to the same qpair */
+	sq->next_zone += count;
+	scan_submit(sq);
+}
+
+static void
+scan_submit(struct scan_qpair *sq)
+{
+	struct scan_ctx *scan = sq->scan;
+	int rc;
+
+	if (scan->rc != 0) {
+		return;
+	}
+	if (sq->next_zone == sq->end_zone) {
+		if (scan->next_chunk == scan->num_zones) {
+			return;
+		}
+		sq->next_zone = scan->next_chunk;
+		sq->end_zone = spdk_min(sq->next_zone + scan->zones_per_report, scan->num_zones);
+		scan->next_chunk = sq->end_zone;
+	}
+
+	rc = spdk_nvme_zns_report_zones(scan->ns_entry->ns, sq->qpair, sq->report, scan->report_size,
+					sq->next_zone * scan->zone_size, SPDK_NVME_ZRA_LIST_ALL, true,
+					scan_report_done, sq);
+	if (rc != 0) {
+		fprintf(stderr, "starting zone report failed: %s\n", spdk_strerror(-rc));
+		scan->rc = rc;
+		return;
+	}
+	sq->busy = true;
+}
+
+static void
+scan_print(struct scan_ctx *scan, uint64_t tsc)
+{
+	uint64_t usable = 0;
+
+	printf("[zone scan] namespace %u: %ju zones in %.3f ms, %u qpairs, %u zones per report\n",
+	       spdk_nvme_ns_get_id(scan->ns_entry->ns), scan->zones_done,
+	       (double)tsc * 1000 / spdk_get_ticks_hz(), g_scan_qpairs, scan->zones_per_report);
+	for (int zs = 0; zs < 16; zs++) {
+		if (scan->state_count[zs]) {
+			printf("  %-14s %10ju\n", scan_state_name(zs), scan->state_count[zs]);
+		}
+	}
+	for (int i = 0; i <= SCAN_FULLNESS_BUCKETS; i++) {
+		usable += scan->fullness[i];
+	}
+	printf("  fullness (written / capacity):\n");
+	printf("  %9s %10ju %6.2f%%\n", "0%", scan->fullness[0],
+	       usable ? (double)scan->fullness[0] * 100 / usable : 0);
+	for (int i = 1; i <= SCAN_FULLNESS_BUCKETS; i++) {
+		printf("  %3d%%-%3d%% %10ju %6.2f%%\n", (i - 1) * 100 / SCAN_FULLNESS_BUCKETS,
+		       i * 100 / SCAN_FULLNESS_BUCKETS, scan->fullness[i],
+		       usable ? (double)scan->fullness[i] * 100 / usable : 0);
+	}
+}
+
+/* Scan every zone of the namespace into scan->zones, the caller frees it */
+static int
+scan_ns(struct ns_entry *ns_entry, struct scan_ctx *scan)
+{
+	struct scan_qpair	*sqs;
+	uint32_t		max_xfer;
+	uint64_t		start_tsc;
+	bool			busy;
+
+	memset(scan, 0, sizeof(*scan));
+	scan->ns_entry = ns_entry;
+	scan->num_zones = spdk_nvme_zns_ns_get_num_zones(ns_entry->ns);
+	scan->zone_size = spdk_nvme_zns_ns_get_zone_size_sectors(ns_entry->ns);
+
+	/* as many descriptors as one command can carry */
+	max_xfer = spdk_nvme_ns_get_max_io_xfer_size(ns_entry->ns);
+	scan->zones_per_report = (max_xfer - sizeof(struct spdk_nvme_zns_zone_report)) /
+				 sizeof(struct spdk_nvme_zns_zone_desc);
+	scan->zones_per_report = spdk_max(scan->zones_per_report, 1);
+	scan->report_size = sizeof(struct spdk_nvme_zns_zone_report) +
+			    scan->zones_per_report * sizeof(struct spdk_nvme_zns_zone_desc);
+
+	scan->zones = calloc(scan->num_zones, sizeof(struct scan_zone));
+	sqs = calloc(g_scan_qpairs, sizeof(struct scan_qpair));
+	if (scan->zones == NULL || sqs == NULL) {
+		free(sqs);
+		return -ENOMEM;
+	}
+	for (uint32_t i = 0; i < g_scan_qpairs; i++) {
+		sqs[i].scan = scan;
+		sqs[i].qpair = spdk_nvme_ctrlr_alloc_io_qpair(ns_entry->ctrlr, NULL, 0);
+		sqs[i].report = spdk_zmalloc(scan->report_size, 0x1000, NULL, SPDK_ENV_SOCKET_ID_ANY,
+					     SPDK_MALLOC_DMA);
+		if (sqs[i].qpair == NULL || sqs[i].report == NULL) {
+			fprintf(stderr, "ERROR: zone scan qpair or report buffer allocation failed\n");
+			scan->rc = -ENOMEM;
+			goto out;
+		}
+	}
+
+	start_tsc = spdk_get_ticks();
+	for (uint32_t i = 0; i < g_scan_qpairs; i++) {
+		scan_submit(&sqs[i]);
+	}
+	do {
+		busy = false;
+		for (uint32_t i = 0; i < g_scan_qpairs; i++) {
+			if (sqs[i].busy) {
+				spdk_nvme_qpair_process_completions(sqs[i].qpair, 0);
+				busy = true;
+			}
+		}
+	} while (busy);
+
+	if (scan->rc == 0) {
+		scan_print(scan, spdk_get_ticks() - start_tsc);
+	}
+
+out:
+	for (uint32_t i = 0; i < g_scan_qpairs; i++) {
+		if (sqs[i].qpair) {
+			spdk_nvme_ctrlr_free_io_qpair(sqs[i].qpair);
+		}
+		spdk_free(sqs[i].report);
+	}
+	free(sqs);
+	return scan->rc;
+}
+
+static int
+scan(void)
+{
+	struct ns_entry	*ns_entry;
+	struct scan_ctx	scan;
+	int		rc = 0;
+
+	TAILQ_FOREACH(ns_entry, &g_namespaces, link) {
+		if (spdk_nvme_ns_get_csi(ns_entry->ns) != SPDK_NVME_CSI_ZNS) {
+			continue;
+		}
+		if (scan_ns(ns_entry, &scan) != 0) {
+			fprintf(stderr, "Zone scan of namespace %u failed\n", spdk_nvme_ns_get_id(ns_entry->ns));
+			rc = 1;
+		}
+		free(scan.zones);
+	}
+	return rc;
+}
+
+/*
+ * Zone compaction (-X).
+ *
+ * Relocates the valid data of written zones into empty zones and resets
+ *  the source zones, the way a host FTL reclaims partially valid zones.
+ *  The zones come from a zone scan of the first ZNS namespace: every full,
+ *  closed or open zone with data is a source, up to -F of them, and every
+ *  empty zone a destination.  This tool has no mapping table, so which
+ *  data is still valid is made up: each -o sized extent of a source is
+ *  valid with the -X percentage, and adjacent valid extents form one range.
+ *
+ * Up to -q streams, no more than the zones that can still be opened and
+ *  made active next to those the scan found open or closed, each work
+ *  through a source zone at a time into a destination zone of their own,
+ *  one command in flight so every write lands at the destination's write
+ *  pointer.  When the controller supports it, a Simple Copy command moves as many ranges as the
+ *  namespace's MSRC/MSSRL/MCL limits allow without the data crossing PCIe;
+ *  otherwise (or with -H) each range is read into host memory and zone
+ *  appended.  The report shows the rate at which data was relocated, and
+ *  the host PCIe traffic against what read+append would have needed.
+ *  Destinations left partly written are closed at the end.
+ */
+struct compact_range {
+	uint64_t	slba;
+	uint32_t	nlb;
+};
+
+struct compact_src {
+	uint64_t		zslba;
+	uint64_t		written;
+	struct compact_range	*ranges;
+	uint32_t		num_ranges;
+	uint64_t		valid;
+};
+
+struct compact_ctx;
+
+struct compact_stream {
+	struct compact_ctx	*ctx;
+	struct compact_src	*src;
+	/* next range of the source, and how much of it was already relocated */
+	uint32_t		range;
+	uint32_t		range_off;
+	struct scan_zone	*dst;
+	uint64_t		dst_wp;
+	/* the command in flight */
+	struct spdk_nvme_scc_source_range *copy_ranges;
+	uint16_t		num_copy_ranges;
+	uint64_t		slba;
+	uint32_t		nlb;
+	/* host read+append only */
+	void			*buf;
+	bool			busy;
+};
+
+struct compact_ctx {
+	struct ns_entry		*ns_entry;
+	struct spdk_nvme_qpair	*qpair;
+	struct scan_ctx		scan;
+	struct compact_src	*srcs;
+	uint32_t		num_srcs;
+	uint32_t		next_src;
+	uint64_t		next_dst;
+	uint64_t		dsts;
+	bool			use_copy;
+	uint32_t		sector_size;
+	/* per command limits, from MSRC, MSSRL and MCL or the max transfer size */
+	uint32_t		max_ranges;
+	uint32_t		max_range_lbas;
+	uint32_t		max_cmd_lbas;
+	uint64_t		written;
+	uint64_t		relocated;
+	uint64_t		commands;
+	uint64_t		ranges;
+	uint64_t		host_bytes;
+	uint64_t		resets;
+	uint32_t		resets_outstanding;
+	uint32_t		closes_outstanding;
+	int			rc;
+};
+
+/* -X: compaction with this percentage of valid data, 0 off */
+static uint32_t g_compact_valid_pct = 0;
+static uint32_t g_compact_zones = 16;
+static bool g_compact_host = false;
+
+static void compact_stream_next(struct compact_stream *stream);
+
+/* Make up the valid ranges of a source zone, see above */
+static int
+compact_src_init(struct compact_src *src, struct scan_zone *zone, uint32_t extent, unsigned int *seed)
+{
+	struct compact_range *range = NULL;
+
+	src->zslba = zone->zslba;
+	src->written = zone->zs == SPDK_NVME_ZONE_STATE_FULL ? zone->zcap : zone->wp - zone->zslba;
+	src->ranges = calloc(SPDK_CEIL_DIV(src->written, extent), sizeof(struct compact_range));
+	if (src->ranges == NULL) {
+		return -ENOMEM;
+	}
+	for (uint64_t off = 0; off < src->written; off += extent) {
+		uint32_t nlb = spdk_min(extent, src->written - off);
+
+		if ((uint32_t)(rand_r(seed) % 100) >= g_compact_valid_pct) {
+			range = NULL;
+			continue;
+		}
+		if (range == NULL) {
+			range = &src->ranges[src->num_ranges++];
+			range->slba = src->zslba + off;
+		}
+		range->nlb += nlb;
+		src->valid += nlb;
+	}
+	return 0;
+}
+
+/* Take the next piece of at most max LBAs of the stream's source, 0 once it is all relocated */
+static uint32_t
+compact_take(struct compact_stream *stream, uint32_t max, uint64_t *slba)
+{
+	struct compact_src	*src = stream->src;
+	struct compact_range	*range;
+	uint32_t		nlb;
+
+	if (stream->range == src->num_ranges) {
+		return 0;
+	}
+	range = &src->ranges[stream->range];
+	nlb = spdk_min(max, range->nlb - stream->range_off);
+	*slba = range->slba + stream->range_off;
+	stream->range_off += nlb;
+	if (stream->range_off == range->nlb) {
+		stream->range++;
+		stream->range_off = 0;
+	}
+	return nlb;
+}
+
+static void
+compact_reset_done(void *arg, const struct spdk_nvme_cpl *completion)
+{
+	struct compact_ctx *ctx = arg;
+
+	ctx->resets_outstanding--;
+	if (spdk_nvme_cpl_is_error(completion)) {
+		spdk_nvme_qpair_print_completion(ctx->qpair, (struct spdk_nvme_cpl *)completion);
+		fprintf(stderr, "Reset of a compacted zone failed\n");
+		ctx->rc = -EIO;
+		return;
+	}
+	ctx->resets++;
+}
+
+/* Account the command that just completed and go on with the next one */
+static void
+compact_cmd_done(struct compact_stream *stream, const struct spdk_nvme_cpl *completion,
+		 const char *what)
+{
+	struct compact_ctx *ctx = stream->ctx;
+
+	stream->busy = false;
+	if (spdk_nvme_cpl_is_error(completion)) {
+		spdk_nvme_qpair_print_completion(ctx->qpair, (struct spdk_nvme_cpl *)completion);
+		fprintf(stderr, "%s into zone 0x%jx failed\n", what, stream->dst->zslba);
+		ctx->rc = -EIO;
+		return;
+	}
+	stream->dst_wp += stream->nlb;
+	ctx->relocated += stream->nlb;
+	ctx->commands++;
+	compact_stream_next(stream);
+}
+
+static void
+compact_copy_done(void *arg, const struct spdk_nvme_cpl *completion)
+{
+	struct compact_stream *stream = arg;
+
+	compact_cmd_done(stream, completion, "Copy");
+}
+
+static void
+compact_append_done(void *arg, const struct spdk_nvme_cpl *completion)
+{
+	struct compact_stream *stream = arg;
+
+	compact_cmd_done(stream, completion, "Append");
+}
+
+static void
+compact_read_done(void *arg, const struct spdk_nvme_cpl *completion)
+{
+	struct compact_stream	*stream = arg;
+	struct compact_ctx	*ctx = stream->ctx;
+	int			rc;
+
+	if (spdk_nvme_cpl_is_error(completion)) {
+		spdk_nvme_qpair_print_completion(ctx->qpair, (struct spdk_nvme_cpl *)completion);
+		fprintf(stderr, "Read of LBA 0x%jx failed\n", stream->slba);
+		stream->busy = false;
+		ctx->rc = -EIO;
+		return;
+	}
+	rc = spdk_nvme_zns_zone_append(ctx->ns_entry->ns, ctx->qpair, stream->buf, stream->dst->zslba,
+				       stream->nlb, compact_append_done, stream, 0);
+	if (rc != 0) {
+		fprintf(stderr, "starting append I/O failed: %s\n", spdk_strerror(-rc));
+		stream->busy = false;
+		ctx->rc = rc;
+	}
+}
+
+/* Move on to the next source once this one is done, resetting it */
+static bool
+compact_next_src(struct compact_stream *stream)
+{
+	struct compact_ctx	*ctx = stream->ctx;
+	int			rc;
+
+	if (stream->src != NULL) {
+		rc = spdk_nvme_zns_reset_zone(ctx->ns_entry->ns, ctx->qpair, stream->src->zslba, false,
+					      compact_reset_done, ctx);
+		if (rc != 0) {
+			fprintf(stderr, "starting reset zone I/O failed: %s\n", spdk_strerror(-rc));
+			ctx->rc = rc;
+			return false;
+		}
+		ctx->resets_outstanding++;
+		stream->src = NULL;
+	}
+	if (ctx->next_src == ctx->num_srcs) {
+		return false;
+	}
+	stream->src = &ctx->srcs[ctx->next_src++];
+	stream->range = 0;
+	stream->range_off = 0;
+	return true;
+}
+
+/* Open up the next empty zone once the destination is full */
+static bool
+compact_next_dst(struct compact_stream *stream)
+{
+	struct compact_ctx	*ctx = stream->ctx;
+	struct scan_zone	*zone;
+
+	while (ctx->next_dst < ctx->scan.num_zones) {
+		zone = &ctx->scan.zones[ctx->next_dst++];
+		if (zone->zs == SPDK_NVME_ZONE_STATE_EMPTY && zone->zcap) {
+			stream->dst = zone;
+			stream->dst_wp = zone->zslba;
+			ctx->dsts++;
+			return true;
+		}
+	}
+	fprintf(stderr, "Ran out of empty zones to compact into\n");
+	ctx->rc = -ENOSPC;
+	return false;
+}
+
+static void
+compact_stream_next(struct compact_stream *stream)
+{
+	struct compact_ctx	*ctx = stream->ctx;
+	uint32_t		room, nlb;
+	uint64_t		slba;
+	int			rc;
+
+	if (ctx->rc != 0) {
+		return;
+	}
+	if (stream->dst == NULL || stream->dst_wp == stream->dst->zslba + stream->dst->zcap) {
+		if (!compact_next_dst(stream)) {
+			return;
+		}
+	}
+	room = spdk_min(ctx->max_cmd_lbas, stream->dst->zslba + stream->dst->zcap - stream->dst_wp);
+
+	stream->nlb = 0;
+	stream->num_copy_ranges = 0;
+	while (stream->nlb == 0) {
+		if (ctx->use_copy) {
+			while (stream->num_copy_ranges < ctx->max_ranges && stream->nlb < room) {
+				nlb = compact_take(stream, spdk_min(ctx->max_range_lbas, room - stream->nlb), &slba);
+				if (nlb == 0) {
+					break;
+				}
+				memset(&stream->copy_ranges[stream->num_copy_ranges], 0,
+				       sizeof(struct spdk_nvme_scc_source_range));
+				stream->copy_ranges[stream->num_copy_ranges].slba = slba;
+				/* 0's based */
+				stream->copy_ranges[stream->num_copy_ranges].nlb = nlb - 1;
+				stream->num_copy_ranges++;
+				stream->nlb += nlb;
+			}
+		} else {
+			stream->nlb = compact_take(stream, room, &stream->slba);
+		}
+		if (stream->nlb == 0 && !compact_next_src(stream)) {
+			return;
+		}
+	}
+
+	if (ctx->use_copy) {
+		rc = spdk_nvme_ns_cmd_copy(ctx->ns_entry->ns, ctx->qpair, stream->copy_ranges,
+					   stream->num_copy_ranges, stream->dst_wp, compact_copy_done, stream);
+		ctx->ranges += stream->num_copy_ranges;
+		/* only the source range descriptors cross PCIe */
+		ctx->host_bytes += stream->num_copy_ranges * sizeof(struct spdk_nvme_scc_source_range);
+	} else {
+		rc = spdk_nvme_ns_cmd_read(ctx->ns_entry->ns, ctx->qpair, stream->buf, stream->slba,
+					   stream->nlb, compact_read_done, stream, 0);
+		ctx->ranges++;
+		/* to host memory and back */
+		ctx->host_bytes += 2 * (uint64_t)stream->nlb * ctx->sector_size;
+	}
+	if (rc != 0) {
+		fprintf(stderr, "starting %s failed: %s\n", ctx->use_copy ? "copy" : "read I/O",
+			spdk_strerror(-rc));
+		ctx->rc = rc;
+		return;
+	}
+	stream->busy = true;
+}
+
+static void
+compact_print(struct compact_ctx *ctx, uint64_t tsc)
+{
+	double	sec = (double)tsc / spdk_get_ticks_hz();
+	double	mib = 1024.0 * 1024.0;
+	uint64_t relocated = ctx->relocated * ctx->sector_size;
+	/* what reading everything to host memory and appending it back would take */
+	uint64_t host_copy = 2 * relocated;
+
+	printf("[compaction] %s: %u source zones, %.2f of %.2f MiB valid (%u%%), into %ju zones\n",
+	       ctx->use_copy ? "simple copy" : "host read+append", ctx->num_srcs,
+	       (double)relocated / mib, (double)ctx->written * ctx->sector_size / mib,
+	       g_compact_valid_pct, ctx->dsts);
+	printf("  %.3f ms, %.2f MiB/s relocated, %ju commands, %.2f ranges per command, %ju zones reset\n",
+	       sec * 1000, sec > 0 ? relocated / mib / sec : 0, ctx->commands,
+	       ctx->commands ? (double)ctx->ranges / ctx->commands : 0, ctx->resets);
+	printf("  host PCIe traffic %.2f MiB, read+append needs %.2f MiB, %.2f MiB saved\n",
+	       (double)ctx->host_bytes / mib, (double)host_copy / mib,
+	       (double)(host_copy - spdk_min(host_copy, ctx->host_bytes)) / mib);
+}
+
+static void
+compact_close_done(void *arg, const struct spdk_nvme_cpl *completion)
+{
+	struct compact_ctx *ctx = arg;
+
+	ctx->closes_outstanding--;
+	if (spdk_nvme_cpl_is_error(completion)) {
+		spdk_nvme_qpair_print_completion(ctx->qpair, (struct spdk_nvme_cpl *)completion);
+		fprintf(stderr, "Close of a destination zone failed\n");
+		ctx->rc = -EIO;
+	}
+}
+
+/* Close the destinations left partly written, so they stop holding open resources */
+static void
+compact_close_dsts(struct compact_ctx *ctx, struct compact_stream *streams, uint32_t num_streams)
+{
+	struct compact_stream	*stream;
+	int			rc;
+
+	for (uint32_t i = 0; i < num_streams; i++) {
+		stream = &streams[i];
+		if (stream->dst == NULL || stream->dst_wp == stream->dst->zslba ||
+		    stream->dst_wp == stream->dst->zslba + stream->dst->zcap) {
+			continue;
+		}
+		rc = spdk_nvme_zns_close_zone(ctx->ns_entry->ns, ctx->qpair, stream->dst->zslba, false,
+					      compact_close_done, ctx);
+		if (rc != 0) {
+			fprintf(stderr, "starting close zone I/O failed: %s\n", spdk_strerror(-rc));
+			ctx->rc = rc;
+			break;
+		}
+		ctx->closes_outstanding++;
+	}
+	while (ctx->closes_outstanding) {
+		spdk_nvme_qpair_process_completions(ctx->qpair, 0);
+	}
+}
+
+static int
+compact_run(struct compact_ctx *ctx)
+{
+	struct compact_stream	*streams;
+	uint32_t		num_streams = spdk_min(g_queue_depth, ctx->num_srcs);
+	uint32_t		max_open = spdk_nvme_zns_ns_get_max_open_zones(ctx->ns_entry->ns);
+	uint32_t		max_active = spdk_nvme_zns_ns_get_max_active_zones(ctx->ns_entry->ns);
+	uint64_t		*state_count = ctx->scan.state_count;
+	uint64_t		open, active, start_tsc, tsc;
+	bool			busy;
+
+	/* every stream keeps a destination zone open, next to the zones the scan
+	 * found open or closed already (0 limits mean unlimited)
+	 */
+	open = state_count[SPDK_NVME_ZONE_STATE_IOPEN] + state_count[SPDK_NVME_ZONE_STATE_EOPEN];
+	active = open + state_count[SPDK_NVME_ZONE_STATE_CLOSED];
+	if (max_open) {
+		num_streams = spdk_min(num_streams, max_open - spdk_min(open, max_open));
+	}
+	if (max_active) {
+		num_streams = spdk_min(num_streams, max_active - spdk_min(active, max_active));
+	}
+	if (num_streams == 0) {
+		fprintf(stderr, "%ju open and %ju active zones leave no room for a destination zone\n",
+			open, active);
+		ctx->rc = -EBUSY;
+		return ctx->rc;
+	}
+	streams = calloc(num_streams, sizeof(struct compact_stream));
+	if (streams == NULL) {
+		ctx->rc = -ENOMEM;
+		return ctx->rc;
+	}
+	for (uint32_t i = 0; i < num_streams; i++) {
+		streams[i].ctx = ctx;
+		if (ctx->use_copy) {
+			streams[i].copy_ranges = calloc(ctx->max_ranges, sizeof(struct spdk_nvme_scc_source_range));
+		} else {
+			streams[i].buf = spdk_zmalloc((size_t)ctx->max_cmd_lbas * ctx->sector_size, 0x1000, NULL,
+						      SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
+		}
+		if (streams[i].copy_ranges == NULL && streams[i].buf == NULL) {
+			ctx->rc = -ENOMEM;
+			goto out;
+		}
+	}
+
+	start_tsc = spdk_get_ticks();
+	for (uint32_t i = 0; i < num_streams; i++) {
+		if (compact_next_src(&streams[i])) {
+			compact_stream_next(&streams[i]);
+		}
+	}
+	do {
+		spdk_nvme_qpair_process_completions(ctx->qpair, 0);
+		busy = ctx->resets_outstanding != 0;
+		for (uint32_t i = 0; i < num_streams; i++) {
+			busy |= streams[i].busy;
+		}
+	} while (busy);
+	tsc = spdk_get_ticks() - start_tsc;
+
+	compact_close_dsts(ctx, streams, num_streams);
+	if (ctx->rc == 0) {
+		compact_print(ctx, tsc);
+	}
+
+out:
+	for (uint32_t i = 0; i < num_streams; i++) {
+		free(streams[i].copy_ranges);
+		spdk_free(streams[i].buf);
+	}
+	free(streams);
+	return ctx->rc;
+}
+
+/* Work out whether to copy and the per command limits */
+static void
+compact_limits(struct compact_ctx *ctx)
+{
+	struct spdk_nvme_ns		*ns = ctx->ns_entry->ns;
+	const struct spdk_nvme_ns_data	*nsdata = spdk_nvme_ns_get_data(ns);
+	uint32_t			max_append;
+
+	ctx->use_copy = !g_compact_host &&
+			(spdk_nvme_ctrlr_get_flags(ctx->ns_entry->ctrlr) & SPDK_NVME_CTRLR_COPY_SUPPORTED);
+	if (ctx->use_copy) {
+		/* MSRC is 0's based, a range's NLB field is 16 bits and 0's based */
+		ctx->max_ranges = nsdata->msrc + 1;
+		ctx->max_range_lbas = spdk_min(spdk_max(nsdata->mssrl, 1), UINT16_MAX + 1);
+		ctx->max_cmd_lbas = spdk_max(nsdata->mcl, 1);
+		return;
+	}
+	if (!g_compact_host) {
+		printf("INFO: no simple copy support, relocating through host memory\n");
+	}
+	ctx->max_ranges = 1;
+	ctx->max_cmd_lbas = spdk_nvme_ns_get_max_io_xfer_size(ns) / ctx->sector_size;
+	max_append = spdk_nvme_zns_ctrlr_get_max_zone_append_size(ctx->ns_entry->ctrlr) / ctx->sector_size;
+	if (max_append) {
+		ctx->max_cmd_lbas = spdk_min(ctx->max_cmd_lbas, max_append);
+	}
+	ctx->max_range_lbas = ctx->max_cmd_lbas;
+}
+
+static int
+compact(void)
+{
+	struct ns_entry		*ns_entry;
+	struct compact_ctx	ctx = {};
+	struct scan_zone	*zone;
+	unsigned int		seed = 1;
+	uint32_t		extent;
+
+	TAILQ_FOREACH(ns_entry, &g_namespaces, link) {
+		if (spdk_nvme_ns_get_csi(ns_entry->ns) == SPDK_NVME_CSI_ZNS) {
+			break;
+		}
+	}
+	if (ns_entry == NULL) {
+		fprintf(stderr, "no ZNS namespace found\n");
+		return 1;
+	}
+	ctx.ns_entry = ns_entry;
+	ctx.sector_size = spdk_nvme_ns_get_sector_size(ns_entry->ns);
+	extent = spdk_max(g_io_size / ctx.sector_size, 1);
+	compact_limits(&ctx);
+
+	if (g_scan_qpairs == 0) {
+		g_scan_qpairs = 4;
+	}
+	if (scan_ns(ns_entry, &ctx.scan) != 0) {
+		fprintf(stderr, "Zone scan failed\n");
+		free(ctx.scan.zones);
+		return 1;
+	}
+
+	ctx.srcs = calloc(g_compact_zones, sizeof(struct compact_src));
+	if (ctx.srcs == NULL) {
+		ctx.rc = -ENOMEM;
+		goto out;
+	}
+	for (uint64_t i = 0; i < ctx.scan.num_zones && ctx.num_srcs < g_compact_zones; i++) {
+		zone = &ctx.scan.zones[i];
+		switch (zone->zs) {
+		case SPDK_NVME_ZONE_STATE_FULL:
+		case SPDK_NVME_ZONE_STATE_CLOSED:
+		case SPDK_NVME_ZONE_STATE_IOPEN:
+		case SPDK_NVME_ZONE_STATE_EOPEN:
+			break;
+		default:
+			continue;
+		}
+		if (zone->zs != SPDK_NVME_ZONE_STATE_FULL && zone->wp == zone->zslba) {
+			continue;
+		}
+		ctx.rc = compact_src_init(&ctx.srcs[ctx.num_srcs], zone, extent, &seed);
+		if (ctx.rc != 0) {
+			goto out;
+		}
+		ctx.written += ctx.srcs[ctx.num_srcs].written;
+		ctx.num_srcs++;
+	}
+	if (ctx.num_srcs == 0) {
+		fprintf(stderr, "no written zones to compact\n");
+		ctx.rc = -ENOENT;
+		goto out;
+	}
+
+	ctx.qpair = spdk_nvme_ctrlr_alloc_io_qpair(ns_entry->ctrlr, NULL, 0);
+	if (ctx.qpair == NULL) {
+		fprintf(stderr, "ERROR: spdk_nvme_ctrlr_alloc_io_qpair() failed\n");
+		ctx.rc = -ENOMEM;
+		goto out;
+	}
+	compact_run(&ctx);
+	spdk_nvme_ctrlr_free_io_qpair(ctx.qpair);
+
+out:
+	for (uint32_t i = 0; i < ctx.num_srcs; i++) {
+		free(ctx.srcs[i].ranges);
+	}
+	free(ctx.srcs);
+	free(ctx.scan.zones);
+	return ctx.rc != 0;
+}
+
+static bool
+probe_cb(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
+	 struct spdk_nvme_ctrlr_opts *opts)
+{
+	printf("Attaching to %s\n", trid->traddr);
+
+	return true;
+}
+
+static void
+attach_cb(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
+	  struct spdk_nvme_ctrlr *ctrlr, const struct spdk_nvme_ctrlr_opts *opts)
+{
+	int nsid;
+	struct ctrlr_entry *entry;
+	struct spdk_nvme_ns *ns;
+	const struct spdk_nvme_ctrlr_data *cdata;
+
+	entry = malloc(sizeof(struct ctrlr_entry));
+	if (entry == NULL) {
+		perror("ctrlr_entry malloc");
+		exit(1);
+	}
+
+	printf("Attached to %s\n", trid->traddr);
+
+	/*
+	 * spdk_nvme_ctrlr is the logical abstraction in SPDK for an NVMe
+	 *  controller.  During initialization, the IDENTIFY data for the
+	 *  controller is read using an NVMe admin command, and that data
+	 *  can be retrieved using spdk_nvme_ctrlr_get_data() to get
+	 *  detailed information on the controller.  Refer to the NVMe
+	 *  specification for more details on IDENTIFY for NVMe controllers.
+	 */
+	cdata = spdk_nvme_ctrlr_get_data(ctrlr);
+
+	snprintf(entry->name, sizeof(entry->name), "%-20.20s (%-20.20s)", cdata->mn, cdata->sn);
+
+	entry->ctrlr = ctrlr;
+	entry->cmb_mapped = false;
+	TAILQ_INSERT_TAIL(&g_controllers, entry, link);
+
+	/*
+	 * Keep the CMB for data buffers, otherwise the driver may put the
+	 *  submission queues of the qpairs allocated later in it.
+	 */
+	if (g_bench && (g_buf_modes & (1u << BENCH_BUF_CMB)) &&
+	    spdk_nvme_ctrlr_reserve_cmb(ctrlr) < 0) {
+		printf("INFO: could not reserve the controller memory buffer\n");
+	}
+
+	/*
+	 * Each controller has one or more namespaces.  An NVMe namespace is basically
+	 *  equivalent to a SCSI LUN.  The controller's IDENTIFY data tells us how
+	 *  many namespaces exist on the controller.  For Intel(R) P3X00 controllers,
+	 *  it will just be one namespace.
+	 *
+	 * Note that in NVMe, namespace IDs start at 1, not 0.
+	 */
+	for (nsid = spdk_nvme_ctrlr_get_first_active_ns(ctrlr); nsid != 0;
+	     nsid = spdk_nvme_ctrlr_get_next_active_ns(ctrlr, nsid)) {
+		ns = spdk_nvme_ctrlr_get_ns(ctrlr, nsid);
+		if (ns == NULL) {
+			continue;
+		}
+		register_ns(ctrlr, ns);
+	}
+}
+
+static void
+cleanup(void)
+{
+	struct ns_entry *ns_entry, *tmp_ns_entry;
+	struct ctrlr_entry *ctrlr_entry, *tmp_ctrlr_entry;
+	struct spdk_nvme_detach_ctx *detach_ctx = NULL;
+
+	TAILQ_FOREACH_SAFE(ns_entry, &g_namespaces, link, tmp_ns_entry) {
+		TAILQ_REMOVE(&g_namespaces, ns_entry, link);
+		free(ns_entry);
+	}
+
+	TAILQ_FOREACH_SAFE(ctrlr_entry, &g_controllers, link, tmp_ctrlr_entry) {
+		TAILQ_REMOVE(&g_controllers, ctrlr_entry, link);
+		spdk_nvme_detach_async(ctrlr_entry->ctrlr, &detach_ctx);
+		free(ctrlr_entry);
+	}
+
+	if (detach_ctx) {
+		spdk_nvme_detach_poll(detach_ctx);
+	}
+}
+
+static void
+usage(const char *program_name)
+{
+	printf("%s [options]\n", program_name);
+	printf("options:\n");
+	printf("\t[-d DPDK huge memory size in MB]\n");
+	printf("\t[-g use single file descriptor for DPDK memory segments]\n");
+	printf("\t[-i shared memory group ID]\n");
+	printf("\t[-m core mask, one benchmark worker per core]\n");
+	printf("\t[-r remote NVMe over Fabrics target address]\n");
+	printf("\t[-V enumerate VMD]\n");
+	printf("\t[-B run the zone append benchmark instead of hello world]\n");
+	printf("\t[-N benchmark every ZNS namespace at once, each core drives all of them]\n");
+	printf("\t[-S scan the zones of every ZNS namespace with this many qpairs instead of hello world]\n");
+	printf("\t[-X compact written zones into empty ones, this percentage of their data is valid]\n");
+	printf("\t[-F source zones to compact (default 16)]\n");
+	printf("\t[-H compact through host read+append even if the device supports simple copy]\n");
+	printf("\t[-q queue depth per core (default 32)]\n");
+	printf("\t[-o io size in bytes (default 4096)]\n");
+	printf("\t[-t run time in seconds (default 10)]\n");
+	printf("\t[-z zones per core (default 4)]\n");
+	printf("\t[-c max completions reaped per poll, 0 for all (default 32)]\n");
+	printf("\t[-P adaptive polling, sleep up to this many us between empty polls (default 0, spin)]\n");
+	printf("\t[-D batch doorbell writes, one per poll instead of one per command]\n");
+	printf("\t[-R percentage of reads of written data (default 0)]\n");
+	printf("\t[-C data buffers in host, cmb or both, both runs the workload once each (default host)]\n");
+#ifdef DEBUG
+	printf("\t[-L enable debug logging]\n");
+#else
+	printf("\t[-L enable debug logging (flag disabled, must reconfigure with --enable-debug)]\n");
+#endif
+}
+
+static int
+parse_uint(const char *arg, const char *what, bool allow_zero, uint32_t *val)
+{
+	long v = spdk_strtol(arg, 10);
+
+	if (v < 0 || (v == 0 && !allow_zero)) {
+		fprintf(stderr, "Invalid %s: %s\n", what, arg);
+		return 1;
+	}
+	*val = v;
+	return 0;
+}
+
+static int
+parse_args(int argc, char **argv, struct spdk_env_opts *env_opts)
+{
+	int op, rc;
+
+	spdk_nvme_trid_populate_transport(&g_trid, SPDK_NVME_TRANSPORT_PCIE);
+	snprintf(g_trid.subnqn, sizeof(g_trid.subnqn), "%s", SPDK_NVMF_DISCOVERY_NQN);
+
+	while ((op = getopt(argc, argv, "d:gi:m:r:L:VBNS:X:F:Hq:o:t:z:c:R:C:P:D")) != -1) {
+		switch (op) {
+		case 'V':
+			g_vmd = true;
+			break;
+		case 'i':
+			env_opts->shm_id = spdk_strtol(optarg, 10);
+			if (env_opts->shm_id < 0) {
+				fprintf(stderr, "Invalid shared memory ID\n");
+				return env_opts->shm_id;
+			}
+			break;
+		case 'g':
+			env_opts->hugepage_single_segments = true;
+			break;
+		case 'm':
+			g_core_mask = optarg;
+			break;
+		case 'r':
+			if (spdk_nvme_transport_id_parse(&g_trid, optarg) != 0) {
+				fprintf(stderr, "Error parsing transport address\n");
+				return 1;
+			}
+			break;
+		case 'd':
+			env_opts->mem_size = spdk_strtol(optarg, 10);
+			if (env_opts->mem_size < 0) {
+				fprintf(stderr, "Invalid DPDK memory size\n");
+				return env_opts->mem_size;
+			}
+			break;
+		case 'B':
+			g_bench = true;
+			break;
+		case 'N':
+			g_bench_all_ns = true;
+			break;
+		case 'X':
+			if (parse_uint(optarg, "valid percentage", false, &g_compact_valid_pct) ||
+			    g_compact_valid_pct > 100) {
+				fprintf(stderr, "Invalid valid percentage: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'F':
+			if (parse_uint(optarg, "source zones", false, &g_compact_zones)) {
+				return 1;
+			}
+			break;
+		case 'H':
+			g_compact_host = true;
+			break;
+		case 'S':
+			if (parse_uint(optarg, "zone scan qpairs", false, &g_scan_qpairs)) {
+				return 1;
+			}
+			break;
+		case 'q':
+			if (parse_uint(optarg, "queue depth", false, &g_queue_depth)) {
+				return 1;
+			}
+			break;
+		case 'o':
+			if (parse_uint(optarg, "io size", false, &g_io_size)) {
+				return 1;
+			}
+			break;
+		case 't':
+			if (parse_uint(optarg, "run time", false, &g_time_sec)) {
+				return 1;
+			}
+			break;
+		case 'z':
+			if (parse_uint(optarg, "zones per core", false, &g_zones_per_core)) {
+				return 1;
+			}
+			break;
+		case 'c':
+			if (parse_uint(optarg, "max completions", true, &g_max_completions)) {
+				return 1;
+			}
+			break;
+		case 'P':
+			if (parse_uint(optarg, "max poll sleep", true, &g_poll_max_us)) {
+				return 1;
+			}
+			break;
+		case 'D':
+			g_delay_doorbell = true;
+			break;
+		case 'R':
+			if (parse_uint(optarg, "read percentage", true, &g_read_pct) || g_read_pct > 100) {
+				fprintf(stderr, "Invalid read percentage: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'C':
+			if (strcmp(optarg, "host") == 0) {
+				g_buf_modes = 1u << BENCH_BUF_HOST;
+			} else if (strcmp(optarg, "cmb") == 0) {
+				g_buf_modes = 1u << BENCH_BUF_CMB;
+			} else if (strcmp(optarg, "both") == 0) {
+				g_buf_modes = (1u << BENCH_BUF_HOST) | (1u << BENCH_BUF_CMB);
+			} else {
+				fprintf(stderr, "Invalid buffer placement: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'L':
+			rc = spdk_log_set_flag(optarg);
+			if (rc < 0) {
+				fprintf(stderr, "unknown flag\n");
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+#ifdef DEBUG
+			spdk_log_set_print_level(SPDK_LOG_DEBUG);
+#endif
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int rc;
+	struct spdk_env_opts opts;
+
+	/*
+	 * SPDK relies on an abstraction around the local environment
+	 * named env that handles memory allocation and PCI device operations.
+	 * This library must be initialized first.
+	 *
+	 */
+	spdk_env_opts_init(&opts);
+	rc = parse_args(argc, argv, &opts);
+	if (rc != 0) {
+		return rc;
+	}
+
+	opts.name = "hello_world";
+	if (g_core_mask) {
+		opts.core_mask = g_core_mask;
+	}
+	if (spdk_env_init(&opts) < 0) {
+		fprintf(stderr, "Unable to initialize SPDK env\n");
+		return 1;
 	}
 
 	printf("Initializing NVMe Controllers\n");
@@ -510,8 +2501,15 @@ main(int argc, char **argv)
 	}
 
 	printf("Initialization complete.\n");
-	hello_world();
-	cleanup();
+	if (g_compact_valid_pct) {
+		rc = compact();
+	} else if (g_scan_qpairs) {
+		rc = scan();
+	} else if (g_bench) {
+		rc = bench();
+	} else {
+		hello_world();
+	}
 	if (g_vmd) {
 		spdk_vmd_fini();
 	}
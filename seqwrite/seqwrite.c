@@ -5,45 +5,503 @@
 #include "spdk/event.h"
 #include "spdk/log.h"
 #include "spdk/string.h"
+#include "spdk/util.h"
+#include "spdk/cpuset.h"
+#include "spdk/histogram_data.h"
 #include "spdk/bdev_zone.h"
+#include "spdk/crc32.h"
+
+struct worker_t;
+struct reclaim_t;
+
+enum io_op {
+    IO_OP_APPEND,
+    IO_OP_READ,
+    IO_OP_WRITE,
+    IO_OP_RESET,
+    IO_OP_OPEN,
+    IO_OP_CLOSE,
+    IO_OP_FINISH,
+    IO_OP_COUNT,
+};
 
 struct request_context_t {
     char *bdev_name;
     struct spdk_bdev *bdev;
     struct spdk_bdev_desc *bdev_desc;
     struct spdk_io_channel *bdev_io_channel;
-    char *buff;
-    uint32_t buff_size;
+    struct spdk_bdev_io_wait_entry bdev_io_wait;
+    /* one worker per core of the reactor mask */
+    TAILQ_HEAD(, worker_t) workers;
+    uint32_t num_workers;
+    /* workers that have not finished the current phase yet */
+    uint32_t workers_pending;
+    /* runs on the app thread once every worker finished the current phase */
+    spdk_msg_fn phase_done_fn;
+    /* zones each worker writes to in the current run */
+    uint32_t num_slots;
+    /* IO_OP_APPEND or IO_OP_WRITE for the current run */
+    enum io_op run_op;
+    /* time-based runs */
+    struct spdk_poller *interval_poller;
+    struct spdk_poller *timeout_poller;
+    uint64_t run_start_tick;
+    uint64_t iv_last_tick;
+    uint32_t iv_pending;
+    uint64_t iv_io;
+    uint64_t iv_blocks;
+    /* zone number of the next zone report batch */
+    uint64_t zone_next;
+    /* background reset thread, -r */
+    struct reclaim_t *reclaim;
+    int rc;
+};
+
+enum slot_state {
+    SLOT_WRITING,       /* taking appends / writes */
+    SLOT_NEED_RESET,    /* recycled zone still holds data from earlier in the run */
+    SLOT_NEED_FINISH,   /* fill mode: zone written, finish it to free the active resource */
+    SLOT_RETIRED,       /* fill mode or -r: the worker has no zones left for this slot */
+    SLOT_WAITING,       /* -r: no reset zone ready yet, picked up by the ready poller */
+};
+
+/* a zone being filled by the append or write engine */
+struct zone_slot_t {
+    uint64_t zone_id;
+    uint64_t capacity;
+    /* host-tracked write pointer is zone_id + blocks_submitted */
+    uint64_t blocks_submitted;
+    uint32_t outstanding;
+    enum slot_state state;
+};
+
+/* per-I/O context, one per queue slot */
+struct io_task_t {
+    struct worker_t *worker;
+    enum io_op op;
+    uint64_t submit_tick;
+    struct zone_slot_t *slot;
+    uint64_t zone_id;
+    uint64_t num_blocks;
+    /* -L: index of this append in its zone's append log */
+    uint32_t append_seq;
+    /* data buffer from the worker's pool while an append or write is in flight */
+    void *buf_elem;
+    void *buf;
     struct spdk_bdev_io_wait_entry bdev_io_wait;
 };
+
+/* submit -> complete latency of every zone operation, in ticks */
+struct op_latency_t {
+    struct spdk_histogram_data *histogram;
+    uint64_t count;
+    uint64_t total_ticks;
+    uint64_t max_ticks;
+};
+
+/* per-core state: an SPDK thread with its own channel, zones and stats */
+struct worker_t {
+    struct request_context_t *req_context;
+    struct spdk_thread *thread;
+    uint32_t core;
+    struct spdk_io_channel *bdev_io_channel;
+    struct io_task_t *tasks;
+    /* zones [zone_first, zone_first + zone_count) belong to this worker */
+    uint64_t zone_first;
+    uint64_t zone_count;
+    /* next zone to submit in a batch phase */
+    uint64_t zone_next;
+    /* append / write engine */
+    enum io_op run_op;
+    struct zone_slot_t *slots;
+    uint32_t num_slots;
+    uint32_t slot_next;
+    uint64_t zone_base;
+    /* zone_base wrapped around, zones handed out from now on hold data */
+    bool wrapped;
+    /* time-based run: stop refilling and finish once drained */
+    bool stop_run;
+    /* contexts that found no zone to write, woken when one frees up */
+    struct io_task_t **idle_tasks;
+    uint32_t num_idle;
+    /* fill mode */
+    uint64_t zones_to_fill;
+    uint64_t zones_finished;
+    uint64_t fill_unflushed;
+    /* -r: zones to reset go out on dirty_ring and come back on ready_ring */
+    struct spdk_ring *dirty_ring;
+    struct spdk_ring *ready_ring;
+    struct spdk_poller *ready_poller;
+    uint64_t reclaim_pending;
+    uint32_t slots_waiting;
+    uint64_t ready_waits;
+    /* DMA buffers on this core's NUMA node, one per queue slot */
+    struct spdk_mempool *buf_pool;
+    struct zone_slot_t *lw_slot;
+    uint64_t lw_blocks_left;
+    uint64_t blocks_total;
+    uint64_t blocks_completed;
+    uint64_t io_completed;
+    uint32_t io_outstanding;
+    /* -V: zones written by this run, read back and checked as soon as each is full,
+     * on read contexts of their own next to the writes
+     */
+    struct io_task_t *vf_tasks;
+    struct io_task_t **vf_idle_tasks;
+    uint32_t vf_num_idle;
+    uint64_t *vf_zones;
+    uint64_t vf_num_zones;
+    uint64_t vf_zone_idx;
+    uint64_t vf_offset;
+    uint64_t vf_blocks;
+    uint64_t vf_mismatches;
+    uint64_t vf_start_tick;
+    uint64_t vf_end_tick;
+    /* reads of the last completion batch, checked once every slot was refilled */
+    struct verify_check_t *vf_checks;
+    uint32_t vf_num_checks;
+    struct spdk_poller *vf_check_poller;
+    /* the writes of the run are done, the read-back may still be draining */
+    bool writes_done;
+    /* -L: appends that did not land where submit order would put them */
+    uint64_t appends_reordered;
+    uint64_t max_displacement;
+    uint64_t start_tick;
+    uint64_t end_tick;
+    /* totals over every run */
+    uint64_t total_blocks;
+    uint64_t total_io;
+    uint64_t total_ticks;
+    int rc;
+    /* worker_phase_done() already reported the current phase */
+    bool phase_finished;
+    struct op_latency_t latency[IO_OP_COUNT];
+    /* interval stats of the run op, double buffered: the worker tallies into
+     * iv_latency[iv_idx] while the app thread drains the other half
+     */
+    struct op_latency_t iv_latency[2];
+    uint32_t iv_idx;
+    uint64_t iv_io;
+    uint64_t iv_blocks;
+    uint64_t iv_io_snap;
+    uint64_t iv_blocks_snap;
+    TAILQ_ENTRY(worker_t) link;
+};
 uint64_t g_tick;
 /* info about bdev device */
 uint64_t g_num_blk = 0;
 uint32_t g_block_size = 0;
 /* info about zone */
-struct spdk_bdev_zone_info zone_info = {0};
 uint64_t g_num_zone = 0;
+/* capacity of the largest zone, most devices use one capacity for all zones */
 uint64_t g_zone_capacity = 0;
 uint64_t g_zone_sz_blk = 0;
 uint32_t g_max_open_zone = 0;
 uint32_t g_max_active_zone = 0;
 uint32_t g_max_append_blk = 0;
 uint64_t g_num_io = 0;
+/* data buffer of one append or write and its DMA alignment */
+uint64_t g_buf_size = 0;
+uint32_t g_buf_align = 1;
+/* number of appends kept in flight per worker */
+uint32_t g_queue_depth = 64;
+/* logical write size, split into appends of at most g_append_blk blocks */
+uint64_t g_io_size = 0;
+uint64_t g_io_blk = 1;
+uint64_t g_append_blk = 1;
+/* number of zones each worker appends to concurrently, 0 picks a default */
+uint32_t g_open_zones = 0;
+/* sweep 1, 2, 4, ... g_open_zones zones and report each */
+bool g_sweep = false;
+
+enum write_mode {
+    WRITE_MODE_APPEND,  /* zone append, device picks the LBA */
+    WRITE_MODE_WRITE,   /* regular write at a host-tracked write pointer */
+    WRITE_MODE_BOTH,    /* same workload with both, reported side by side */
+};
+enum write_mode g_write_mode = WRITE_MODE_APPEND;
+
+/* seconds each run lasts, 0 runs until the zones are full */
+uint64_t g_run_time_sec = 0;
+
+/* fill mode: write every zone of the namespace within the active zone limit */
+bool g_fill = false;
+/* blocks completed by all workers, flushed in batches; 5% steps of the fill */
+#define FILL_STEPS 20
+uint64_t g_fill_blocks_total = 0;
+uint64_t g_fill_blocks_done = 0;
+uint64_t g_fill_flush_blk = 1;
+uint64_t g_fill_start_tick = 0;
+uint64_t g_fill_step_tick[FILL_STEPS + 1];
+/* reset every non-empty zone before the first run instead of right before each
+ * zone is used
+ */
+bool g_eager_reset = false;
+/* resets the background reclaim thread keeps in flight, 0 resets inline */
+uint32_t g_reclaim_qd = 0;
+/* startup timeline, reported when the first run starts */
+uint64_t g_app_start_tick = 0;
+uint64_t g_zone_report_tick = 0;
+uint64_t g_reset_done_tick = 0;
+uint64_t g_startup_resets = 0;
+/* seconds between two interval reports of a time-based run */
+uint64_t g_interval_sec = 1;
+
+enum zone_policy {
+    ZONE_POLICY_RR,     /* round-robin over the open zones */
+    ZONE_POLICY_LO,     /* zone with the fewest outstanding appends */
+};
+enum zone_policy g_zone_policy = ZONE_POLICY_RR;
+
+struct run_result_t {
+    uint32_t num_zones;
+    /* indexed by write_mode, WRITE_MODE_APPEND or WRITE_MODE_WRITE */
+    double iops[2];
+    double mibps[2];
+};
+struct run_result_t g_results[32];
+uint32_t g_num_results = 0;
+
+/* latency of all workers, merged when they exit */
+struct op_latency_t g_latency[IO_OP_COUNT];
+/* run op latency of all workers over the last interval */
+struct op_latency_t g_iv_latency;
+static const char *g_op_name[IO_OP_COUNT] = {
+    "append", "read", "write", "reset", "open", "close", "finish"
+};
+
+static struct spdk_thread *g_app_thread;
+
+/* Host copy of the zone report, indexed by zone number. Loaded in batches at
+ * startup and kept current from completions, each worker only updates the
+ * zones of its own partition.
+ */
+struct zone_entry_t {
+    uint64_t write_pointer;
+    uint32_t capacity;
+    uint8_t state;          /* enum spdk_bdev_zone_state */
+};
+struct zone_entry_t *g_zones = NULL;
+/* -L: where every append of a zone landed, indexed by submit order within the
+ * zone. Allocated when a zone is first written, cleared whenever a slot takes
+ * the zone; only the worker owning the zone touches its log.
+ */
+struct append_rec_t {
+    uint32_t expected;      /* in-zone offset if appends completed in submit order */
+    uint32_t landed;        /* in-zone offset the device assigned */
+};
+struct append_log_t {
+    struct append_rec_t *recs;
+    uint32_t count;
+};
+bool g_append_log = false;
+
+/* -V: every written block starts with this header, the CRC covers the rest of the block */
+struct verify_hdr_t {
+    uint32_t crc;
+    uint32_t magic;
+    uint64_t zone_id;
+    uint64_t lba;           /* UINT64_MAX for appends, the append log has the placement */
+    uint64_t seq;           /* appends: index in the zone's append log */
+    uint32_t block;         /* block index within the append or write */
+};
+#define VERIFY_MAGIC 0x5a5eb10c
+/* -V: a read-back buffer waiting for its CRC32C check */
+struct verify_check_t {
+    void *buf_elem;
+    const char *buf;
+    uint64_t lba;
+    uint64_t num_blocks;
+};
+/* mismatches printed per worker, the rest are only counted */
+#define VERIFY_MAX_REPORT 8
+bool g_verify = false;
+/* -V or -C: read back what each run wrote; -C alone skips the checks, the baseline for -V */
+bool g_readback = false;
+struct append_log_t *g_append_logs = NULL;
+/* zones fetched per spdk_bdev_get_zone_info() call */
+#define ZONE_REPORT_BATCH 1024
+struct spdk_bdev_zone_info *g_zone_report = NULL;
+
+static inline struct zone_entry_t *
+zone_entry(uint64_t zone_id)
+{
+    return &g_zones[zone_id / g_zone_sz_blk];
+}
+
+static inline bool
+zone_writable(uint64_t zone_id)
+{
+    struct zone_entry_t *zone = zone_entry(zone_id);
+
+    return zone->capacity && zone->state != SPDK_BDEV_ZONE_STATE_OFFLINE &&
+           zone->state != SPDK_BDEV_ZONE_STATE_READ_ONLY;
+}
+
+/* Apply a completed I/O or zone action to the table */
+static void
+zone_entry_update(uint64_t zone_id, enum io_op op, uint64_t num_blocks)
+{
+    struct zone_entry_t *zone = zone_entry(zone_id);
+
+    switch (op) {
+    case IO_OP_APPEND:
+    case IO_OP_WRITE:
+        zone->write_pointer += num_blocks;
+        zone->state = zone->write_pointer == zone_id + zone->capacity ?
+                      SPDK_BDEV_ZONE_STATE_FULL : SPDK_BDEV_ZONE_STATE_IMP_OPEN;
+        break;
+    case IO_OP_RESET:
+        zone->write_pointer = zone_id;
+        zone->state = SPDK_BDEV_ZONE_STATE_EMPTY;
+        break;
+    case IO_OP_FINISH:
+        zone->write_pointer = zone_id + zone->capacity;
+        zone->state = SPDK_BDEV_ZONE_STATE_FULL;
+        break;
+    case IO_OP_OPEN:
+        zone->state = SPDK_BDEV_ZONE_STATE_EXP_OPEN;
+        break;
+    case IO_OP_CLOSE:
+        zone->state = zone->write_pointer == zone_id ? SPDK_BDEV_ZONE_STATE_EMPTY :
+                      SPDK_BDEV_ZONE_STATE_CLOSED;
+        break;
+    default:
+        break;
+    }
+}
 
 static void
 usage(void)
 {
     printf(" -b <bdev> name of the bdev to use\n");
+    printf(" -q <depth> number of outstanding appends per core (default 64)\n");
+    printf(" -o <bytes> logical write size, split into appends no larger than the\n");
+    printf("            max zone append size (default one write unit)\n");
+    printf(" -z <zones> number of zones each core appends to concurrently (default 1,\n");
+    printf("            with -F the device's open/active zone limit split over the cores)\n");
+    printf(" -a <rr|lo> zone selection: round-robin or least-outstanding (default rr)\n");
+    printf(" -S         sweep 1, 2, 4, ... -z zones and report throughput of each\n");
+    printf(" -w <append|write|both> zone append, or regular writes at a host-tracked\n");
+    printf("            write pointer with one write in flight per zone (default append)\n");
+    printf(" -t <sec>   run each workload for sec seconds, recycling zones as they fill\n");
+    printf(" -I <sec>   seconds between interval reports of a -t run (default 1)\n");
+    printf(" -F         fill the whole namespace, finishing zones as they fill, and\n");
+    printf("            report throughput for every 5%% of capacity\n");
+    printf(" -R         reset all non-empty zones at startup (default: reset each zone\n");
+    printf("            right before it is written, open and closed zones are finished at\n");
+    printf("            startup so they hold no active resource)\n");
+    printf(" -L         log the LBA every append landed at and report in-zone reordering\n");
+    printf(" -V         stamp every block with its location and a CRC32C, read each zone\n");
+    printf("            back as soon as it is written, next to the writes at the same\n");
+    printf("            queue depth, and count mismatches (implies -L)\n");
+    printf(" -C         read each zone back like -V but without stamping or checking,\n");
+    printf("            the baseline for the cost of -V\n");
+    printf(" -r <n>     reset zones on a background thread with at most n resets in\n");
+    printf("            flight, writers take reset zones from a ready pool\n");
+    printf(" one worker thread runs on every core of the reactor mask (-m)\n");
 }
 
 static char *g_bdev_name = "Malloc0"; /* Default bdev name if without -b */
 static int
 parse_arg(int ch, char *arg)
 {
+    long val;
+
     switch (ch) {
     case 'b':
         g_bdev_name = arg;
         break;
+    case 'q':
+        val = spdk_strtol(arg, 10);
+        if (val <= 0) {
+            fprintf(stderr, "Invalid queue depth: %s\n", arg);
+            return -EINVAL;
+        }
+        g_queue_depth = val;
+        break;
+    case 'o':
+        val = spdk_strtol(arg, 10);
+        if (val <= 0) {
+            fprintf(stderr, "Invalid io size: %s\n", arg);
+            return -EINVAL;
+        }
+        g_io_size = val;
+        break;
+    case 'z':
+        val = spdk_strtol(arg, 10);
+        if (val <= 0) {
+            fprintf(stderr, "Invalid number of zones: %s\n", arg);
+            return -EINVAL;
+        }
+        g_open_zones = val;
+        break;
+    case 'a':
+        if (strcmp(arg, "rr") == 0) {
+            g_zone_policy = ZONE_POLICY_RR;
+        } else if (strcmp(arg, "lo") == 0) {
+            g_zone_policy = ZONE_POLICY_LO;
+        } else {
+            fprintf(stderr, "Invalid zone policy: %s\n", arg);
+            return -EINVAL;
+        }
+        break;
+    case 'S':
+        g_sweep = true;
+        break;
+    case 'F':
+        g_fill = true;
+        break;
+    case 'R':
+        g_eager_reset = true;
+        break;
+    case 'L':
+        g_append_log = true;
+        break;
+    case 'V':
+        g_verify = true;
+        g_readback = true;
+        g_append_log = true;
+        break;
+    case 'C':
+        g_readback = true;
+        break;
+    case 'r':
+        val = spdk_strtol(arg, 10);
+        if (val <= 0) {
+            fprintf(stderr, "Invalid reclaim queue depth: %s\n", arg);
+            return -EINVAL;
+        }
+        g_reclaim_qd = val;
+        break;
+    case 't':
+        val = spdk_strtol(arg, 10);
+        if (val <= 0) {
+            fprintf(stderr, "Invalid run time: %s\n", arg);
+            return -EINVAL;
+        }
+        g_run_time_sec = val;
+        break;
+    case 'I':
+        val = spdk_strtol(arg, 10);
+        if (val <= 0) {
+            fprintf(stderr, "Invalid report interval: %s\n", arg);
+            return -EINVAL;
+        }
+        g_interval_sec = val;
+        break;
+    case 'w':
+        if (strcmp(arg, "append") == 0) {
+            g_write_mode = WRITE_MODE_APPEND;
+        } else if (strcmp(arg, "write") == 0) {
+            g_write_mode = WRITE_MODE_WRITE;
+        } else if (strcmp(arg, "both") == 0) {
+            g_write_mode = WRITE_MODE_BOTH;
+        } else {
+            fprintf(stderr, "Invalid write mode: %s\n", arg);
+            return -EINVAL;
+        }
+        break;
     default:
         return -EINVAL;
     }
@@ -60,6 +518,120 @@ queue_io_wait_with_cb(struct request_context_t *req_context, spdk_bdev_io_wait_c
                     &req_context->bdev_io_wait);
 }
 
+
+static void
+queue_task_io_wait(struct io_task_t *task, spdk_bdev_io_wait_cb cb_fn)
+{
+    struct worker_t *worker = task->worker;
+
+    task->bdev_io_wait.bdev = worker->req_context->bdev;
+    task->bdev_io_wait.cb_fn = cb_fn;
+    task->bdev_io_wait.cb_arg = task;
+    spdk_bdev_queue_io_wait(worker->req_context->bdev, worker->bdev_io_channel,
+                    &task->bdev_io_wait);
+}
+
+static void
+latency_record(struct io_task_t *task)
+{
+    struct op_latency_t *lat = &task->worker->latency[task->op];
+    uint64_t ticks = spdk_get_ticks() - task->submit_tick;
+
+    spdk_histogram_data_tally(lat->histogram, ticks);
+    lat->count++;
+    lat->total_ticks += ticks;
+    if (ticks > lat->max_ticks) {
+        lat->max_ticks = ticks;
+    }
+
+    if (g_run_time_sec && task->op == task->worker->run_op) {
+        lat = &task->worker->iv_latency[task->worker->iv_idx];
+        spdk_histogram_data_tally(lat->histogram, ticks);
+        lat->count++;
+        lat->total_ticks += ticks;
+        lat->max_ticks = spdk_max(lat->max_ticks, ticks);
+    }
+}
+
+static void
+latency_reset(struct op_latency_t *lat)
+{
+    spdk_histogram_data_reset(lat->histogram);
+    lat->count = 0;
+    lat->total_ticks = 0;
+    lat->max_ticks = 0;
+}
+
+static void
+latency_merge(struct op_latency_t *dst, const struct op_latency_t *src)
+{
+    spdk_histogram_data_merge(dst->histogram, src->histogram);
+    dst->count += src->count;
+    dst->total_ticks += src->total_ticks;
+    dst->max_ticks = spdk_max(dst->max_ticks, src->max_ticks);
+}
+
+struct latency_pctl_ctx {
+    const double *pctl;
+    uint64_t *ticks;
+    uint32_t num_pctl;
+    uint32_t idx;
+};
+
+static void
+latency_pctl_cb(void *ctx, uint64_t start, uint64_t end, uint64_t count,
+                uint64_t total, uint64_t so_far)
+{
+    struct latency_pctl_ctx *pctl_ctx = ctx;
+
+    /* so_far includes this bucket, so its upper bound covers every percentile reached */
+    while (pctl_ctx->idx < pctl_ctx->num_pctl &&
+           (double)so_far >= total * pctl_ctx->pctl[pctl_ctx->idx] / 100) {
+        pctl_ctx->ticks[pctl_ctx->idx++] = end;
+    }
+}
+
+/* Fill ticks[i] with the pctl[i] percentile of lat */
+static void
+latency_percentiles(const struct op_latency_t *lat, const double *pctl, uint64_t *ticks,
+                    uint32_t num_pctl)
+{
+    struct latency_pctl_ctx ctx;
+
+    for (uint32_t i = 0; i < num_pctl; i++) {
+        ticks[i] = lat->max_ticks;
+    }
+    ctx.pctl = pctl;
+    ctx.ticks = ticks;
+    ctx.num_pctl = num_pctl;
+    ctx.idx = 0;
+    spdk_histogram_data_iterate(lat->histogram, latency_pctl_cb, &ctx);
+}
+
+static void
+latency_print(void)
+{
+    static const double pctl[] = {50, 99, 99.9, 99.99};
+    uint64_t ticks[SPDK_COUNTOF(pctl)];
+    double us_per_tick = 1000.0 * 1000.0 / spdk_get_ticks_hz();
+
+    printf("[latency] us\n");
+    printf("%8s %10s %10s %10s %10s %10s %10s %10s\n", "op", "count", "avg",
+           "p50", "p99", "p99.9", "p99.99", "max");
+    for (int op = 0; op < IO_OP_COUNT; op++) {
+        struct op_latency_t *lat = &g_latency[op];
+
+        if (lat->count == 0) {
+            continue;
+        }
+        latency_percentiles(lat, pctl, ticks, SPDK_COUNTOF(pctl));
+        printf("%8s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", g_op_name[op],
+               lat->count, (double)lat->total_ticks / lat->count * us_per_tick,
+               ticks[0] * us_per_tick, ticks[1] * us_per_tick, ticks[2] * us_per_tick,
+               ticks[3] * us_per_tick, lat->max_ticks * us_per_tick);
+    }
+}
+
 static void
 appstop_error(struct request_context_t *req_context)
 {
@@ -76,371 +648,2258 @@ appstop_success(struct request_context_t *req_context)
     spdk_app_stop(0);
 }
 
-/* read start 
-uint64_t r_complete = 0;
+/* worker start */
+static int worker_ready_poll(void *arg);
+static int verify_check_poll(void *arg);
+static void reclaim_stop(struct request_context_t *req_context);
 
 static void
-read_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+_worker_phase_done(void *arg)
 {
-    struct request_context_t *req_context = cb_arg;
+    struct worker_t *worker = arg;
+    struct request_context_t *req_context = worker->req_context;
 
-    spdk_bdev_free_io(bdev_io);
+    if (worker->rc) {
+        req_context->rc = worker->rc;
+    }
+    if (--req_context->workers_pending == 0) {
+        req_context->phase_done_fn(req_context);
+    }
+}
 
-    if (success) {
-        r_complete++;
-        //SPDK_NOTICELOG("Read string from bdev : %s\n", req_context->buff);
-    } else {
-        SPDK_ERRLOG("bdev io read error\n");
-        appstop_error(req_context);
+/* Called on the worker thread once it has nothing left in flight. Only the
+ * first call of a phase counts, a synchronous submit failure can reach here
+ * both from worker_io_failed() and from the drained check after the loop.
+ */
+static void
+worker_phase_done(struct worker_t *worker)
+{
+    if (worker->phase_finished) {
+        return;
     }
+    worker->phase_finished = true;
+    spdk_thread_send_msg(g_app_thread, _worker_phase_done, worker);
+}
 
-    if (r_complete == g_num_io) {
-        printf("Read bdev complete\n");
-        appstop_success(req_context);
+/* Run fn on every worker thread, then done_fn on the app thread once all of
+ * them called worker_phase_done().
+ */
+static void
+workers_run_phase(struct request_context_t *req_context, spdk_msg_fn fn, spdk_msg_fn done_fn)
+{
+    struct worker_t *worker;
+
+    req_context->workers_pending = req_context->num_workers;
+    req_context->phase_done_fn = done_fn;
+    TAILQ_FOREACH(worker, &req_context->workers, link) {
+        worker->phase_finished = false;
+        spdk_thread_send_msg(worker->thread, fn, worker);
     }
+}
 
+/* An I/O of the current phase failed: stop refilling and report once drained */
+static void
+worker_io_failed(struct worker_t *worker, int rc)
+{
+    if (!worker->rc) {
+        worker->rc = rc;
+    }
+    if (worker->io_outstanding == 0) {
+        worker_phase_done(worker);
+    }
 }
 
 static void
-read_bdev(void *arg)
+worker_init(void *arg)
 {
-    struct request_context_t *req_context = arg;
-    int rc = 0;
+    struct worker_t *worker = arg;
 
-    printf("Reading the bdev...\n");
-    
-    uint64_t num_blocks = 1;
-    for (uint64_t i = 0, offset_blocks = 0; i < g_num_io; i++, offset_blocks++) {
-        // Zero the buffer so that we can use it for reading 
-        memset(req_context->buff, 0, req_context->buff_size);
-        rc = spdk_bdev_read_blocks(req_context->bdev_desc, req_context->bdev_io_channel,
-                    req_context->buff, offset_blocks, num_blocks, 
-                    read_complete, req_context);
+    worker->bdev_io_channel = spdk_bdev_get_io_channel(worker->req_context->bdev_desc);
+    if (worker->bdev_io_channel == NULL) {
+        SPDK_ERRLOG("Could not create bdev I/O channel on core %u\n", worker->core);
+        worker->rc = -ENOMEM;
+    }
+    if (g_reclaim_qd) {
+        worker->ready_poller = SPDK_POLLER_REGISTER(worker_ready_poll, worker, 0);
+    }
+    if (g_verify) {
+        worker->vf_check_poller = SPDK_POLLER_REGISTER(verify_check_poll, worker, 0);
+    }
+    worker_phase_done(worker);
+}
 
-        if (rc == -ENOMEM) {
-            SPDK_NOTICELOG("Queueing io\n");
-            queue_io_wait_with_cb(req_context, read_bdev);
-        } else if (rc) {
-            SPDK_ERRLOG("%s error while reading from bdev: %d\n", spdk_strerror(-rc), rc);
-            appstop_error(req_context);
+static void
+worker_fini(void *arg)
+{
+    struct worker_t *worker = arg;
+
+    spdk_poller_unregister(&worker->ready_poller);
+    spdk_poller_unregister(&worker->vf_check_poller);
+    if (worker->bdev_io_channel) {
+        spdk_put_io_channel(worker->bdev_io_channel);
+        worker->bdev_io_channel = NULL;
+    }
+    worker_phase_done(worker);
+    spdk_thread_exit(worker->thread);
+}
+
+static void
+worker_free(struct worker_t *worker)
+{
+    for (int op = 0; op < IO_OP_COUNT; op++) {
+        if (worker->latency[op].histogram) {
+            spdk_histogram_data_free(worker->latency[op].histogram);
         }
     }
-   
+    for (int i = 0; i < 2; i++) {
+        if (worker->iv_latency[i].histogram) {
+            spdk_histogram_data_free(worker->iv_latency[i].histogram);
+        }
+    }
+    free(worker->tasks);
+    free(worker->idle_tasks);
+    free(worker->slots);
+    free(worker->vf_zones);
+    free(worker->vf_tasks);
+    free(worker->vf_idle_tasks);
+    free(worker->vf_checks);
+    if (worker->buf_pool) {
+        spdk_mempool_free(worker->buf_pool);
+    }
+    if (worker->dirty_ring) {
+        spdk_ring_free(worker->dirty_ring);
+    }
+    if (worker->ready_ring) {
+        spdk_ring_free(worker->ready_ring);
+    }
+    free(worker);
 }
- read end */
 
-/* write start 
-uint64_t w_complete = 0;
+/* mempool constructor: stamp each buffer so written blocks are recognizable */
+static void
+buf_init(struct spdk_mempool *mp, void *opaque, void *obj, unsigned obj_idx)
+{
+    void *buf = (void *)SPDK_ALIGN_CEIL((uintptr_t)obj, g_buf_align);
+
+    memset(buf, 0, g_buf_size);
+    snprintf(buf, g_buf_size, "Hello World! #%u\n", obj_idx);
+}
+
+/* -V: header and CRC32C for every block of an append or write */
+static void
+verify_stamp(struct io_task_t *task)
+{
+    struct verify_hdr_t *hdr;
+    char *block;
+
+    for (uint64_t i = 0; i < task->num_blocks; i++) {
+        block = (char *)task->buf + i * g_block_size;
+        hdr = (struct verify_hdr_t *)block;
+        hdr->magic = VERIFY_MAGIC;
+        hdr->zone_id = task->slot->zone_id;
+        hdr->lba = task->op == IO_OP_WRITE ? task->zone_id + i : UINT64_MAX;
+        hdr->seq = task->op == IO_OP_APPEND ? task->append_seq : 0;
+        hdr->block = i;
+        hdr->crc = spdk_crc32c_update(block + sizeof(hdr->crc), g_block_size - sizeof(hdr->crc),
+                                      ~0u);
+    }
+}
+
+static void
+task_buf_get(struct io_task_t *task)
+{
+    if (!task->buf_elem) {
+        task->buf_elem = spdk_mempool_get(task->worker->buf_pool);
+        task->buf = (void *)SPDK_ALIGN_CEIL((uintptr_t)task->buf_elem, g_buf_align);
+        if (g_verify && task->op != IO_OP_READ) {
+            verify_stamp(task);
+        }
+    }
+}
+
+static void
+task_buf_put(struct io_task_t *task)
+{
+    if (task->buf_elem) {
+        spdk_mempool_put(task->worker->buf_pool, task->buf_elem);
+        task->buf_elem = NULL;
+        task->buf = NULL;
+    }
+}
+
+static int
+worker_alloc(struct request_context_t *req_context, uint32_t core)
+{
+    struct spdk_cpuset cpumask;
+    struct worker_t *worker;
+    char name[32];
+
+    worker = calloc(1, sizeof(*worker));
+    if (!worker) {
+        return -ENOMEM;
+    }
+    worker->req_context = req_context;
+    worker->core = core;
+
+    /* One context per queue slot, shared by every phase */
+    worker->tasks = calloc(g_queue_depth, sizeof(struct io_task_t));
+    worker->idle_tasks = calloc(g_queue_depth, sizeof(struct io_task_t *));
+    if (!worker->tasks || !worker->idle_tasks) {
+        worker_free(worker);
+        return -ENOMEM;
+    }
+    for (uint32_t i = 0; i < g_queue_depth; i++) {
+        worker->tasks[i].worker = worker;
+    }
+    if (g_readback) {
+        worker->vf_tasks = calloc(g_queue_depth, sizeof(struct io_task_t));
+        worker->vf_idle_tasks = calloc(g_queue_depth, sizeof(struct io_task_t *));
+        if (!worker->vf_tasks || !worker->vf_idle_tasks) {
+            worker_free(worker);
+            return -ENOMEM;
+        }
+        for (uint32_t i = 0; i < g_queue_depth; i++) {
+            worker->vf_tasks[i].worker = worker;
+        }
+    }
+    if (g_verify) {
+        worker->vf_checks = calloc(g_queue_depth, sizeof(struct verify_check_t));
+        if (!worker->vf_checks) {
+            worker_free(worker);
+            return -ENOMEM;
+        }
+    }
+
+    /* Every task holds at most one buffer. With -V up to g_queue_depth more
+     * wait for their check, plus the one a completion checks inline when that
+     * backlog is full, so the pool never runs dry. No per-lcore cache: only
+     * this core takes from it.
+     */
+    snprintf(name, sizeof(name), "seqwrite_buf_%u", core);
+    worker->buf_pool = spdk_mempool_create_ctor(name,
+                       g_queue_depth * (g_verify ? 3 : g_readback ? 2 : 1) + 1,
+                       g_buf_size + g_buf_align - 1, 0,
+                       spdk_env_get_socket_id(core), buf_init, NULL);
+    if (!worker->buf_pool) {
+        worker_free(worker);
+        return -ENOMEM;
+    }
+    for (int op = 0; op < IO_OP_COUNT; op++) {
+        worker->latency[op].histogram = spdk_histogram_data_alloc();
+        if (!worker->latency[op].histogram) {
+            worker_free(worker);
+            return -ENOMEM;
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        worker->iv_latency[i].histogram = spdk_histogram_data_alloc();
+        if (!worker->iv_latency[i].histogram) {
+            worker_free(worker);
+            return -ENOMEM;
+        }
+    }
+
+    if (g_reclaim_qd) {
+        /* room for every zone of the partition, a zone sits on at most one ring */
+        worker->dirty_ring = spdk_ring_create(SPDK_RING_TYPE_SP_SC,
+                                              spdk_align32pow2(g_num_zone + 1),
+                                              spdk_env_get_socket_id(core));
+        worker->ready_ring = spdk_ring_create(SPDK_RING_TYPE_SP_SC,
+                                              spdk_align32pow2(g_num_zone + 1),
+                                              spdk_env_get_socket_id(core));
+        if (!worker->dirty_ring || !worker->ready_ring) {
+            worker_free(worker);
+            return -ENOMEM;
+        }
+    }
+
+    snprintf(name, sizeof(name), "seqwrite_%u", core);
+    spdk_cpuset_zero(&cpumask);
+    spdk_cpuset_set_cpu(&cpumask, core, true);
+    worker->thread = spdk_thread_create(name, &cpumask);
+    if (!worker->thread) {
+        worker_free(worker);
+        return -ENOMEM;
+    }
+
+    TAILQ_INSERT_TAIL(&req_context->workers, worker, link);
+    req_context->num_workers++;
+    return 0;
+}
+
+static void
+workers_fini_done(void *arg)
+{
+    struct request_context_t *req_context = arg;
+    struct worker_t *worker, *tmp;
+    double hz = spdk_get_ticks_hz();
+
+    printf("[workers]\n");
+    TAILQ_FOREACH_SAFE(worker, &req_context->workers, link, tmp) {
+        if (worker->total_ticks) {
+            printf("core %u: zones #%lu ~ #%lu, %lu I/Os, %.0f IOPS, %.2f MiB/s\n",
+                   worker->core, worker->zone_first, worker->zone_first + worker->zone_count - 1,
+                   worker->total_io, worker->total_io * hz / worker->total_ticks,
+                   (double)worker->total_blocks * g_block_size * hz / worker->total_ticks /
+                   (1024 * 1024));
+        }
+        for (int op = 0; op < IO_OP_COUNT; op++) {
+            latency_merge(&g_latency[op], &worker->latency[op]);
+        }
+        TAILQ_REMOVE(&req_context->workers, worker, link);
+        worker_free(worker);
+    }
+    req_context->num_workers = 0;
+
+    if (req_context->rc) {
+        appstop_error(req_context);
+    } else {
+        appstop_success(req_context);
+    }
+}
+
+/* Release every worker's channel and thread, then stop the app */
+static void
+workers_stop(struct request_context_t *req_context, int rc)
+{
+    if (rc) {
+        req_context->rc = rc;
+    }
+    if (req_context->reclaim) {
+        /* comes back here once the reclaim thread is gone */
+        reclaim_stop(req_context);
+        return;
+    }
+    if (req_context->num_workers == 0) {
+        workers_fini_done(req_context);
+        return;
+    }
+    workers_run_phase(req_context, worker_fini, workers_fini_done);
+}
+/* worker end */
+
+/* reclaim start */
+/* One zone reset issued by the reclaim thread */
+struct reclaim_task_t {
+    struct reclaim_t *reclaim;
+    struct worker_t *worker;
+    uint64_t zone_id;
+    uint64_t submit_tick;
+    struct spdk_bdev_io_wait_entry bdev_io_wait;
+};
+
+/* Thread that resets zones the workers are done with, off their I/O path */
+struct reclaim_t {
+    struct request_context_t *req_context;
+    struct spdk_thread *thread;
+    struct spdk_io_channel *bdev_io_channel;
+    struct spdk_poller *poller;
+    struct reclaim_task_t *tasks;
+    struct reclaim_task_t **free_tasks;
+    uint32_t num_free;
+    uint32_t outstanding;
+    /* worker whose dirty ring is looked at first on the next poll */
+    struct worker_t *worker_next;
+    struct op_latency_t latency;
+    uint64_t resets;
+    bool stopping;
+    int rc;
+};
+
+/* Worker side: hand a written zone to the reclaim thread */
+static void
+reclaim_enqueue(struct worker_t *worker, uint64_t zone_id)
+{
+    void *zone = (void *)(uintptr_t)zone_id;
+
+    spdk_ring_enqueue(worker->dirty_ring, &zone, 1, NULL);
+    worker->reclaim_pending++;
+}
+
+static void reclaim_reset_submit(void *arg);
+static void workers_init_done(void *arg);
+
+static void
+reclaim_free(struct reclaim_t *reclaim)
+{
+    if (reclaim->latency.histogram) {
+        spdk_histogram_data_free(reclaim->latency.histogram);
+    }
+    free(reclaim->tasks);
+    free(reclaim->free_tasks);
+    free(reclaim);
+}
+
+static void
+_reclaim_stopped(void *arg)
+{
+    struct reclaim_t *reclaim = arg;
+    struct request_context_t *req_context = reclaim->req_context;
+    struct worker_t *worker;
+    uint64_t waits = 0;
+    int rc;
+
+    TAILQ_FOREACH(worker, &req_context->workers, link) {
+        waits += worker->ready_waits;
+    }
+    printf("[reclaim] %lu zones reset in the background, at most %u in flight, "
+           "writers found the ready pool empty %lu times\n", reclaim->resets, g_reclaim_qd, waits);
+    latency_merge(&g_latency[IO_OP_RESET], &reclaim->latency);
+
+    rc = reclaim->rc;
+    req_context->reclaim = NULL;
+    reclaim_free(reclaim);
+    workers_stop(req_context, rc);
+}
+
+static void
+reclaim_exit(struct reclaim_t *reclaim)
+{
+    spdk_poller_unregister(&reclaim->poller);
+    if (reclaim->bdev_io_channel) {
+        spdk_put_io_channel(reclaim->bdev_io_channel);
+        reclaim->bdev_io_channel = NULL;
+    }
+    spdk_thread_send_msg(g_app_thread, _reclaim_stopped, reclaim);
+    spdk_thread_exit(reclaim->thread);
+}
+
+static void
+reclaim_reset_done(struct reclaim_task_t *task, bool success)
+{
+    struct reclaim_t *reclaim = task->reclaim;
+    struct op_latency_t *lat = &reclaim->latency;
+    uint64_t ticks = spdk_get_ticks() - task->submit_tick;
+    void *zone = (void *)(uintptr_t)task->zone_id;
+
+    reclaim->outstanding--;
+
+    if (success) {
+        spdk_histogram_data_tally(lat->histogram, ticks);
+        lat->count++;
+        lat->total_ticks += ticks;
+        lat->max_ticks = spdk_max(lat->max_ticks, ticks);
+        zone_entry_update(task->zone_id, IO_OP_RESET, 0);
+        reclaim->resets++;
+    } else {
+        /* hand the zone back anyway, the write to it fails and stops the run */
+        SPDK_ERRLOG("bdev io reset zone 0x%lx error: %d\n", task->zone_id, EIO);
+        reclaim->rc = -EIO;
+    }
+    spdk_ring_enqueue(task->worker->ready_ring, &zone, 1, NULL);
+    reclaim->free_tasks[reclaim->num_free++] = task;
+
+    if (reclaim->stopping && reclaim->outstanding == 0) {
+        reclaim_exit(reclaim);
+    }
+}
+
+static void
+reclaim_reset_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    spdk_bdev_free_io(bdev_io);
+    reclaim_reset_done(cb_arg, success);
+}
+
+static void
+reclaim_reset_submit(void *arg)
+{
+    struct reclaim_task_t *task = arg;
+    struct reclaim_t *reclaim = task->reclaim;
+    int rc = 0;
+
+    task->submit_tick = spdk_get_ticks();
+    rc = spdk_bdev_zone_management(reclaim->req_context->bdev_desc, reclaim->bdev_io_channel,
+                                   task->zone_id, SPDK_BDEV_ZONE_RESET,
+                                   reclaim_reset_complete, task);
+    if (rc == -ENOMEM) {
+        task->bdev_io_wait.bdev = reclaim->req_context->bdev;
+        task->bdev_io_wait.cb_fn = reclaim_reset_submit;
+        task->bdev_io_wait.cb_arg = task;
+        spdk_bdev_queue_io_wait(reclaim->req_context->bdev, reclaim->bdev_io_channel,
+                                &task->bdev_io_wait);
+    } else if (rc) {
+        SPDK_ERRLOG("%s error while submitting %s: %d\n", spdk_strerror(-rc),
+                    g_op_name[task->op], rc);
+        reclaim_reset_done(task, false);
+    }
+}
+
+/* Take dirty zones round-robin from the workers while below the reset cap */
+static int
+reclaim_poll(void *arg)
+{
+    struct reclaim_t *reclaim = arg;
+    struct request_context_t *req_context = reclaim->req_context;
+    struct worker_t *worker = reclaim->worker_next;
+    struct reclaim_task_t *task;
+    uint32_t empty = 0, submitted = 0;
+    void *zone;
+
+    while (reclaim->num_free && empty < req_context->num_workers) {
+        if (spdk_ring_dequeue(worker->dirty_ring, &zone, 1) == 1) {
+            task = reclaim->free_tasks[--reclaim->num_free];
+            task->worker = worker;
+            task->zone_id = (uintptr_t)zone;
+            reclaim->outstanding++;
+            reclaim_reset_submit(task);
+            submitted++;
+            empty = 0;
+        } else {
+            empty++;
+        }
+        worker = TAILQ_NEXT(worker, link) ? TAILQ_NEXT(worker, link) :
+                 TAILQ_FIRST(&req_context->workers);
+    }
+    reclaim->worker_next = worker;
+    return submitted ? SPDK_POLLER_BUSY : SPDK_POLLER_IDLE;
+}
+
+static void
+reclaim_init(void *arg)
+{
+    struct reclaim_t *reclaim = arg;
+
+    reclaim->bdev_io_channel = spdk_bdev_get_io_channel(reclaim->req_context->bdev_desc);
+    if (reclaim->bdev_io_channel == NULL) {
+        SPDK_ERRLOG("Could not create bdev I/O channel for the reclaim thread\n");
+        reclaim->rc = -ENOMEM;
+        reclaim_exit(reclaim);
+        return;
+    }
+    reclaim->poller = SPDK_POLLER_REGISTER(reclaim_poll, reclaim, 0);
+    spdk_thread_send_msg(g_app_thread, workers_init_done, reclaim->req_context);
+}
+
+static void
+_reclaim_stop(void *arg)
+{
+    struct reclaim_t *reclaim = arg;
+
+    reclaim->stopping = true;
+    spdk_poller_unregister(&reclaim->poller);
+    if (reclaim->outstanding == 0) {
+        reclaim_exit(reclaim);
+    }
+}
+
+/* Drain the resets in flight, then workers_stop() carries on */
+static void
+reclaim_stop(struct request_context_t *req_context)
+{
+    spdk_thread_send_msg(req_context->reclaim->thread, _reclaim_stop, req_context->reclaim);
+}
+
+/* Start the reclaim thread on the app core, the workers' rings exist already */
+static int
+reclaim_start(struct request_context_t *req_context)
+{
+    struct spdk_cpuset cpumask;
+    struct reclaim_t *reclaim;
+
+    reclaim = calloc(1, sizeof(*reclaim));
+    if (!reclaim) {
+        return -ENOMEM;
+    }
+    reclaim->req_context = req_context;
+    reclaim->worker_next = TAILQ_FIRST(&req_context->workers);
+    reclaim->tasks = calloc(g_reclaim_qd, sizeof(struct reclaim_task_t));
+    reclaim->free_tasks = calloc(g_reclaim_qd, sizeof(struct reclaim_task_t *));
+    reclaim->latency.histogram = spdk_histogram_data_alloc();
+    if (!reclaim->tasks || !reclaim->free_tasks || !reclaim->latency.histogram) {
+        reclaim_free(reclaim);
+        return -ENOMEM;
+    }
+    for (uint32_t i = 0; i < g_reclaim_qd; i++) {
+        reclaim->tasks[i].reclaim = reclaim;
+        reclaim->free_tasks[reclaim->num_free++] = &reclaim->tasks[i];
+    }
+
+    spdk_cpuset_zero(&cpumask);
+    spdk_cpuset_set_cpu(&cpumask, spdk_env_get_current_core(), true);
+    reclaim->thread = spdk_thread_create("seqwrite_reclaim", &cpumask);
+    if (!reclaim->thread) {
+        reclaim_free(reclaim);
+        return -ENOMEM;
+    }
+    req_context->reclaim = reclaim;
+    spdk_thread_send_msg(reclaim->thread, reclaim_init, reclaim);
+    return 0;
+}
+/* reclaim end */
+
+/* read start 
+uint64_t r_complete = 0;
+
+static void
+read_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct request_context_t *req_context = cb_arg;
+
+    spdk_bdev_free_io(bdev_io);
+
+    if (success) {
+        r_complete++;
+        //SPDK_NOTICELOG("Read string from bdev : %s\n", req_context->buff);
+    } else {
+        SPDK_ERRLOG("bdev io read error\n");
+        appstop_error(req_context);
+    }
+
+    if (r_complete == g_num_io) {
+        printf("Read bdev complete\n");
+        appstop_success(req_context);
+    }
+
+}
+
+static void
+read_bdev(void *arg)
+{
+    struct request_context_t *req_context = arg;
+    int rc = 0;
+
+    printf("Reading the bdev...\n");
+    
+    uint64_t num_blocks = 1;
+    for (uint64_t i = 0, offset_blocks = 0; i < g_num_io; i++, offset_blocks++) {
+        // Zero the buffer so that we can use it for reading 
+        memset(req_context->buff, 0, req_context->buff_size);
+        rc = spdk_bdev_read_blocks(req_context->bdev_desc, req_context->bdev_io_channel,
+                    req_context->buff, offset_blocks, num_blocks, 
+                    read_complete, req_context);
+
+        if (rc == -ENOMEM) {
+            SPDK_NOTICELOG("Queueing io\n");
+            queue_io_wait_with_cb(req_context, read_bdev);
+        } else if (rc) {
+            SPDK_ERRLOG("%s error while reading from bdev: %d\n", spdk_strerror(-rc), rc);
+            appstop_error(req_context);
+        }
+    }
+   
+}
+ read end */
+
+/* write start 
+uint64_t w_complete = 0;
+
+static void
+write_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct request_context_t *req_context = cb_arg;
+
+    spdk_bdev_free_io(bdev_io);
+
+    if (success) {
+        w_complete++;
+    } else {
+        SPDK_ERRLOG("bdev io write error: %d\n", EIO);
+        appstop_error(req_context);
+        return;
+    }
+
+    if (w_complete == g_num_io) {
+        printf("Write bdev complete\n");
+        read_bdev(req_context);
+    }
+}
+
+static void
+write_bdev(void *arg)
+{
+    struct request_context_t *req_context = arg;
+    int rc = 0;
+
+    printf("Writing to the bdev...\n");
+
+    g_num_io = g_num_blk;
+    uint64_t num_blocks = 1;
+    for (uint64_t i = 0, offset_blocks = 0; i < g_num_io; i++, offset_blocks++) {
+        rc = spdk_bdev_write_blocks(req_context->bdev_desc, req_context->bdev_io_channel,
+                                req_context->buff, offset_blocks, num_blocks, 
+                                write_complete, req_context);
+
+        if (rc == -ENOMEM) {
+            SPDK_NOTICELOG("Queueing io\n");
+            queue_io_wait_with_cb(req_context, write_bdev);
+        } else if (rc) {
+            SPDK_ERRLOG("%s error while writing to bdev: %d\n", spdk_strerror(-rc), rc);
+            appstop_error(req_context);
+        }
+    }
+}
+ write end */
+
+/* read zone start 
+uint64_t rz_complete = 0;
+
+static void
+read_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct request_context_t *req_context = cb_arg;
+
+    spdk_bdev_free_io(bdev_io);
+
+    if (success) {
+        rz_complete++;
+        //printf("%s", req_context->buff);
+    } else {
+        SPDK_ERRLOG("bdev io read error\n");
+        appstop_error(req_context);
+    }
+
+    if (rz_complete == g_num_io) {
+        printf("Read bdev complete\n");
+        appstop_success(req_context);
+    }
+
+}
+
+static void
+read_zone(void *arg)
+{
+    struct request_context_t *req_context = arg;
+    int rc = 0;
+
+    printf("Reading the bdev...\n");
+   
+    uint64_t num_blocks = 1;
+    uint64_t offset_blocks = 0;
+    for (uint32_t zone = 0; zone < 1; zone++) {
+        offset_blocks = zone * g_zone_sz_blk;
+        for (; offset_blocks < zone * g_zone_sz_blk + g_zone_capacity; offset_blocks++) {        
+            // Zero the buffer so that we can use it for reading 
+            memset(req_context->buff, 0, req_context->buff_size);
+            rc = spdk_bdev_read_blocks(req_context->bdev_desc, req_context->bdev_io_channel,
+                    req_context->buff, offset_blocks, num_blocks, 
+                    read_zone_complete, req_context);
+            if (rc == -ENOMEM) {
+                SPDK_NOTICELOG("Queueing io\n");
+                queue_io_wait_with_cb(req_context, read_zone);
+            } else if (rc) {
+                SPDK_ERRLOG("%s error while writing to bdev: %d\n", spdk_strerror(-rc), rc);
+                appstop_error(req_context);
+            }   
+        }
+    }  
+
+
+    uint64_t num_blocks = 1;
+    for (uint64_t i = 0, offset_blocks = 0; i < g_num_io; i++, offset_blocks++) {
+        // Zero the buffer so that we can use it for reading 
+        memset(req_context->buff, 0, req_context->buff_size);
+        rc = spdk_bdev_read_blocks(req_context->bdev_desc, req_context->bdev_io_channel,
+                    req_context->buff, offset_blocks, num_blocks, 
+                    read_zone_complete, req_context);
+
+        if (rc == -ENOMEM) {
+            SPDK_NOTICELOG("Queueing io\n");
+            queue_io_wait_with_cb(req_context, read_zone);
+        } else if (rc) {
+            SPDK_ERRLOG("%s error while reading from bdev: %d\n", spdk_strerror(-rc), rc);
+            appstop_error(req_context);
+        }
+    }
+   
+}
+ read zone end */
+
+/* append zone start */
+static void append_zone_submit(void *arg);
+static void write_zone_submit(void *arg);
+static void slot_mgmt_submit(void *arg);
+static void verify_kick(struct worker_t *worker);
+static void verify_zone_finish(struct worker_t *worker);
+
+static bool
+zone_in_use(struct worker_t *worker, uint64_t zone_id)
+{
+    for (uint32_t i = 0; i < worker->num_slots; i++) {
+        if (worker->slots[i].zone_id == zone_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Point slot at the next writable zone of this worker. A zone that is not empty,
+ * left over from an earlier run or written earlier in this one once zone_base
+ * wrapped around, is reset right before use. In fill mode zones are never
+ * reused, the slot retires instead.
+ */
+static void
+slot_assign(struct worker_t *worker, struct zone_slot_t *slot)
+{
+    uint64_t zone_id;
+    void *zone;
+
+    for (;;) {
+        if (worker->zone_base == worker->zone_first + worker->zone_count) {
+            if (g_reclaim_qd) {
+                /* after the first pass every zone comes back reset from the reclaim thread */
+                if (spdk_ring_dequeue(worker->ready_ring, &zone, 1) == 1) {
+                    worker->reclaim_pending--;
+                    zone_id = (uintptr_t)zone;
+                    break;
+                }
+                /* with nothing left to come back from the reclaim thread the
+                 * slot would wait forever, it retires instead
+                 */
+                if (worker->reclaim_pending) {
+                    slot->state = SLOT_WAITING;
+                    slot->capacity = 0;
+                    slot->blocks_submitted = 0;
+                    worker->slots_waiting++;
+                    worker->ready_waits++;
+                    return;
+                }
+            }
+            if (g_fill || g_reclaim_qd) {
+                slot->state = SLOT_RETIRED;
+                slot->capacity = 0;
+                slot->blocks_submitted = 0;
+                return;
+            }
+            worker->zone_base = worker->zone_first;
+            worker->wrapped = true;
+        }
+        zone_id = worker->zone_base++ * g_zone_sz_blk;
+        if (!zone_writable(zone_id) || (worker->wrapped && zone_in_use(worker, zone_id))) {
+            continue;
+        }
+        if (g_reclaim_qd && zone_entry(zone_id)->state != SPDK_BDEV_ZONE_STATE_EMPTY) {
+            reclaim_enqueue(worker, zone_id);
+            continue;
+        }
+        break;
+    }
+
+    slot->zone_id = zone_id;
+    slot->capacity = zone_entry(zone_id)->capacity;
+    if (g_append_log) {
+        g_append_logs[zone_id / g_zone_sz_blk].count = 0;
+    }
+    slot->outstanding = 0;
+    slot->state = zone_entry(zone_id)->state == SPDK_BDEV_ZONE_STATE_EMPTY ?
+                  SLOT_WRITING : SLOT_NEED_RESET;
+    /* a zone waiting for its reset looks full so no I/O picks it */
+    slot->blocks_submitted = slot->state == SLOT_NEED_RESET ? slot->capacity : 0;
+    if (!g_run_time_sec && !g_fill) {
+        worker->blocks_total += slot->capacity;
+    }
+}
+
+static struct zone_slot_t *
+append_pick_zone(struct worker_t *worker)
+{
+    struct zone_slot_t *slot, *best = NULL;
+    uint32_t i;
+
+    for (i = 0; i < worker->num_slots; i++) {
+        if (g_zone_policy == ZONE_POLICY_RR) {
+            slot = &worker->slots[(worker->slot_next + i) % worker->num_slots];
+            if (slot->blocks_submitted < slot->capacity) {
+                worker->slot_next = (slot - worker->slots + 1) % worker->num_slots;
+                return slot;
+            }
+        } else {
+            slot = &worker->slots[i];
+            if (slot->blocks_submitted < slot->capacity &&
+                (!best || slot->outstanding < best->outstanding)) {
+                best = slot;
+            }
+        }
+    }
+    return best;
+}
+
+/* Give the append a sequence number in its zone's log, landed offset unknown yet */
+static int
+append_log_record(struct io_task_t *task)
+{
+    struct zone_slot_t *slot = task->slot;
+    struct append_log_t *log = &g_append_logs[slot->zone_id / g_zone_sz_blk];
+
+    if (!log->recs) {
+        /* a zone never takes more appends than its logical writes have pieces */
+        log->recs = calloc(SPDK_CEIL_DIV(slot->capacity, g_io_blk) *
+                           SPDK_CEIL_DIV(g_io_blk, g_append_blk), sizeof(struct append_rec_t));
+        if (!log->recs) {
+            SPDK_ERRLOG("Failed to allocate append log\n");
+            return -ENOMEM;
+        }
+    }
+    task->append_seq = log->count++;
+    log->recs[task->append_seq].expected = slot->blocks_submitted;
+    log->recs[task->append_seq].landed = UINT32_MAX;
+    return 0;
+}
+
+/* Store where the append landed; false if the device put it outside the zone */
+static bool
+append_log_complete(struct io_task_t *task, uint64_t location)
+{
+    struct worker_t *worker = task->worker;
+    struct zone_slot_t *slot = task->slot;
+    struct append_rec_t *rec = &g_append_logs[slot->zone_id / g_zone_sz_blk].recs[task->append_seq];
+    uint64_t displacement;
+
+    if (location < slot->zone_id || location + task->num_blocks > slot->zone_id + slot->capacity) {
+        SPDK_ERRLOG("append to zone 0x%lx landed at 0x%lx, outside the zone\n",
+                    slot->zone_id, location);
+        return false;
+    }
+    rec->landed = location - slot->zone_id;
+    if (rec->landed != rec->expected) {
+        worker->appends_reordered++;
+        displacement = rec->landed > rec->expected ? rec->landed - rec->expected :
+                       rec->expected - rec->landed;
+        worker->max_displacement = spdk_max(worker->max_displacement, displacement);
+    }
+    return true;
+}
+
+static bool
+append_zone_next(struct io_task_t *task)
+{
+    struct worker_t *worker = task->worker;
+    struct zone_slot_t *slot;
+
+    /* All appends of one logical write go to the same zone */
+    if (worker->lw_blocks_left == 0) {
+        slot = append_pick_zone(worker);
+        if (!slot) {
+            return false;
+        }
+        worker->lw_slot = slot;
+        worker->lw_blocks_left = spdk_min(g_io_blk, slot->capacity - slot->blocks_submitted);
+    }
+    slot = worker->lw_slot;
+
+    task->op = IO_OP_APPEND;
+    task->slot = slot;
+    task->zone_id = slot->zone_id;
+    task->num_blocks = spdk_min(g_append_blk, worker->lw_blocks_left);
+    if (g_append_log && append_log_record(task) != 0) {
+        worker_io_failed(worker, -ENOMEM);
+        return false;
+    }
+    worker->lw_blocks_left -= task->num_blocks;
+    slot->blocks_submitted += task->num_blocks;
+    slot->outstanding++;
+    worker->io_outstanding++;
+
+    append_zone_submit(task);
+    return true;
+}
+
+/* Regular writes must land exactly on the write pointer, so only a zone with
+ * no write in flight can take the next one.
+ */
+static bool
+write_zone_next(struct io_task_t *task)
+{
+    struct worker_t *worker = task->worker;
+    struct zone_slot_t *slot;
+    uint32_t i;
+
+    for (i = 0; i < worker->num_slots; i++) {
+        slot = &worker->slots[(worker->slot_next + i) % worker->num_slots];
+        if (slot->outstanding == 0 && slot->blocks_submitted < slot->capacity) {
+            worker->slot_next = (slot - worker->slots + 1) % worker->num_slots;
+
+            task->op = IO_OP_WRITE;
+            task->slot = slot;
+            task->zone_id = slot->zone_id + slot->blocks_submitted;
+            task->num_blocks = spdk_min(g_io_blk, slot->capacity - slot->blocks_submitted);
+            slot->blocks_submitted += task->num_blocks;
+            slot->outstanding++;
+            worker->io_outstanding++;
+
+            write_zone_submit(task);
+            return true;
+        }
+    }
+    /* Every zone is busy or full, this context idles until the run ends */
+    return false;
+}
+
+static bool
+fill_zone_next(struct io_task_t *task)
+{
+    struct worker_t *worker = task->worker;
+    struct zone_slot_t *slot;
+
+    if (worker->rc || worker->stop_run) {
+        return false;
+    }
+
+    /* Pending resets and finishes go out before any new data is queued */
+    for (uint32_t i = 0; i < worker->num_slots; i++) {
+        slot = &worker->slots[i];
+        if ((slot->state == SLOT_NEED_RESET || slot->state == SLOT_NEED_FINISH) &&
+            slot->outstanding == 0) {
+            task->op = slot->state == SLOT_NEED_RESET ? IO_OP_RESET : IO_OP_FINISH;
+            task->slot = slot;
+            task->zone_id = slot->zone_id;
+            task->num_blocks = 0;
+            slot->outstanding++;
+            worker->io_outstanding++;
+            slot_mgmt_submit(task);
+            return true;
+        }
+    }
+
+    if (worker->run_op == IO_OP_WRITE) {
+        return write_zone_next(task);
+    }
+    return append_zone_next(task);
+}
+
+/* Park task until fill_zone_kick() finds it some work */
+static void
+fill_zone_next_or_idle(struct io_task_t *task)
+{
+    struct worker_t *worker = task->worker;
+
+    if (!fill_zone_next(task) && !worker->rc && !worker->stop_run) {
+        worker->idle_tasks[worker->num_idle++] = task;
+    }
+}
+
+static void
+fill_zone_kick(struct worker_t *worker)
+{
+    struct io_task_t *task;
+
+    while (worker->num_idle) {
+        task = worker->idle_tasks[worker->num_idle - 1];
+        if (!fill_zone_next(task)) {
+            break;
+        }
+        worker->num_idle--;
+    }
+}
+
+/* -r: give slots that wait for a reset zone one from the ready ring */
+static int
+worker_ready_poll(void *arg)
+{
+    struct worker_t *worker = arg;
+    struct zone_slot_t *slot;
+    uint32_t i;
+
+    if (worker->slots_waiting == 0 || worker->rc || worker->stop_run ||
+        (spdk_ring_count(worker->ready_ring) == 0 && worker->reclaim_pending)) {
+        return SPDK_POLLER_IDLE;
+    }
+    for (i = 0; i < worker->num_slots; i++) {
+        slot = &worker->slots[i];
+        if (slot->state == SLOT_WAITING) {
+            worker->slots_waiting--;
+            slot_assign(worker, slot);
+        }
+    }
+    fill_zone_kick(worker);
+    /* the last waiting slots may have retired with everything else written */
+    if (!g_run_time_sec && !g_fill &&
+        worker->blocks_completed == worker->blocks_total && worker->slots_waiting == 0) {
+        fill_zone_done(worker);
+    }
+    return SPDK_POLLER_BUSY;
+}
+
+static void
+fill_progress_msg(void *arg)
+{
+    uint32_t step = (uintptr_t)arg;
+    double sec = (double)(g_fill_step_tick[step] - g_fill_start_tick) / spdk_get_ticks_hz();
+
+    printf("[fill] %3u%% after %.1f s, %.2f MiB/s so far\n", step * 100 / FILL_STEPS, sec,
+           (double)g_fill_blocks_total * step / FILL_STEPS * g_block_size / sec / (1024 * 1024));
+}
+
+/* Add this worker's progress to the shared counter; whoever crosses a 5% mark timestamps it */
+static void
+fill_progress_flush(struct worker_t *worker)
+{
+    uint64_t old, new;
+    uint32_t step;
+
+    if (worker->fill_unflushed == 0) {
+        return;
+    }
+    old = __atomic_fetch_add(&g_fill_blocks_done, worker->fill_unflushed, __ATOMIC_RELAXED);
+    new = old + worker->fill_unflushed;
+    worker->fill_unflushed = 0;
+
+    for (step = old * FILL_STEPS / g_fill_blocks_total + 1;
+         step <= new * FILL_STEPS / g_fill_blocks_total; step++) {
+        g_fill_step_tick[step] = spdk_get_ticks();
+        spdk_thread_send_msg(g_app_thread, fill_progress_msg, (void *)(uintptr_t)step);
+    }
+}
+
+/* -r: zones written by this run are reset in the background for the next one */
+static void
+worker_release_zones(struct worker_t *worker)
+{
+    struct zone_slot_t *slot;
+
+    for (uint32_t i = 0; i < worker->num_slots; i++) {
+        slot = &worker->slots[i];
+        if ((slot->state == SLOT_WRITING || slot->state == SLOT_NEED_FINISH) &&
+            zone_entry(slot->zone_id)->state != SPDK_BDEV_ZONE_STATE_EMPTY) {
+            reclaim_enqueue(worker, slot->zone_id);
+        }
+    }
+}
+
+static void
+fill_zone_done(struct worker_t *worker)
+{
+    if (g_fill) {
+        fill_progress_flush(worker);
+    }
+    /* with -V or -C the zones are released once they have been read back */
+    if (g_reclaim_qd && !g_readback) {
+        worker_release_zones(worker);
+    }
+    worker->end_tick = spdk_get_ticks();
+    worker->total_blocks += worker->blocks_completed;
+    worker->total_io += worker->io_completed;
+    worker->total_ticks += worker->end_tick - worker->start_tick;
+    if (g_readback) {
+        /* the last zones may still be read back, that ends the phase */
+        worker->writes_done = true;
+        if (worker->io_outstanding == 0) {
+            verify_zone_finish(worker);
+        }
+        return;
+    }
+    worker_phase_done(worker);
+}
+
+static void
+fill_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct io_task_t *task = cb_arg;
+    struct worker_t *worker = task->worker;
+
+    struct zone_slot_t *slot = task->slot;
+
+    if (success && g_append_log && task->op == IO_OP_APPEND) {
+        success = append_log_complete(task, spdk_bdev_io_get_append_location(bdev_io));
+    }
+    spdk_bdev_free_io(bdev_io);
+    task_buf_put(task);
+    worker->io_outstanding--;
+    slot->outstanding--;
+
+    if (success) {
+        latency_record(task);
+        zone_entry_update(slot->zone_id, task->op, task->num_blocks);
+        if (task->op == IO_OP_RESET) {
+            slot->state = SLOT_WRITING;
+            slot->blocks_submitted = 0;
+        } else if (task->op == IO_OP_FINISH) {
+            worker->zones_finished++;
+            slot_assign(worker, slot);
+        } else {
+            worker->io_completed++;
+            worker->blocks_completed += task->num_blocks;
+            worker->iv_io++;
+            worker->iv_blocks += task->num_blocks;
+            if (g_fill) {
+                worker->fill_unflushed += task->num_blocks;
+                if (worker->fill_unflushed >= g_fill_flush_blk) {
+                    fill_progress_flush(worker);
+                }
+            }
+            if (g_readback && slot->state == SLOT_WRITING &&
+                slot->blocks_submitted == slot->capacity && slot->outstanding == 0) {
+                /* zone written: read it back while the run goes on */
+                worker->vf_zones[worker->vf_num_zones++] = slot->zone_id;
+                verify_kick(worker);
+            }
+        }
+    } else {
+        SPDK_ERRLOG("bdev io %s error: %d\n", g_op_name[task->op], EIO);
+        worker_io_failed(worker, -EIO);
+        return;
+    }
+
+    if (worker->rc) {
+        /* Stop refilling and wait for the in-flight I/O to drain */
+        worker_io_failed(worker, worker->rc);
+        return;
+    }
+
+    if (g_run_time_sec) {
+        if (worker->stop_run) {
+            if (worker->io_outstanding == 0) {
+                fill_zone_done(worker);
+            }
+            return;
+        }
+        /* A time-based run never runs out of zones: swap a full one for the next */
+        if (slot->state == SLOT_WRITING && slot->blocks_submitted == slot->capacity &&
+            slot->outstanding == 0) {
+            if (worker->lw_slot == slot) {
+                worker->lw_blocks_left = 0;
+            }
+            if (g_reclaim_qd) {
+                reclaim_enqueue(worker, slot->zone_id);
+            }
+            slot_assign(worker, slot);
+        }
+    } else if (g_fill) {
+        if (worker->zones_finished == worker->zones_to_fill) {
+            fill_zone_done(worker);
+            return;
+        }
+        /* Zone written: finish it explicitly so its active resource is released */
+        if (slot->state == SLOT_WRITING && slot->blocks_submitted == slot->capacity &&
+            slot->outstanding == 0) {
+            slot->state = SLOT_NEED_FINISH;
+        }
+    } else if (worker->blocks_completed == worker->blocks_total && worker->slots_waiting == 0) {
+        fill_zone_done(worker);
+        return;
+    }
+
+    /* Keep the queue full: reuse this context for the next I/O */
+    fill_zone_next_or_idle(task);
+    fill_zone_kick(worker);
+}
+
+static void
+fill_zone_submit_failed(struct io_task_t *task, int rc)
+{
+    struct worker_t *worker = task->worker;
+
+    SPDK_ERRLOG("%s error while submitting %s: %d\n", spdk_strerror(-rc),
+                g_op_name[task->op], rc);
+    task_buf_put(task);
+    worker->io_outstanding--;
+    task->slot->outstanding--;
+    worker_io_failed(worker, rc);
+}
+
+static void
+append_zone_submit(void *arg)
+{
+    struct io_task_t *task = arg;
+    struct worker_t *worker = task->worker;
+    int rc = 0;
+
+    task_buf_get(task);
+    task->submit_tick = spdk_get_ticks();
+    rc = spdk_bdev_zone_append(worker->req_context->bdev_desc, worker->bdev_io_channel,
+                        task->buf, task->zone_id, task->num_blocks,
+                        fill_zone_complete, task);
+    if (rc == -ENOMEM) {
+        /* bdev_io pool exhausted, retry this append once one is returned */
+        queue_task_io_wait(task, append_zone_submit);
+    } else if (rc) {
+        fill_zone_submit_failed(task, rc);
+    }
+}
+
+static void
+write_zone_submit(void *arg)
+{
+    struct io_task_t *task = arg;
+    struct worker_t *worker = task->worker;
+    int rc = 0;
+
+    task_buf_get(task);
+    task->submit_tick = spdk_get_ticks();
+    rc = spdk_bdev_write_blocks(worker->req_context->bdev_desc, worker->bdev_io_channel,
+                        task->buf, task->zone_id, task->num_blocks,
+                        fill_zone_complete, task);
+    if (rc == -ENOMEM) {
+        queue_task_io_wait(task, write_zone_submit);
+    } else if (rc) {
+        fill_zone_submit_failed(task, rc);
+    }
+}
+
+/* Reset or finish the zone of task->slot */
+static void
+slot_mgmt_submit(void *arg)
+{
+    struct io_task_t *task = arg;
+    struct worker_t *worker = task->worker;
+    int rc = 0;
+
+    task->submit_tick = spdk_get_ticks();
+    rc = spdk_bdev_zone_management(worker->req_context->bdev_desc, worker->bdev_io_channel,
+                        task->zone_id,
+                        task->op == IO_OP_RESET ? SPDK_BDEV_ZONE_RESET : SPDK_BDEV_ZONE_FINISH,
+                        fill_zone_complete, task);
+    if (rc == -ENOMEM) {
+        queue_task_io_wait(task, slot_mgmt_submit);
+    } else if (rc) {
+        fill_zone_submit_failed(task, rc);
+    }
+}
+
+/* Fill num_slots zones of this worker starting at zone_base with run_op */
+static void
+fill_zone(void *arg)
+{
+    struct worker_t *worker = arg;
+    uint32_t i;
+
+    worker->run_op = worker->req_context->run_op;
+    worker->num_slots = worker->req_context->num_slots;
+    if (!worker->slots) {
+        worker->slots = calloc(g_open_zones, sizeof(struct zone_slot_t));
+        if (g_readback) {
+            worker->vf_zones = calloc(worker->zone_count, sizeof(uint64_t));
+        }
+        if (!worker->slots || (g_readback && !worker->vf_zones)) {
+            SPDK_ERRLOG("Failed to allocate zone slots\n");
+            worker_io_failed(worker, -ENOMEM);
+            return;
+        }
+    }
+    worker->vf_num_zones = 0;
+    worker->vf_zone_idx = 0;
+    worker->vf_offset = 0;
+    worker->vf_blocks = 0;
+    worker->vf_mismatches = 0;
+    worker->vf_start_tick = 0;
+    worker->vf_end_tick = 0;
+    worker->writes_done = false;
+    if (g_readback) {
+        for (i = 0; i < g_queue_depth; i++) {
+            worker->vf_idle_tasks[i] = &worker->vf_tasks[i];
+        }
+        worker->vf_num_idle = g_queue_depth;
+    }
+    worker->blocks_total = 0;
+    worker->slots_waiting = 0;
+    if (g_fill) {
+        worker->zones_to_fill = 0;
+        for (uint64_t zone = worker->zone_first; zone < worker->zone_first + worker->zone_count;
+             zone++) {
+            if (zone_writable(zone * g_zone_sz_blk)) {
+                worker->zones_to_fill++;
+                worker->blocks_total += g_zones[zone].capacity;
+            }
+        }
+        worker->zones_finished = 0;
+        worker->fill_unflushed = 0;
+    }
+    for (i = 0; i < worker->num_slots; i++) {
+        worker->slots[i].zone_id = UINT64_MAX;
+    }
+    for (i = 0; i < worker->num_slots; i++) {
+        slot_assign(worker, &worker->slots[i]);
+    }
+    worker->slot_next = 0;
+    worker->stop_run = false;
+    worker->iv_io = 0;
+    worker->iv_blocks = 0;
+
+    worker->num_idle = 0;
+    worker->appends_reordered = 0;
+    worker->max_displacement = 0;
+    worker->blocks_completed = 0;
+    worker->io_completed = 0;
+    worker->lw_blocks_left = 0;
+    worker->io_outstanding = 0;
+    worker->start_tick = spdk_get_ticks();
+    for (i = 0; i < g_queue_depth; i++) {
+        fill_zone_next_or_idle(&worker->tasks[i]);
+    }
+    /* every zone of this worker is offline or read-only */
+    if (worker->io_outstanding == 0 && worker->slots_waiting == 0) {
+        fill_zone_done(worker);
+    }
+}
+
+/* interval report start */
+static void
+_worker_collect_done(void *arg)
+{
+    struct worker_t *worker = arg;
+    struct request_context_t *req_context = worker->req_context;
+    struct op_latency_t *lat = &worker->iv_latency[!worker->iv_idx];
+    static const double pctl[] = {99};
+    uint64_t p99;
+    double sec, us_per_tick = 1000.0 * 1000.0 / spdk_get_ticks_hz();
+    uint64_t now;
+
+    /* the worker already switched to the other half, this one is ours */
+    latency_merge(&g_iv_latency, lat);
+    latency_reset(lat);
+    req_context->iv_io += worker->iv_io_snap;
+    req_context->iv_blocks += worker->iv_blocks_snap;
+
+    if (--req_context->iv_pending) {
+        return;
+    }
+
+    now = spdk_get_ticks();
+    sec = (double)(now - req_context->iv_last_tick) / spdk_get_ticks_hz();
+    latency_percentiles(&g_iv_latency, pctl, &p99, 1);
+    printf("[%6.1f s] %s: %.0f IOPS, %.2f MiB/s, avg %.1f us, p99 %.1f us\n",
+           (double)(now - req_context->run_start_tick) / spdk_get_ticks_hz(),
+           g_op_name[req_context->run_op], req_context->iv_io / sec,
+           (double)req_context->iv_blocks * g_block_size / sec / (1024 * 1024),
+           g_iv_latency.count ? (double)g_iv_latency.total_ticks / g_iv_latency.count * us_per_tick : 0,
+           g_iv_latency.count ? p99 * us_per_tick : 0);
+
+    req_context->iv_last_tick = now;
+    req_context->iv_io = 0;
+    req_context->iv_blocks = 0;
+    latency_reset(&g_iv_latency);
+}
+
+/* Hand the interval counters over to the app thread and start a new interval */
+static void
+worker_collect(void *arg)
+{
+    struct worker_t *worker = arg;
+
+    worker->iv_io_snap = worker->iv_io;
+    worker->iv_blocks_snap = worker->iv_blocks;
+    worker->iv_io = 0;
+    worker->iv_blocks = 0;
+    worker->iv_idx = !worker->iv_idx;
+    spdk_thread_send_msg(g_app_thread, _worker_collect_done, worker);
+}
+
+static int
+interval_poll(void *arg)
+{
+    struct request_context_t *req_context = arg;
+    struct worker_t *worker;
+
+    if (req_context->iv_pending) {
+        /* previous interval still being collected */
+        return SPDK_POLLER_IDLE;
+    }
+    req_context->iv_pending = req_context->num_workers;
+    TAILQ_FOREACH(worker, &req_context->workers, link) {
+        spdk_thread_send_msg(worker->thread, worker_collect, worker);
+    }
+    return SPDK_POLLER_BUSY;
+}
+
+static void
+worker_stop_run(void *arg)
+{
+    struct worker_t *worker = arg;
+
+    worker->stop_run = true;
+    if (worker->io_outstanding == 0) {
+        fill_zone_done(worker);
+    }
+}
+
+static int
+run_timeout_poll(void *arg)
+{
+    struct request_context_t *req_context = arg;
+    struct worker_t *worker;
+
+    spdk_poller_unregister(&req_context->timeout_poller);
+    spdk_poller_unregister(&req_context->interval_poller);
+    TAILQ_FOREACH(worker, &req_context->workers, link) {
+        spdk_thread_send_msg(worker->thread, worker_stop_run, worker);
+    }
+    return SPDK_POLLER_BUSY;
+}
+/* interval report end */
+
+static void append_run_done(void *arg);
+static void append_run_next(struct request_context_t *req_context);
+static void verify_done(void *arg);
+
+static void
+append_run_start(struct request_context_t *req_context, enum io_op op)
+{
+    req_context->run_op = op;
+    if (op == IO_OP_WRITE) {
+        printf("Write to %u zones on each of %u cores (queue depth %u, one write per zone, "
+               "%lu blocks per write)...\n", req_context->num_slots, req_context->num_workers,
+               g_queue_depth, g_io_blk);
+    } else {
+        printf("Append to %u zones on each of %u cores (queue depth %u, %lu/%lu blocks per write/append, %s)...\n",
+               req_context->num_slots, req_context->num_workers, g_queue_depth, g_io_blk, g_append_blk,
+               g_zone_policy == ZONE_POLICY_RR ? "round-robin" : "least-outstanding");
+    }
+    g_fill_start_tick = spdk_get_ticks();
+    workers_run_phase(req_context, fill_zone, append_run_done);
+
+    if (g_run_time_sec) {
+        req_context->run_start_tick = spdk_get_ticks();
+        req_context->iv_last_tick = req_context->run_start_tick;
+        req_context->interval_poller = SPDK_POLLER_REGISTER(interval_poll, req_context,
+                                       g_interval_sec * 1000 * 1000);
+        req_context->timeout_poller = SPDK_POLLER_REGISTER(run_timeout_poll, req_context,
+                                      g_run_time_sec * 1000 * 1000);
+    }
+}
+
+/* Runs on the app thread once every worker filled its zones */
+static void
+append_run_done(void *arg)
+{
+    struct request_context_t *req_context = arg;
+    struct run_result_t *result;
+    struct worker_t *worker;
+    uint64_t start = UINT64_MAX, end = 0, blocks = 0, ios = 0;
+    uint64_t reordered = 0, max_displacement = 0;
+    int mode = req_context->run_op == IO_OP_WRITE ? WRITE_MODE_WRITE : WRITE_MODE_APPEND;
+    double sec;
+
+    /* a run that failed early still has its time-based pollers registered */
+    spdk_poller_unregister(&req_context->timeout_poller);
+    spdk_poller_unregister(&req_context->interval_poller);
+
+    if (req_context->rc) {
+        workers_stop(req_context, req_context->rc);
+        return;
+    }
+
+    TAILQ_FOREACH(worker, &req_context->workers, link) {
+        start = spdk_min(start, worker->start_tick);
+        end = spdk_max(end, worker->end_tick);
+        blocks += worker->blocks_completed;
+        ios += worker->io_completed;
+        reordered += worker->appends_reordered;
+        max_displacement = spdk_max(max_displacement, worker->max_displacement);
+    }
+    sec = (double)(end - start) / spdk_get_ticks_hz();
+
+    if (g_fill) {
+        g_fill_step_tick[0] = g_fill_start_tick;
+        uint64_t zones = 0;
+
+        TAILQ_FOREACH(worker, &req_context->workers, link) {
+            zones += worker->zones_finished;
+        }
+        printf("[fill] %lu zones finished\n", zones);
+        printf("%8s %10s %14s\n", "filled", "sec", "MiB/s");
+        for (uint32_t i = 1; i <= FILL_STEPS; i++) {
+            double step_sec = (double)(g_fill_step_tick[i] - g_fill_step_tick[i - 1]) /
+                              spdk_get_ticks_hz();
+
+            printf("%7u%% %10.2f %14.2f\n", i * 100 / FILL_STEPS, step_sec,
+                   (double)g_fill_blocks_total / FILL_STEPS * g_block_size / step_sec /
+                   (1024 * 1024));
+        }
+    }
+
+    /* In both mode the write run reuses the result slot of its append run */
+    if (req_context->run_op == IO_OP_APPEND || g_write_mode != WRITE_MODE_BOTH) {
+        g_num_results++;
+    }
+    result = &g_results[g_num_results - 1];
+    result->num_zones = req_context->num_slots * req_context->num_workers;
+    result->iops[mode] = ios / sec;
+    result->mibps[mode] = (double)blocks * g_block_size / sec / (1024 * 1024);
+    printf("[%s] zones %u qd %u cores %u: %lu I/Os in %.3f s, %.0f IOPS, %.2f MiB/s\n",
+           g_op_name[req_context->run_op], result->num_zones, g_queue_depth,
+           req_context->num_workers, ios, sec, result->iops[mode], result->mibps[mode]);
+    if (g_append_log && req_context->run_op == IO_OP_APPEND) {
+        printf("[append log] %lu of %lu appends (%.2f%%) landed out of submit order, "
+               "max displacement %lu blocks\n", reordered, ios,
+               ios ? (double)reordered * 100 / ios : 0.0, max_displacement);
+    }
+
+    if (g_readback) {
+        /* every zone was read back during the run, before the next run reuses it */
+        verify_done(req_context);
+        return;
+    }
+    append_run_next(req_context);
+}
+
+/* Chain the next run of a sweep or both mode, or wrap up */
+static void
+append_run_next(struct request_context_t *req_context)
+{
+    if (req_context->run_op == IO_OP_APPEND && g_write_mode == WRITE_MODE_BOTH) {
+        /* same workload again with regular writes, on fresh zones */
+        append_run_start(req_context, IO_OP_WRITE);
+        return;
+    }
+
+    if (g_sweep && req_context->num_slots < g_open_zones) {
+        /* next sweep step: double the zone count, capped at -z */
+        req_context->num_slots = spdk_min(req_context->num_slots * 2, g_open_zones);
+        append_run_start(req_context, g_write_mode == WRITE_MODE_WRITE ? IO_OP_WRITE : IO_OP_APPEND);
+        return;
+    }
+
+    if (g_sweep || g_write_mode == WRITE_MODE_BOTH) {
+        printf("[summary] qd %u cores %u\n", g_queue_depth, req_context->num_workers);
+        printf("%8s %14s %14s %14s %14s\n", "zones", "append IOPS", "append MiB/s",
+               "write IOPS", "write MiB/s");
+        for (uint32_t i = 0; i < g_num_results; i++) {
+            printf("%8u %14.0f %14.2f %14.0f %14.2f\n", g_results[i].num_zones,
+                   g_results[i].iops[WRITE_MODE_APPEND], g_results[i].mibps[WRITE_MODE_APPEND],
+                   g_results[i].iops[WRITE_MODE_WRITE], g_results[i].mibps[WRITE_MODE_WRITE]);
+        }
+    }
+    workers_stop(req_context, 0);
+}
+
+/* Check -z against the device limits and the zones a sweep consumes per worker */
+static int
+append_zone_setup(struct request_context_t *req_context)
+{
+    uint64_t zones_needed = 0;
+    uint64_t zones_per_worker = g_num_zone / req_context->num_workers;
+    uint32_t max_per_worker;
+    uint32_t max_zones;
+    uint32_t n;
+
+    /* as many zones as the device keeps open and active at once, split over the cores */
+    max_zones = g_max_open_zone;
+    if (g_max_active_zone && (!max_zones || g_max_active_zone < max_zones)) {
+        max_zones = g_max_active_zone;
+    }
+    if (max_zones && req_context->num_workers > max_zones) {
+        SPDK_ERRLOG("%u cores need a zone each, the device keeps only %u zones open and active\n",
+                    req_context->num_workers, max_zones);
+        return -EINVAL;
+    }
+    max_per_worker = max_zones ? max_zones / req_context->num_workers : 0;
+
+    if (g_fill) {
+        if (!g_open_zones) {
+            g_open_zones = max_per_worker ? max_per_worker : 1;
+        } else if (max_per_worker && g_open_zones > max_per_worker) {
+            printf("-z %u exceeds max active zones over %u cores, using %u zones per core\n",
+                   g_open_zones, req_context->num_workers, max_per_worker);
+            g_open_zones = max_per_worker;
+        }
+        g_open_zones = spdk_min(g_open_zones, zones_per_worker);
+        if (!g_open_zones) {
+            SPDK_ERRLOG("Fewer zones than cores\n");
+            return -EINVAL;
+        }
+
+        g_fill_blocks_total = 0;
+        for (uint64_t zone = 0; zone < zones_per_worker * req_context->num_workers; zone++) {
+            if (zone_writable(zone * g_zone_sz_blk)) {
+                g_fill_blocks_total += g_zones[zone].capacity;
+            }
+        }
+        /* flush progress ~100 times per 5% step, not on every completion */
+        g_fill_flush_blk = spdk_max(g_fill_blocks_total / FILL_STEPS / 100 /
+                                    req_context->num_workers, 1);
+        g_fill_blocks_done = 0;
+        req_context->num_slots = g_open_zones;
+        printf("fill: %lu zones, %u open per core, %lu MiB\n",
+               zones_per_worker * req_context->num_workers, g_open_zones,
+               g_fill_blocks_total * g_block_size / (1024 * 1024));
+        return 0;
+    }
+    if (!g_open_zones) {
+        g_open_zones = 1;
+    }
+
+    if (max_per_worker && g_open_zones > max_per_worker) {
+        printf("-z %u exceeds max open/active zones over %u cores, using %u zones per core\n",
+               g_open_zones, req_context->num_workers, max_per_worker);
+        g_open_zones = max_per_worker;
+    }
+
+    for (n = g_sweep ? 1 : g_open_zones; ; n = spdk_min(n * 2, g_open_zones)) {
+        zones_needed += g_write_mode == WRITE_MODE_BOTH ? 2 * n : n;
+        if (n == g_open_zones) {
+            break;
+        }
+    }
+    if (g_run_time_sec) {
+        /* zones are recycled, each core only needs a spare for every open zone */
+        zones_needed = 2 * g_open_zones;
+    }
+    if (zones_needed > zones_per_worker) {
+        SPDK_ERRLOG("Run needs %lu zones per core but each core owns only %lu\n",
+                    zones_needed, zones_per_worker);
+        return -EINVAL;
+    }
+
+    req_context->num_slots = g_sweep ? 1 : g_open_zones;
+    return 0;
+}
+/* append zone end */
+
+/* verify start */
+static void verify_zone_submit(void *arg);
+
+/* Check one block read back from lba */
+static bool
+verify_block(const char *block, uint64_t lba)
+{
+    const struct verify_hdr_t *hdr = (const struct verify_hdr_t *)block;
+    uint64_t zone_id = lba / g_zone_sz_blk * g_zone_sz_blk;
+    struct append_log_t *log;
+
+    if (hdr->magic != VERIFY_MAGIC || hdr->zone_id != zone_id ||
+        hdr->crc != spdk_crc32c_update(block + sizeof(hdr->crc),
+                                       g_block_size - sizeof(hdr->crc), ~0u)) {
+        return false;
+    }
+    if (hdr->lba != UINT64_MAX) {
+        return hdr->lba == lba;
+    }
+    /* an append: its log record says where the device put it */
+    log = &g_append_logs[zone_id / g_zone_sz_blk];
+    return hdr->seq < log->count && log->recs[hdr->seq].landed + hdr->block == lba - zone_id;
+}
+
+static bool
+verify_zone_next(struct io_task_t *task)
+{
+    struct worker_t *worker = task->worker;
+    uint64_t zone_id, written;
+
+    while (!worker->rc && worker->vf_zone_idx < worker->vf_num_zones) {
+        zone_id = worker->vf_zones[worker->vf_zone_idx];
+        written = zone_entry(zone_id)->write_pointer - zone_id;
+        if (worker->vf_offset < written) {
+            task->op = IO_OP_READ;
+            task->zone_id = zone_id + worker->vf_offset;
+            task->num_blocks = spdk_min(g_io_blk, written - worker->vf_offset);
+            worker->vf_offset += task->num_blocks;
+            worker->io_outstanding++;
+            if (!worker->vf_start_tick) {
+                worker->vf_start_tick = spdk_get_ticks();
+            }
+            verify_zone_submit(task);
+            return true;
+        }
+        worker->vf_zone_idx++;
+        worker->vf_offset = 0;
+    }
+    return false;
+}
+
+/* Hand the zones written so far to the idle read contexts */
+static void
+verify_kick(struct worker_t *worker)
+{
+    while (worker->vf_num_idle) {
+        if (!verify_zone_next(worker->vf_idle_tasks[worker->vf_num_idle - 1])) {
+            break;
+        }
+        worker->vf_num_idle--;
+    }
+}
+
+/* The writes are done and every zone was read back, or the run failed and drained */
+static void
+verify_zone_finish(struct worker_t *worker)
+{
+    worker->vf_end_tick = spdk_get_ticks();
+    if (g_reclaim_qd) {
+        worker_release_zones(worker);
+    }
+    worker_phase_done(worker);
+}
+
+static void
+verify_check(struct worker_t *worker, const char *buf, uint64_t lba, uint64_t num_blocks)
+{
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        if (!verify_block(buf + i * g_block_size, lba + i)) {
+            if (worker->vf_mismatches++ < VERIFY_MAX_REPORT) {
+                SPDK_ERRLOG("verify mismatch at lba 0x%lx\n", lba + i);
+            }
+        }
+    }
+}
+
+/* A read is checked: hand back its buffer, the phase may end with it */
+static void
+verify_read_done(struct worker_t *worker, void *buf_elem)
+{
+    spdk_mempool_put(worker->buf_pool, buf_elem);
+    if (--worker->io_outstanding == 0 && (worker->writes_done || worker->rc)) {
+        verify_zone_finish(worker);
+    }
+}
+
+/* Check the reads the last batch of completions stashed, their slots are refilled already */
+static int
+verify_check_poll(void *arg)
+{
+    struct worker_t *worker = arg;
+    struct verify_check_t *check;
+    uint32_t num_checks = worker->vf_num_checks;
+
+    if (num_checks == 0) {
+        return SPDK_POLLER_IDLE;
+    }
+    worker->vf_num_checks = 0;
+    for (uint32_t i = 0; i < num_checks; i++) {
+        check = &worker->vf_checks[i];
+        verify_check(worker, check->buf, check->lba, check->num_blocks);
+        verify_read_done(worker, check->buf_elem);
+    }
+    return SPDK_POLLER_BUSY;
+}
 
 static void
-write_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+verify_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 {
-    struct request_context_t *req_context = cb_arg;
+    struct io_task_t *task = cb_arg;
+    struct worker_t *worker = task->worker;
+    struct verify_check_t *check;
+    void *buf_elem = task->buf_elem;
+    const char *buf = task->buf;
+    uint64_t lba = task->zone_id;
+    uint64_t num_blocks = task->num_blocks;
 
     spdk_bdev_free_io(bdev_io);
+    task->buf_elem = NULL;
+    task->buf = NULL;
 
     if (success) {
-        w_complete++;
+        latency_record(task);
+        worker->vf_blocks += num_blocks;
     } else {
-        SPDK_ERRLOG("bdev io write error: %d\n", EIO);
-        appstop_error(req_context);
-        return;
+        SPDK_ERRLOG("bdev io read error: %d\n", EIO);
+        if (!worker->rc) {
+            worker->rc = -EIO;
+        }
     }
 
-    if (w_complete == g_num_io) {
-        printf("Write bdev complete\n");
-        read_bdev(req_context);
+    /* Refill the queue slot before checking, so the CRC32C runs while the
+     * next read is in flight. This read stays outstanding until its buffer
+     * is checked, the phase cannot end under it.
+     */
+    if (!verify_zone_next(task) && !worker->rc) {
+        /* caught up with the writers, wait for the next zone to fill */
+        worker->vf_idle_tasks[worker->vf_num_idle++] = task;
+    }
+    if (!success || !g_verify) {
+        verify_read_done(worker, buf_elem);
+        return;
     }
+    if (worker->vf_num_checks < g_queue_depth) {
+        /* checked by verify_check_poll() once the whole batch of completions
+         * refilled its slots, not between two of them
+         */
+        check = &worker->vf_checks[worker->vf_num_checks++];
+        check->buf_elem = buf_elem;
+        check->buf = buf;
+        check->lba = lba;
+        check->num_blocks = num_blocks;
+        return;
+    }
+    verify_check(worker, buf, lba, num_blocks);
+    verify_read_done(worker, buf_elem);
 }
 
 static void
-write_bdev(void *arg)
+verify_zone_submit(void *arg)
 {
-    struct request_context_t *req_context = arg;
+    struct io_task_t *task = arg;
+    struct worker_t *worker = task->worker;
     int rc = 0;
 
-    printf("Writing to the bdev...\n");
-
-    g_num_io = g_num_blk;
-    uint64_t num_blocks = 1;
-    for (uint64_t i = 0, offset_blocks = 0; i < g_num_io; i++, offset_blocks++) {
-        rc = spdk_bdev_write_blocks(req_context->bdev_desc, req_context->bdev_io_channel,
-                                req_context->buff, offset_blocks, num_blocks, 
-                                write_complete, req_context);
-
-        if (rc == -ENOMEM) {
-            SPDK_NOTICELOG("Queueing io\n");
-            queue_io_wait_with_cb(req_context, write_bdev);
-        } else if (rc) {
-            SPDK_ERRLOG("%s error while writing to bdev: %d\n", spdk_strerror(-rc), rc);
-            appstop_error(req_context);
-        }
+    task_buf_get(task);
+    task->submit_tick = spdk_get_ticks();
+    rc = spdk_bdev_read_blocks(worker->req_context->bdev_desc, worker->bdev_io_channel,
+                               task->buf, task->zone_id, task->num_blocks,
+                               verify_zone_complete, task);
+    if (rc == -ENOMEM) {
+        queue_task_io_wait(task, verify_zone_submit);
+    } else if (rc) {
+        SPDK_ERRLOG("%s error while reading from bdev: %d\n", spdk_strerror(-rc), rc);
+        task_buf_put(task);
+        worker->io_outstanding--;
+        worker_io_failed(worker, rc);
     }
 }
- write end */
-
-/* read zone start 
-uint64_t rz_complete = 0;
 
 static void
-read_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+verify_done(void *arg)
 {
-    struct request_context_t *req_context = cb_arg;
+    struct request_context_t *req_context = arg;
+    struct worker_t *worker;
+    uint64_t start = UINT64_MAX, end = 0, blocks = 0, mismatches = 0;
+    double sec;
 
-    spdk_bdev_free_io(bdev_io);
+    if (req_context->rc) {
+        workers_stop(req_context, req_context->rc);
+        return;
+    }
 
-    if (success) {
-        rz_complete++;
-        //printf("%s", req_context->buff);
-    } else {
-        SPDK_ERRLOG("bdev io read error\n");
-        appstop_error(req_context);
+    TAILQ_FOREACH(worker, &req_context->workers, link) {
+        if (worker->vf_start_tick) {
+            start = spdk_min(start, worker->vf_start_tick);
+            end = spdk_max(end, worker->vf_end_tick);
+        }
+        blocks += worker->vf_blocks;
+        mismatches += worker->vf_mismatches;
     }
+    sec = start < end ? (double)(end - start) / spdk_get_ticks_hz() : 0;
+    printf("[%s] %lu blocks in %.3f s, %.2f MiB/s, %lu mismatches\n",
+           g_verify ? "verify" : "read back", blocks, sec,
+           sec ? (double)blocks * g_block_size / sec / (1024 * 1024) : 0.0, mismatches);
 
-    if (rz_complete == g_num_io) {
-        printf("Read bdev complete\n");
-        appstop_success(req_context);
+    if (mismatches) {
+        workers_stop(req_context, -EILSEQ);
+        return;
     }
+    append_run_next(req_context);
+}
+/* verify end */
 
+/* reset zone start */
+static void reset_zone_submit(void *arg);
+
+/* Zones the startup pass touches: every non-empty zone with -R, otherwise only
+ * the open and closed ones, which would hold active resources for the whole run
+ */
+static bool
+reset_zone_needed(uint64_t zone)
+{
+    switch (g_zones[zone].state) {
+    case SPDK_BDEV_ZONE_STATE_EMPTY:
+        return false;
+    case SPDK_BDEV_ZONE_STATE_IMP_OPEN:
+    case SPDK_BDEV_ZONE_STATE_EXP_OPEN:
+    case SPDK_BDEV_ZONE_STATE_CLOSED:
+        return true;
+    default:
+        return g_eager_reset;
+    }
 }
 
-static void
-read_zone(void *arg)
+/* The last worker also covers the zones left over by the even split */
+static uint64_t
+reset_zone_end(struct worker_t *worker)
 {
-    struct request_context_t *req_context = arg;
-    int rc = 0;
+    return TAILQ_NEXT(worker, link) ? worker->zone_first + worker->zone_count : g_num_zone;
+}
 
-    printf("Reading the bdev...\n");
-   
-    uint64_t num_blocks = 1;
-    uint64_t offset_blocks = 0;
-    for (uint32_t zone = 0; zone < 1; zone++) {
-        offset_blocks = zone * g_zone_sz_blk;
-        for (; offset_blocks < zone * g_zone_sz_blk + g_zone_capacity; offset_blocks++) {        
-            // Zero the buffer so that we can use it for reading 
-            memset(req_context->buff, 0, req_context->buff_size);
-            rc = spdk_bdev_read_blocks(req_context->bdev_desc, req_context->bdev_io_channel,
-                    req_context->buff, offset_blocks, num_blocks, 
-                    read_zone_complete, req_context);
-            if (rc == -ENOMEM) {
-                SPDK_NOTICELOG("Queueing io\n");
-                queue_io_wait_with_cb(req_context, read_zone);
-            } else if (rc) {
-                SPDK_ERRLOG("%s error while writing to bdev: %d\n", spdk_strerror(-rc), rc);
-                appstop_error(req_context);
-            }   
-        }
-    }  
+static bool
+reset_zone_next(struct io_task_t *task)
+{
+    struct worker_t *worker = task->worker;
+    uint64_t end = reset_zone_end(worker);
 
+    /* the zone table says which zones need no action */
+    while (worker->zone_next < end && !reset_zone_needed(worker->zone_next)) {
+        worker->zone_next++;
+    }
+    if (worker->rc || worker->zone_next == end) {
+        return false;
+    }
 
-    uint64_t num_blocks = 1;
-    for (uint64_t i = 0, offset_blocks = 0; i < g_num_io; i++, offset_blocks++) {
-        // Zero the buffer so that we can use it for reading 
-        memset(req_context->buff, 0, req_context->buff_size);
-        rc = spdk_bdev_read_blocks(req_context->bdev_desc, req_context->bdev_io_channel,
-                    req_context->buff, offset_blocks, num_blocks, 
-                    read_zone_complete, req_context);
+    /* lazy mode keeps the data, the zone is reset once a slot picks it */
+    task->op = g_eager_reset ? IO_OP_RESET : IO_OP_FINISH;
+    task->zone_id = worker->zone_next * g_zone_sz_blk;
+    worker->zone_next++;
+    worker->io_outstanding++;
 
-        if (rc == -ENOMEM) {
-            SPDK_NOTICELOG("Queueing io\n");
-            queue_io_wait_with_cb(req_context, read_zone);
-        } else if (rc) {
-            SPDK_ERRLOG("%s error while reading from bdev: %d\n", spdk_strerror(-rc), rc);
-            appstop_error(req_context);
-        }
-    }
-   
+    reset_zone_submit(task);
+    return true;
 }
- read zone end */
-
-/* append zone start */
-uint64_t az_complete = 0;
 
 static void
-append_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+reset_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 {
-    struct request_context_t *req_context = cb_arg;
+    struct io_task_t *task = cb_arg;
+    struct worker_t *worker = task->worker;
 
+    /* Complete the I/O */
     spdk_bdev_free_io(bdev_io);
-
+    worker->io_outstanding--;
+    
     if (success) {
-        az_complete++;
-    } else {
-        SPDK_ERRLOG("bdev io append error: %d\n", EIO);
-        appstop_error(req_context);
+        worker->io_completed++;
+        latency_record(task);
+        zone_entry_update(task->zone_id, task->op, 0);
+	} else {
+        SPDK_ERRLOG("bdev io %s zone error: %d\n", g_op_name[task->op], EIO);
+        worker_io_failed(worker, -EIO);
+        return;
+	}
+
+    if (worker->rc) {
+        worker_io_failed(worker, worker->rc);
         return;
     }
-/*
-    if (az_complete % g_zone_capacity == 0) {
-        g_tick = spdk_get_ticks();
-        printf("tick = %ld\n", g_tick);
-    }   
-*/  
-    if (az_complete == g_num_io) {
-        printf("Append bdev complete...\n");
-        //read_zone(req_context);
-        appstop_success(req_context);
+
+    if (!reset_zone_next(task) && worker->io_outstanding == 0) {
+        worker_phase_done(worker);
     }
 }
 
 static void
-append_zone(void *arg)
+reset_zone_submit(void *arg)
 {
-    struct request_context_t *req_context = arg;
+    struct io_task_t *task = arg;
+    struct worker_t *worker = task->worker;
     int rc = 0;
 
-    printf("Append to the bdev...\n");
-   
-    if (g_max_active_zone == 0) {
-        g_num_io = g_num_zone * g_zone_capacity;
-    } else {
-        g_num_io = 1 * g_zone_capacity;//g_max_open_zone * g_zone_capacity;
+    task->submit_tick = spdk_get_ticks();
+    rc = spdk_bdev_zone_management(worker->req_context->bdev_desc, worker->bdev_io_channel,
+                   task->zone_id,
+                   task->op == IO_OP_RESET ? SPDK_BDEV_ZONE_RESET : SPDK_BDEV_ZONE_FINISH,
+                   reset_zone_complete, task);
+
+    if (rc == -ENOMEM) {
+        SPDK_NOTICELOG("Queueing io\n");
+        queue_task_io_wait(task, reset_zone_submit);
+    } else if (rc) {
+        SPDK_ERRLOG("%s error while resetting zone: %d\n", spdk_strerror(-rc), rc);
+        worker->io_outstanding--;
+        worker_io_failed(worker, rc);
     }
+}
 
-    uint64_t zone_id = 0;
-    uint64_t num_blocks = 1;
-    uint64_t offset_blocks = 0;
-    for (uint32_t zone = 0; zone < 1; zone++) {
-        offset_blocks = zone * g_zone_sz_blk;
-        for (; offset_blocks < zone * g_zone_sz_blk + g_zone_capacity; offset_blocks++) {
-            zone_id =spdk_bdev_get_zone_id(req_context->bdev, offset_blocks);
-            rc = spdk_bdev_zone_append(req_context->bdev_desc, req_context->bdev_io_channel,
-                                req_context->buff, zone_id, num_blocks, 
-                                append_zone_complete, req_context);
-            if (rc == -ENOMEM) {
-                SPDK_NOTICELOG("Queueing io\n");
-                queue_io_wait_with_cb(req_context, append_zone);
-            } else if (rc) {
-                SPDK_ERRLOG("%s error while writing to bdev: %d\n", spdk_strerror(-rc), rc);
-                appstop_error(req_context);
-            }   
+/* -R: reset every non-empty zone of this worker, otherwise finish its open and
+ * closed zones, at most g_queue_depth in flight
+ */
+static void
+reset_zone(void *arg)
+{
+    struct worker_t *worker = arg;
+    uint32_t i;
+
+    worker->zone_next = worker->zone_first;
+    worker->io_completed = 0;
+    worker->io_outstanding = 0;
+    for (i = 0; i < g_queue_depth; i++) {
+        if (!reset_zone_next(&worker->tasks[i])) {
+            break;
         }
-    }  
-/*
-    for (uint64_t i = 0, offset_blocks = 0; i < g_num_io; i++, offset_blocks++) {
-        zone_id =spdk_bdev_get_zone_id(req_context->bdev, offset_blocks);
-        //printf("offset_blocks = 0x%lx, zone_id=0x%lx\n", offset_blocks, zone_id);
-        rc = spdk_bdev_zone_append(req_context->bdev_desc, req_context->bdev_io_channel,
-                                req_context->buff, zone_id, num_blocks, 
-                                append_complete, req_context);
-        if (rc == -ENOMEM) {
-            SPDK_NOTICELOG("Queueing io\n");
-            queue_io_wait_with_cb(req_context, append_zone);
-        } else if (rc) {
-            SPDK_ERRLOG("%s error while writing to bdev: %d\n", spdk_strerror(-rc), rc);
-            appstop_error(req_context);
-        }   
     }
-*/   
+    /* nothing to do: every zone of this worker is empty or inactive already */
+    if (worker->io_outstanding == 0) {
+        worker_phase_done(worker);
+    }
 }
-/* append zone end */
 
-/* reset zone start */
-uint64_t reset_complete = 0;
+/* Everything before the first I/O of the first run */
+static void
+startup_print(void)
+{
+    uint64_t hz = spdk_get_ticks_hz();
+    uint64_t now = spdk_get_ticks();
+
+    printf("[startup] %.1f ms to first write: zone report %.1f ms",
+           (double)(now - g_app_start_tick) * 1000 / hz,
+           (double)(g_zone_report_tick - g_app_start_tick) * 1000 / hz);
+    if (g_eager_reset) {
+        printf(", %lu zone resets %.1f ms\n", g_startup_resets,
+               (double)(g_reset_done_tick - g_zone_report_tick) * 1000 / hz);
+    } else {
+        printf(", %lu open/closed zones finished %.1f ms, zone resets deferred to first use\n",
+               g_startup_resets, (double)(g_reset_done_tick - g_zone_report_tick) * 1000 / hz);
+    }
+}
 
 static void
-reset_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+reset_zone_done(void *arg)
 {
-    struct request_context_t *req_context = cb_arg;
+    struct request_context_t *req_context = arg;
+    struct worker_t *worker;
 
-    /* Complete the I/O */
-    spdk_bdev_free_io(bdev_io);
-    
-    if (success) {
-		reset_complete++;
-	} else {
-        SPDK_ERRLOG("bdev io reset zone error: %d\n", EIO);
-        appstop_error(req_context);
+    if (req_context->rc) {
+        workers_stop(req_context, req_context->rc);
         return;
-	}
-
-    if (reset_complete == g_num_zone) {
+    }
+    g_reset_done_tick = spdk_get_ticks();
+    TAILQ_FOREACH(worker, &req_context->workers, link) {
+        g_startup_resets += worker->io_completed;
+    }
+    if (g_eager_reset) {
         printf("Reset all zone complete\n");
-        append_zone(req_context);
-    }    
+    }
+    startup_print();
+
+    if (append_zone_setup(req_context)) {
+        workers_stop(req_context, -EINVAL);
+        return;
+    }
+    append_run_start(req_context, g_write_mode == WRITE_MODE_WRITE ? IO_OP_WRITE : IO_OP_APPEND);
 }
+/* reset zone end */
 
 static void
-reset_zone(void *arg)
+workers_init_done(void *arg)
 {
     struct request_context_t *req_context = arg;
-    int rc = 0;
 
-    printf("Reset all zone...\n");
+    int rc;
 
-    for (uint64_t i = 0; i < g_num_zone; i++) {
-        rc = spdk_bdev_zone_management(req_context->bdev_desc, req_context->bdev_io_channel,
-                       i * g_zone_sz_blk, SPDK_BDEV_ZONE_RESET, 
-                       reset_zone_complete, req_context);
+    if (req_context->rc) {
+        workers_stop(req_context, req_context->rc);
+        return;
+    }
 
-        if (rc == -ENOMEM) {
-            SPDK_NOTICELOG("Queueing io\n");
-            queue_io_wait_with_cb(req_context, reset_zone);
-        } else if (rc) {
-            SPDK_ERRLOG("%s error while resetting zone: %d\n", spdk_strerror(-rc), rc);
-            appstop_error(req_context);
+    if (g_reclaim_qd && !req_context->reclaim) {
+        /* reclaim_init() comes back here once the thread is running */
+        rc = reclaim_start(req_context);
+        if (rc) {
+            SPDK_ERRLOG("Failed to start the reclaim thread\n");
+            workers_stop(req_context, rc);
+        }
+        return;
+    }
+
+    if (g_eager_reset) {
+        printf("Reset all zone...\n");
+    }
+    workers_run_phase(req_context, reset_zone, reset_zone_done);
+}
+
+/* One worker per core, the zones are split evenly between them */
+static void
+workers_start(struct request_context_t *req_context)
+{
+    struct worker_t *worker;
+    uint64_t zones_per_worker;
+    uint64_t zone = 0;
+    uint32_t core;
+
+    SPDK_ENV_FOREACH_CORE(core) {
+        if (worker_alloc(req_context, core)) {
+            SPDK_ERRLOG("Failed to allocate worker for core %u\n", core);
+            workers_stop(req_context, -ENOMEM);
+            return;
         }
     }
+
+    zones_per_worker = g_num_zone / req_context->num_workers;
+    TAILQ_FOREACH(worker, &req_context->workers, link) {
+        worker->zone_first = zone;
+        worker->zone_count = zones_per_worker;
+        worker->zone_base = zone;
+        zone += zones_per_worker;
+    }
+    printf("%u workers, %lu zones each\n", req_context->num_workers, zones_per_worker);
+
+    workers_run_phase(req_context, worker_init, workers_init_done);
 }
-/* reset zone end */
 
 /* get zone info start */
+static void get_zone_info_batch(void *arg);
+
 static void
 get_zone_info_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 {
     struct request_context_t *req_context = cb_arg;
+    struct spdk_bdev_zone_info *info;
+    struct zone_entry_t *zone;
+    uint64_t num_zones = spdk_min(ZONE_REPORT_BATCH, g_num_zone - req_context->zone_next);
+    uint64_t num_empty = 0, num_full = 0, num_offline = 0;
+    uint64_t min_capacity = UINT64_MAX;
 
     /* Complete the I/O */
     spdk_bdev_free_io(bdev_io);
-    
-    if (success) {
-        printf("Get zone info complete\n");
-
-        g_zone_capacity = zone_info.capacity;
-        g_num_zone = spdk_bdev_get_num_zones(req_context->bdev);
-        g_zone_sz_blk = spdk_bdev_get_zone_size(req_context->bdev);
-        g_max_open_zone = spdk_bdev_get_max_open_zones(req_context->bdev);
-        g_max_active_zone = spdk_bdev_get_max_active_zones(req_context->bdev);
-        g_max_append_blk = spdk_bdev_get_max_zone_append_size(req_context->bdev);
-        printf("[zone info]\n");
-        printf("num zone: %lu zones\n", g_num_zone);
-        printf("zone size: %lu blocks\n", g_zone_sz_blk);
-        printf("zone capacity: %lu blocks\n", g_zone_capacity);
-        printf("max open zone: %u zones\n", g_max_open_zone);
-        printf("max active zone: %u zones\n", g_max_active_zone);
-        printf("max append size: %u blocks\n", g_max_append_blk);
 
-    } else {
-        SPDK_ERRLOG("bdev io reset zone error: %d\n", EIO);
+    if (!success) {
+        SPDK_ERRLOG("bdev io get zone info error: %d\n", EIO);
         appstop_error(req_context);
         return;
-    } 
-    reset_zone(req_context); 
+    }
+
+    for (uint64_t i = 0; i < num_zones; i++) {
+        info = &g_zone_report[i];
+        zone = &g_zones[req_context->zone_next + i];
+        zone->write_pointer = info->write_pointer;
+        zone->capacity = info->capacity;
+        zone->state = info->state;
+    }
+    req_context->zone_next += num_zones;
+    if (req_context->zone_next < g_num_zone) {
+        get_zone_info_batch(req_context);
+        return;
+    }
+
+    free(g_zone_report);
+    g_zone_report = NULL;
+    g_zone_report_tick = spdk_get_ticks();
+    printf("Get zone info complete\n");
+
+    for (uint64_t i = 0; i < g_num_zone; i++) {
+        g_zone_capacity = spdk_max(g_zone_capacity, g_zones[i].capacity);
+        min_capacity = spdk_min(min_capacity, g_zones[i].capacity);
+        num_empty += g_zones[i].state == SPDK_BDEV_ZONE_STATE_EMPTY;
+        num_full += g_zones[i].state == SPDK_BDEV_ZONE_STATE_FULL;
+        num_offline += !zone_writable(i * g_zone_sz_blk);
+    }
+    printf("[zone info]\n");
+    printf("num zone: %lu zones (%lu empty, %lu full, %lu offline or read-only)\n",
+           g_num_zone, num_empty, num_full, num_offline);
+    printf("zone size: %lu blocks\n", g_zone_sz_blk);
+    if (min_capacity == g_zone_capacity) {
+        printf("zone capacity: %lu blocks\n", g_zone_capacity);
+    } else {
+        printf("zone capacity: %lu ~ %lu blocks\n", min_capacity, g_zone_capacity);
+    }
+    printf("max open zone: %u zones\n", g_max_open_zone);
+    printf("max active zone: %u zones\n", g_max_active_zone);
+    printf("max append size: %u blocks\n", g_max_append_blk);
+
+    workers_start(req_context);
 }
 
 static void
-get_zone_info(void *arg)
+get_zone_info_batch(void *arg)
 {
     struct request_context_t *req_context = arg;
     int rc = 0;
 
-    printf("Get zone info...\n");
-
-    /* get first zone to know zone capacity */
-    uint64_t zone_id = 0x4000;
-    size_t num_zones = 1;
     rc = spdk_bdev_get_zone_info(req_context->bdev_desc, req_context->bdev_io_channel,
-                                zone_id, num_zones, &zone_info,
-                                get_zone_info_complete, req_context);
-    
+                                req_context->zone_next * g_zone_sz_blk,
+                                spdk_min(ZONE_REPORT_BATCH, g_num_zone - req_context->zone_next),
+                                g_zone_report, get_zone_info_complete, req_context);
+
     if (rc == -ENOMEM) {
         SPDK_NOTICELOG("Queueing io\n");
-        queue_io_wait_with_cb(req_context, get_zone_info);
+        queue_io_wait_with_cb(req_context, get_zone_info_batch);
     } else if (rc) {
         SPDK_ERRLOG("%s error while get zone_info: %d\n", spdk_strerror(-rc), rc);
         appstop_error(req_context);
     }
 }
+
+/* Load the report of every zone into g_zones, ZONE_REPORT_BATCH zones at a time */
+static void
+get_zone_info(void *arg)
+{
+    struct request_context_t *req_context = arg;
+
+    printf("Get zone info...\n");
+
+    g_num_zone = spdk_bdev_get_num_zones(req_context->bdev);
+    g_zone_sz_blk = spdk_bdev_get_zone_size(req_context->bdev);
+    g_max_open_zone = spdk_bdev_get_max_open_zones(req_context->bdev);
+    g_max_active_zone = spdk_bdev_get_max_active_zones(req_context->bdev);
+    g_max_append_blk = spdk_bdev_get_max_zone_append_size(req_context->bdev);
+
+    g_zones = calloc(g_num_zone, sizeof(struct zone_entry_t));
+    g_zone_report = calloc(ZONE_REPORT_BATCH, sizeof(struct spdk_bdev_zone_info));
+    if (g_append_log) {
+        g_append_logs = calloc(g_num_zone, sizeof(struct append_log_t));
+    }
+    if (!g_zones || !g_zone_report || (g_append_log && !g_append_logs)) {
+        SPDK_ERRLOG("Failed to allocate zone table\n");
+        appstop_error(req_context);
+        return;
+    }
+    req_context->zone_next = 0;
+    get_zone_info_batch(req_context);
+}
 /* get zone info end */
 
 
@@ -458,6 +2917,9 @@ appstart(void *arg)
     int rc = 0;
     req_context->bdev = NULL;
     req_context->bdev_desc = NULL;
+    TAILQ_INIT(&req_context->workers);
+    g_app_thread = spdk_get_thread();
+    g_app_start_tick = spdk_get_ticks();
 
     SPDK_NOTICELOG("Successfully started the application\n");
 
@@ -488,20 +2950,44 @@ appstart(void *arg)
     g_num_blk = spdk_bdev_get_num_blocks(req_context->bdev);
     g_block_size = spdk_bdev_get_block_size(req_context->bdev);
 
-    /* Allocate memory for the write buffer.
-     * Initialize the write buffer with the string "Hello World!"
+    /* Size the appends: a logical write of -o bytes is split into appends of
+     * at most the max zone append size, both multiples of the write unit.
      */
-    uint32_t buf_align = spdk_bdev_get_buf_align(req_context->bdev);
-    req_context->buff_size = g_block_size * spdk_bdev_get_write_unit_size(req_context->bdev);
-    req_context->buff = spdk_zmalloc(req_context->buff_size, buf_align, NULL,
-                    SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
+    uint32_t write_unit = spdk_bdev_get_write_unit_size(req_context->bdev);
+    uint32_t max_append = spdk_bdev_get_max_zone_append_size(req_context->bdev);
+    if (g_io_size == 0) {
+        g_io_size = (uint64_t)g_block_size * write_unit;
+    }
+    if (g_io_size % ((uint64_t)g_block_size * write_unit)) {
+        SPDK_ERRLOG("io size %lu is not a multiple of the write unit (%u bytes)\n",
+                    g_io_size, g_block_size * write_unit);
+        appstop_error(req_context);
+        return;
+    }
+    g_io_blk = g_io_size / g_block_size;
+    g_append_blk = g_io_blk;
+    if (max_append && g_append_blk > max_append) {
+        g_append_blk = spdk_max(max_append / write_unit, 1) * write_unit;
+    }
 
-    if (!req_context->buff) {
-        SPDK_ERRLOG("Failed to allocate buffer\n");
+    /* Write buffers come from a per-worker mempool, see worker_alloc() */
+    g_buf_align = spdk_bdev_get_buf_align(req_context->bdev);
+    g_buf_size = g_block_size * g_io_blk;
+
+    for (int op = 0; op < IO_OP_COUNT; op++) {
+        g_latency[op].histogram = spdk_histogram_data_alloc();
+        if (!g_latency[op].histogram) {
+            SPDK_ERRLOG("Failed to allocate latency histogram\n");
+            appstop_error(req_context);
+            return;
+        }
+    }
+    g_iv_latency.histogram = spdk_histogram_data_alloc();
+    if (!g_iv_latency.histogram) {
+        SPDK_ERRLOG("Failed to allocate latency histogram\n");
         appstop_error(req_context);
         return;
     }
-    snprintf(req_context->buff, req_context->buff_size, "%s", "Hello World!\n");
 
     if (spdk_bdev_is_zoned(req_context->bdev)) {
         get_zone_info(req_context);
@@ -523,18 +3009,45 @@ main(int argc, char **argv)
     opts.name = "seqwrite";
 
     /* Parse built-in SPDK command line parameters to enable spdk trace*/
-    if ((rc = spdk_app_parse_args(argc, argv, &opts, "b:", NULL, parse_arg,
+    if ((rc = spdk_app_parse_args(argc, argv, &opts, "b:q:o:z:a:Sw:t:I:FRr:LVC", NULL, parse_arg,
                       usage)) != SPDK_APP_PARSE_ARGS_SUCCESS) {
         exit(rc);
     }
     req_context.bdev_name = g_bdev_name;
+    if (g_fill && (g_run_time_sec || g_sweep || g_write_mode == WRITE_MODE_BOTH)) {
+        fprintf(stderr, "-F cannot be combined with -t, -S or -w both\n");
+        usage();
+        exit(1);
+    }
+    if (g_readback && g_run_time_sec) {
+        fprintf(stderr, "-V and -C cannot be combined with -t, zones are reused during the run\n");
+        usage();
+        exit(1);
+    }
 
     rc = spdk_app_start(&opts, appstart, &req_context);
     if (rc) {
         SPDK_ERRLOG("ERROR starting application\n");
     }
 
-    spdk_free(req_context.buff);
+    latency_print();
+    for (int op = 0; op < IO_OP_COUNT; op++) {
+        if (g_latency[op].histogram) {
+            spdk_histogram_data_free(g_latency[op].histogram);
+        }
+    }
+    if (g_iv_latency.histogram) {
+        spdk_histogram_data_free(g_iv_latency.histogram);
+    }
+
+    free(g_zone_report);
+    free(g_zones);
+    if (g_append_logs) {
+        for (uint64_t i = 0; i < g_num_zone; i++) {
+            free(g_append_logs[i].recs);
+        }
+        free(g_append_logs);
+    }
     spdk_app_fini();
     return rc;
 }
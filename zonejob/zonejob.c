@@ -0,0 +1,1183 @@
+#include "spdk/stdinc.h"
+#include "spdk/thread.h"
+#include "spdk/bdev.h"
+#include "spdk/env.h"
+#include "spdk/event.h"
+#include "spdk/log.h"
+#include "spdk/string.h"
+#include "spdk/util.h"
+#include "spdk/cpuset.h"
+#include "spdk/histogram_data.h"
+#include "spdk/bdev_zone.h"
+#include "spdk/json.h"
+#include "spdk/file.h"
+
+/* zonejob runs the jobs of a JSON job file concurrently against a zoned bdev:
+ *
+ * {
+ *   "jobs": [
+ *     { "name": "ingest", "mix": { "append": 100 }, "zone_first": 0, "zone_count": 64,
+ *       "bs": 65536, "qd": 32, "open_zones": 4, "runtime": 10, "numjobs": 2 },
+ *     { "name": "gc", "mix": { "read": 80, "reset": 20 }, "zone_first": 64,
+ *       "zone_count": 32, "bs": 131072, "qd": 8, "rate_iops": 2000, "runtime": 10 }
+ *   ]
+ * }
+ *
+ * Every job clone (numjobs) runs on its own SPDK thread, round-robin over the
+ * reactor cores, and owns an equal slice of the job's zone range. Jobs with
+ * overlapping zone ranges track the shared zones separately and will trip
+ * over each other's writes and resets, so give writers disjoint ranges.
+ * Appends are capped at the device's max zone append size, a larger bs is
+ * written as several appends of at most that size.
+ */
+
+enum job_op {
+    JOB_OP_APPEND,      /* zone append to one of the job's open zones */
+    JOB_OP_WRITE,       /* regular write at a host-tracked write pointer */
+    JOB_OP_READ,        /* bs read at a random offset below a zone's write pointer */
+    JOB_OP_RESET,       /* reset a written zone that is not open for writing */
+    JOB_OP_FINISH,      /* finish a partially written open zone */
+    JOB_OP_COUNT,
+};
+static const char *g_op_name[JOB_OP_COUNT] = {
+    "append", "write", "read", "reset", "finish"
+};
+
+/* op weights of a job, in percent or any other unit */
+struct job_mix_t {
+    uint32_t weight[JOB_OP_COUNT];
+};
+
+/* one entry of "jobs" in the job file */
+struct job_spec_t {
+    char *name;
+    struct job_mix_t mix;
+    uint64_t zone_first;
+    uint64_t zone_count;
+    uint64_t bs;
+    uint32_t qd;
+    uint32_t open_zones;
+    uint64_t rate_iops;
+    uint64_t runtime;
+    uint32_t numjobs;
+};
+
+#define MAX_JOB_SPECS 32
+struct job_file_t {
+    struct job_spec_t specs[MAX_JOB_SPECS];
+    size_t num_specs;
+};
+
+/* a zone as one job clone sees it */
+struct job_zone_t {
+    uint64_t zone_id;
+    uint64_t capacity;
+    /* blocks completed and blocks handed out to appends / writes */
+    uint64_t written;
+    uint64_t submitted;
+    uint32_t outstanding;
+    /* regular writes in flight, appends stay off the zone until they land */
+    uint32_t writes;
+    bool active;        /* one of the job's open zones */
+    bool busy;          /* being reset or finished */
+};
+
+struct op_stats_t {
+    struct spdk_histogram_data *histogram;
+    uint64_t count;
+    uint64_t blocks;
+    uint64_t total_ticks;
+    uint64_t max_ticks;
+};
+
+struct job_t;
+struct request_context_t;
+
+/* per-I/O context, one per queue slot, each with its own bs buffer */
+struct job_task_t {
+    struct job_t *job;
+    enum job_op op;
+    struct job_zone_t *zone;
+    uint64_t lba;
+    uint64_t num_blocks;
+    uint64_t submit_tick;
+    void *buf;
+    struct spdk_bdev_io_wait_entry bdev_io_wait;
+};
+
+struct job_t {
+    struct request_context_t *req_context;
+    struct job_spec_t *spec;
+    uint32_t clone;
+    uint32_t core;
+    struct spdk_thread *thread;
+    struct spdk_io_channel *bdev_io_channel;
+    struct job_zone_t *zones;
+    uint64_t num_zones;
+    /* next zone to open, wraps around the job's slice */
+    uint64_t zone_cursor;
+    uint64_t reset_cursor;
+    uint32_t num_active;
+    uint32_t active_next;
+    uint64_t bs_blk;
+    uint32_t mix_total;
+    struct job_task_t *tasks;
+    void *buf;
+    /* contexts with nothing to issue, woken by completions and the rate poller */
+    struct job_task_t **idle_tasks;
+    uint32_t num_idle;
+    uint32_t outstanding;
+    uint64_t submitted_ios;
+    struct spdk_poller *stop_poller;
+    struct spdk_poller *rate_poller;
+    bool stop;
+    /* job_fini() ran, a submit failing inside a completion must not run it again */
+    bool finished;
+    int rc;
+    unsigned int seed;
+    uint64_t start_tick;
+    uint64_t end_tick;
+    struct op_stats_t stats[JOB_OP_COUNT];
+    TAILQ_ENTRY(job_t) link;
+};
+
+struct request_context_t {
+    char *bdev_name;
+    struct spdk_bdev *bdev;
+    struct spdk_bdev_desc *bdev_desc;
+    struct spdk_io_channel *bdev_io_channel;
+    struct spdk_bdev_io_wait_entry bdev_io_wait;
+    TAILQ_HEAD(, job_t) jobs;
+    uint32_t num_jobs;
+    uint32_t jobs_pending;
+    /* zone number of the next zone report batch */
+    uint64_t zone_next;
+    int rc;
+};
+
+/* info about bdev device */
+uint32_t g_block_size = 0;
+uint32_t g_buf_align = 1;
+/* info about zone */
+uint64_t g_num_zone = 0;
+uint64_t g_zone_sz_blk = 0;
+/* max zone append size in blocks, a multiple of the write unit, 0 no limit */
+uint64_t g_append_blk = 0;
+/* zone report of the whole namespace, each job clone copies its slice */
+struct spdk_bdev_zone_info *g_zones = NULL;
+#define ZONE_REPORT_BATCH 1024
+
+static char *g_bdev_name = "Malloc0"; /* Default bdev name if without -b */
+static char *g_job_file = NULL;
+static struct job_file_t g_job_file_data;
+static struct spdk_thread *g_app_thread;
+
+static void
+usage(void)
+{
+    printf(" -b <bdev> name of the bdev to use\n");
+    printf(" -j <file> JSON job file, see the top of zonejob.c for the format\n");
+}
+
+static int
+parse_arg(int ch, char *arg)
+{
+    switch (ch) {
+    case 'b':
+        g_bdev_name = arg;
+        break;
+    case 'j':
+        g_job_file = arg;
+        break;
+    default:
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/* job file start */
+static const struct spdk_json_object_decoder job_mix_decoders[] = {
+    {"append", offsetof(struct job_mix_t, weight[JOB_OP_APPEND]), spdk_json_decode_uint32, true},
+    {"write", offsetof(struct job_mix_t, weight[JOB_OP_WRITE]), spdk_json_decode_uint32, true},
+    {"read", offsetof(struct job_mix_t, weight[JOB_OP_READ]), spdk_json_decode_uint32, true},
+    {"reset", offsetof(struct job_mix_t, weight[JOB_OP_RESET]), spdk_json_decode_uint32, true},
+    {"finish", offsetof(struct job_mix_t, weight[JOB_OP_FINISH]), spdk_json_decode_uint32, true},
+};
+
+static int
+decode_job_mix(const struct spdk_json_val *val, void *out)
+{
+    return spdk_json_decode_object(val, job_mix_decoders, SPDK_COUNTOF(job_mix_decoders), out);
+}
+
+static const struct spdk_json_object_decoder job_spec_decoders[] = {
+    {"name", offsetof(struct job_spec_t, name), spdk_json_decode_string, true},
+    {"mix", offsetof(struct job_spec_t, mix), decode_job_mix, false},
+    {"zone_first", offsetof(struct job_spec_t, zone_first), spdk_json_decode_uint64, true},
+    {"zone_count", offsetof(struct job_spec_t, zone_count), spdk_json_decode_uint64, true},
+    {"bs", offsetof(struct job_spec_t, bs), spdk_json_decode_uint64, true},
+    {"qd", offsetof(struct job_spec_t, qd), spdk_json_decode_uint32, true},
+    {"open_zones", offsetof(struct job_spec_t, open_zones), spdk_json_decode_uint32, true},
+    {"rate_iops", offsetof(struct job_spec_t, rate_iops), spdk_json_decode_uint64, true},
+    {"runtime", offsetof(struct job_spec_t, runtime), spdk_json_decode_uint64, true},
+    {"numjobs", offsetof(struct job_spec_t, numjobs), spdk_json_decode_uint32, true},
+};
+
+static int
+decode_job_spec(const struct spdk_json_val *val, void *out)
+{
+    struct job_spec_t *spec = out;
+
+    /* defaults for everything the job leaves out */
+    spec->bs = 4096;
+    spec->qd = 1;
+    spec->open_zones = 1;
+    spec->runtime = 10;
+    spec->numjobs = 1;
+    return spdk_json_decode_object(val, job_spec_decoders, SPDK_COUNTOF(job_spec_decoders), out);
+}
+
+static int
+decode_job_specs(const struct spdk_json_val *val, void *out)
+{
+    struct job_file_t *file = out;
+
+    return spdk_json_decode_array(val, decode_job_spec, file->specs, MAX_JOB_SPECS,
+                                  &file->num_specs, sizeof(struct job_spec_t));
+}
+
+static const struct spdk_json_object_decoder job_file_decoders[] = {
+    {"jobs", 0, decode_job_specs, false},
+};
+
+/* Parse and sanity check the job file, before the app starts */
+static int
+job_file_load(const char *path, struct job_file_t *file)
+{
+    struct spdk_json_val *values = NULL;
+    struct job_spec_t *spec;
+    void *json, *end;
+    ssize_t num_values;
+    size_t size;
+    FILE *f;
+    int rc = -EINVAL;
+
+    f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Could not open job file %s: %s\n", path, spdk_strerror(errno));
+        return -errno;
+    }
+    json = spdk_posix_file_load(f, &size);
+    fclose(f);
+    if (!json) {
+        fprintf(stderr, "Could not read job file %s\n", path);
+        return -EIO;
+    }
+
+    /* first pass counts the values, second one fills them in */
+    num_values = spdk_json_parse(json, size, NULL, 0, &end, SPDK_JSON_PARSE_FLAG_ALLOW_COMMENTS);
+    if (num_values < 0) {
+        fprintf(stderr, "Job file %s is not valid JSON\n", path);
+        goto out;
+    }
+    values = calloc(num_values, sizeof(*values));
+    if (!values) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    spdk_json_parse(json, size, values, num_values, &end, SPDK_JSON_PARSE_FLAG_ALLOW_COMMENTS);
+    if (spdk_json_decode_object(values, job_file_decoders, SPDK_COUNTOF(job_file_decoders), file)) {
+        fprintf(stderr, "Job file %s: failed to decode \"jobs\"\n", path);
+        goto out;
+    }
+
+    for (size_t i = 0; i < file->num_specs; i++) {
+        spec = &file->specs[i];
+        if (!spec->name) {
+            spec->name = spdk_sprintf_alloc("job%zu", i);
+        }
+        uint32_t total = 0;
+        for (int op = 0; op < JOB_OP_COUNT; op++) {
+            total += spec->mix.weight[op];
+        }
+        if (!spec->name || total == 0 || spec->qd == 0 || spec->numjobs == 0 ||
+            spec->open_zones == 0 || spec->runtime == 0 || spec->bs == 0) {
+            fprintf(stderr, "Job %s: mix, qd, numjobs, open_zones, runtime and bs must be "
+                    "non-zero\n", spec->name ? spec->name : "?");
+            goto out;
+        }
+    }
+    rc = 0;
+out:
+    free(values);
+    free(json);
+    return rc;
+}
+/* job file end */
+
+static void
+queue_io_wait_with_cb(struct request_context_t *req_context, spdk_bdev_io_wait_cb cb_fn)
+{
+    req_context->bdev_io_wait.bdev = req_context->bdev;
+    req_context->bdev_io_wait.cb_fn = cb_fn;
+    req_context->bdev_io_wait.cb_arg = req_context;
+    spdk_bdev_queue_io_wait(req_context->bdev, req_context->bdev_io_channel,
+                    &req_context->bdev_io_wait);
+}
+
+static void
+appstop_error(struct request_context_t *req_context)
+{
+    spdk_put_io_channel(req_context->bdev_io_channel);
+    spdk_bdev_close(req_context->bdev_desc);
+    spdk_app_stop(-1);
+}
+
+static void
+appstop_success(struct request_context_t *req_context)
+{
+    spdk_put_io_channel(req_context->bdev_io_channel);
+    spdk_bdev_close(req_context->bdev_desc);
+    spdk_app_stop(0);
+}
+
+/* stats start */
+struct stats_pctl_ctx {
+    double pctl;
+    uint64_t ticks;
+};
+
+static void
+stats_pctl_cb(void *ctx, uint64_t start, uint64_t end, uint64_t count,
+              uint64_t total, uint64_t so_far)
+{
+    struct stats_pctl_ctx *pctl_ctx = ctx;
+
+    if (pctl_ctx->ticks == UINT64_MAX && (double)so_far >= total * pctl_ctx->pctl / 100) {
+        pctl_ctx->ticks = end;
+    }
+}
+
+static void
+stats_record(struct job_task_t *task)
+{
+    struct op_stats_t *stats = &task->job->stats[task->op];
+    uint64_t ticks = spdk_get_ticks() - task->submit_tick;
+
+    spdk_histogram_data_tally(stats->histogram, ticks);
+    stats->count++;
+    stats->blocks += task->num_blocks;
+    stats->total_ticks += ticks;
+    stats->max_ticks = spdk_max(stats->max_ticks, ticks);
+}
+
+static void
+job_print(struct job_t *job)
+{
+    struct op_stats_t *stats;
+    struct stats_pctl_ctx ctx;
+    double hz = spdk_get_ticks_hz();
+    double sec = (double)(job->end_tick - job->start_tick) / hz;
+
+    printf("[%s.%u] core %u, zones #%lu ~ #%lu, %.3f s\n", job->spec->name, job->clone,
+           job->core, job->zones[0].zone_id / g_zone_sz_blk,
+           job->zones[job->num_zones - 1].zone_id / g_zone_sz_blk, sec);
+    for (int op = 0; op < JOB_OP_COUNT; op++) {
+        stats = &job->stats[op];
+        if (stats->count == 0) {
+            continue;
+        }
+        ctx.pctl = 99;
+        ctx.ticks = UINT64_MAX;
+        spdk_histogram_data_iterate(stats->histogram, stats_pctl_cb, &ctx);
+        if (ctx.ticks == UINT64_MAX) {
+            ctx.ticks = stats->max_ticks;
+        }
+        printf("  %-8s %10lu I/Os %10.0f IOPS %10.2f MiB/s  avg %8.1f us  p99 %8.1f us  max %8.1f us\n",
+               g_op_name[op], stats->count, stats->count / sec,
+               (double)stats->blocks * g_block_size / sec / (1024 * 1024),
+               (double)stats->total_ticks / stats->count * 1000 * 1000 / hz,
+               (double)ctx.ticks * 1000 * 1000 / hz,
+               (double)stats->max_ticks * 1000 * 1000 / hz);
+    }
+}
+/* stats end */
+
+/* job start */
+static void job_task_submit(void *arg);
+
+/*
+ * A write needs the zone idle so it goes out at the write pointer, an append
+ * must not take the LBA a pending write targets
+ */
+static struct job_zone_t *
+job_write_zone(struct job_t *job, bool need_idle)
+{
+    struct job_zone_t *zone;
+
+    for (uint64_t i = 0; i < job->num_zones; i++) {
+        zone = &job->zones[(job->active_next + i) % job->num_zones];
+        if (zone->active && !zone->busy && zone->submitted < zone->capacity &&
+            zone->writes == 0 && (!need_idle || zone->outstanding == 0)) {
+            job->active_next = (zone - job->zones + 1) % job->num_zones;
+            return zone;
+        }
+    }
+    return NULL;
+}
+
+/* Open the next zone of the slice; one that still holds data gets reset first */
+static bool
+job_open_zone(struct job_task_t *task)
+{
+    struct job_t *job = task->job;
+    struct job_zone_t *zone;
+
+    if (job->num_active == job->spec->open_zones) {
+        return false;
+    }
+    for (uint64_t i = 0; i < job->num_zones; i++) {
+        zone = &job->zones[job->zone_cursor];
+        job->zone_cursor = (job->zone_cursor + 1) % job->num_zones;
+        if (zone->active || zone->busy || zone->outstanding || zone->capacity == 0) {
+            continue;
+        }
+        zone->active = true;
+        job->num_active++;
+        if (zone->written == 0 && zone->submitted == 0) {
+            return false;
+        }
+        zone->busy = true;
+        task->op = JOB_OP_RESET;
+        task->zone = zone;
+        task->lba = zone->zone_id;
+        task->num_blocks = 0;
+        return true;
+    }
+    return false;
+}
+
+static bool
+job_prep_write(struct job_task_t *task, enum job_op op)
+{
+    struct job_t *job = task->job;
+    struct job_zone_t *zone;
+
+    zone = job_write_zone(job, op == JOB_OP_WRITE);
+    if (!zone) {
+        /* opening a zone may take a reset first, which then is this task's I/O */
+        if (job_open_zone(task)) {
+            return true;
+        }
+        zone = job_write_zone(job, op == JOB_OP_WRITE);
+        if (!zone) {
+            return false;
+        }
+    }
+    task->op = op;
+    task->zone = zone;
+    task->num_blocks = spdk_min(job->bs_blk, zone->capacity - zone->submitted);
+    if (op == JOB_OP_APPEND && g_append_blk) {
+        /* a bs above the max zone append size goes out as several appends */
+        task->num_blocks = spdk_min(task->num_blocks, g_append_blk);
+    }
+    task->lba = op == JOB_OP_WRITE ? zone->zone_id + zone->submitted : zone->zone_id;
+    zone->submitted += task->num_blocks;
+    if (op == JOB_OP_WRITE) {
+        zone->writes++;
+    }
+    return true;
+}
+
+static bool
+job_prep_read(struct job_task_t *task)
+{
+    struct job_t *job = task->job;
+    struct job_zone_t *zone;
+    uint64_t start = rand_r(&job->seed) % job->num_zones;
+    uint64_t chunks, chunk;
+
+    for (uint64_t i = 0; i < job->num_zones; i++) {
+        zone = &job->zones[(start + i) % job->num_zones];
+        if (zone->written == 0 || zone->busy) {
+            continue;
+        }
+        chunks = SPDK_CEIL_DIV(zone->written, job->bs_blk);
+        chunk = rand_r(&job->seed) % chunks;
+        task->op = JOB_OP_READ;
+        task->zone = zone;
+        task->lba = zone->zone_id + chunk * job->bs_blk;
+        task->num_blocks = spdk_min(job->bs_blk, zone->written - chunk * job->bs_blk);
+        return true;
+    }
+    return false;
+}
+
+static bool
+job_prep_reset(struct job_task_t *task)
+{
+    struct job_t *job = task->job;
+    struct job_zone_t *zone;
+
+    for (uint64_t i = 0; i < job->num_zones; i++) {
+        zone = &job->zones[job->reset_cursor];
+        job->reset_cursor = (job->reset_cursor + 1) % job->num_zones;
+        if (!zone->active && !zone->busy && zone->outstanding == 0 && zone->submitted) {
+            zone->busy = true;
+            task->op = JOB_OP_RESET;
+            task->zone = zone;
+            task->lba = zone->zone_id;
+            task->num_blocks = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+job_prep_finish(struct job_task_t *task)
+{
+    struct job_t *job = task->job;
+    struct job_zone_t *zone;
+
+    for (uint64_t i = 0; i < job->num_zones; i++) {
+        zone = &job->zones[i];
+        if (zone->active && !zone->busy && zone->outstanding == 0 && zone->submitted &&
+            zone->submitted < zone->capacity) {
+            zone->busy = true;
+            task->op = JOB_OP_FINISH;
+            task->zone = zone;
+            task->lba = zone->zone_id;
+            task->num_blocks = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+job_prep(struct job_task_t *task, enum job_op op)
+{
+    switch (op) {
+    case JOB_OP_APPEND:
+    case JOB_OP_WRITE:
+        return job_prep_write(task, op);
+    case JOB_OP_READ:
+        return job_prep_read(task);
+    case JOB_OP_RESET:
+        return job_prep_reset(task);
+    case JOB_OP_FINISH:
+        return job_prep_finish(task);
+    default:
+        return false;
+    }
+}
+
+/* Pick an op by the job's mix; if it can't go out now try the other ops of the mix */
+static bool
+job_task_next(struct job_task_t *task)
+{
+    struct job_t *job = task->job;
+    const uint32_t *weight = job->spec->mix.weight;
+    uint64_t allowed;
+    uint32_t pick;
+    int op;
+
+    if (job->stop || job->rc) {
+        return false;
+    }
+    if (job->spec->rate_iops) {
+        allowed = (spdk_get_ticks() - job->start_tick) * job->spec->rate_iops /
+                  spdk_get_ticks_hz();
+        if (job->submitted_ios >= allowed) {
+            return false;
+        }
+    }
+
+    pick = rand_r(&job->seed) % job->mix_total;
+    for (op = 0; pick >= weight[op]; op++) {
+        pick -= weight[op];
+    }
+    if (!job_prep(task, op)) {
+        for (op = 0; op < JOB_OP_COUNT; op++) {
+            if (weight[op] && job_prep(task, op)) {
+                break;
+            }
+        }
+        if (op == JOB_OP_COUNT) {
+            return false;
+        }
+    }
+
+    task->zone->outstanding++;
+    job->outstanding++;
+    job->submitted_ios++;
+    job_task_submit(task);
+    return true;
+}
+
+static void
+job_task_next_or_idle(struct job_task_t *task)
+{
+    struct job_t *job = task->job;
+
+    if (!job_task_next(task) && !job->stop && !job->rc) {
+        job->idle_tasks[job->num_idle++] = task;
+    }
+}
+
+static void
+job_kick(struct job_t *job)
+{
+    while (job->num_idle) {
+        if (!job_task_next(job->idle_tasks[job->num_idle - 1])) {
+            break;
+        }
+        job->num_idle--;
+    }
+}
+
+static void
+job_done(void *arg)
+{
+    struct job_t *job = arg;
+    struct request_context_t *req_context = job->req_context;
+
+    if (job->rc) {
+        SPDK_ERRLOG("job %s.%u failed: %s\n", job->spec->name, job->clone,
+                    spdk_strerror(-job->rc));
+        req_context->rc = job->rc;
+    }
+    if (--req_context->jobs_pending) {
+        return;
+    }
+
+    printf("[jobs]\n");
+    TAILQ_FOREACH(job, &req_context->jobs, link) {
+        if (!job->rc) {
+            job_print(job);
+        }
+    }
+    if (req_context->rc) {
+        appstop_error(req_context);
+    } else {
+        appstop_success(req_context);
+    }
+}
+
+/* Called on the job thread once the job is stopped and has nothing in flight */
+static void
+job_fini(struct job_t *job)
+{
+    if (job->finished) {
+        return;
+    }
+    job->finished = true;
+    job->end_tick = spdk_get_ticks();
+    spdk_poller_unregister(&job->stop_poller);
+    spdk_poller_unregister(&job->rate_poller);
+    if (job->bdev_io_channel) {
+        spdk_put_io_channel(job->bdev_io_channel);
+        job->bdev_io_channel = NULL;
+    }
+    spdk_thread_send_msg(g_app_thread, job_done, job);
+    spdk_thread_exit(job->thread);
+}
+
+static void
+job_task_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct job_task_t *task = cb_arg;
+    struct job_t *job = task->job;
+    struct job_zone_t *zone = task->zone;
+
+    if (bdev_io) {
+        spdk_bdev_free_io(bdev_io);
+    }
+    if (!success) {
+        SPDK_ERRLOG("job %s.%u: %s of zone #%lu failed\n", job->spec->name, job->clone,
+                    g_op_name[task->op], zone->zone_id / g_zone_sz_blk);
+        job->rc = -EIO;
+    } else {
+        stats_record(task);
+    }
+
+    switch (task->op) {
+    case JOB_OP_WRITE:
+        zone->writes--;
+        /* fall through */
+    case JOB_OP_APPEND:
+        zone->written += success ? task->num_blocks : 0;
+        if (zone->active && zone->written == zone->capacity) {
+            /* full zones hold no open resource, the job may open the next one */
+            zone->active = false;
+            job->num_active--;
+        }
+        break;
+    case JOB_OP_RESET:
+        zone->written = 0;
+        zone->submitted = 0;
+        zone->busy = false;
+        break;
+    case JOB_OP_FINISH:
+        zone->submitted = zone->capacity;
+        zone->active = false;
+        zone->busy = false;
+        job->num_active--;
+        break;
+    default:
+        break;
+    }
+    zone->outstanding--;
+    job->outstanding--;
+
+    job_task_next_or_idle(task);
+    job_kick(job);
+    if ((job->stop || job->rc) && job->outstanding == 0) {
+        job_fini(job);
+    }
+}
+
+static void
+job_task_submit(void *arg)
+{
+    struct job_task_t *task = arg;
+    struct job_t *job = task->job;
+    struct spdk_bdev_desc *desc = job->req_context->bdev_desc;
+    struct spdk_io_channel *ch = job->bdev_io_channel;
+    int rc = 0;
+
+    task->submit_tick = spdk_get_ticks();
+    switch (task->op) {
+    case JOB_OP_APPEND:
+        rc = spdk_bdev_zone_append(desc, ch, task->buf, task->lba, task->num_blocks,
+                                   job_task_complete, task);
+        break;
+    case JOB_OP_WRITE:
+        rc = spdk_bdev_write_blocks(desc, ch, task->buf, task->lba, task->num_blocks,
+                                    job_task_complete, task);
+        break;
+    case JOB_OP_READ:
+        rc = spdk_bdev_read_blocks(desc, ch, task->buf, task->lba, task->num_blocks,
+                                   job_task_complete, task);
+        break;
+    case JOB_OP_RESET:
+        rc = spdk_bdev_zone_management(desc, ch, task->lba, SPDK_BDEV_ZONE_RESET,
+                                       job_task_complete, task);
+        break;
+    case JOB_OP_FINISH:
+        rc = spdk_bdev_zone_management(desc, ch, task->lba, SPDK_BDEV_ZONE_FINISH,
+                                       job_task_complete, task);
+        break;
+    default:
+        rc = -EINVAL;
+        break;
+    }
+
+    if (rc == -ENOMEM) {
+        task->bdev_io_wait.bdev = job->req_context->bdev;
+        task->bdev_io_wait.cb_fn = job_task_submit;
+        task->bdev_io_wait.cb_arg = task;
+        spdk_bdev_queue_io_wait(job->req_context->bdev, ch, &task->bdev_io_wait);
+    } else if (rc) {
+        SPDK_ERRLOG("%s error while submitting %s: %d\n", spdk_strerror(-rc),
+                    g_op_name[task->op], rc);
+        job_task_complete(NULL, false, task);
+    }
+}
+
+/* Rate limited jobs park their tasks, this hands out the tokens that accrued */
+static int
+job_rate_poll(void *arg)
+{
+    struct job_t *job = arg;
+    uint32_t num_idle = job->num_idle;
+
+    job_kick(job);
+    return num_idle != job->num_idle ? SPDK_POLLER_BUSY : SPDK_POLLER_IDLE;
+}
+
+static int
+job_stop_poll(void *arg)
+{
+    struct job_t *job = arg;
+
+    spdk_poller_unregister(&job->stop_poller);
+    job->stop = true;
+    job->num_idle = 0;
+    if (job->outstanding == 0) {
+        job_fini(job);
+    }
+    return SPDK_POLLER_BUSY;
+}
+
+/* Runs on the job thread */
+static void
+job_start(void *arg)
+{
+    struct job_t *job = arg;
+
+    job->bdev_io_channel = spdk_bdev_get_io_channel(job->req_context->bdev_desc);
+    if (!job->bdev_io_channel) {
+        SPDK_ERRLOG("Could not create bdev I/O channel for job %s.%u\n",
+                    job->spec->name, job->clone);
+        job->rc = -ENOMEM;
+        job_fini(job);
+        return;
+    }
+
+    job->start_tick = spdk_get_ticks();
+    job->stop_poller = SPDK_POLLER_REGISTER(job_stop_poll, job,
+                                            job->spec->runtime * 1000 * 1000);
+    if (job->spec->rate_iops) {
+        job->rate_poller = SPDK_POLLER_REGISTER(job_rate_poll, job, 1000);
+    }
+    for (uint32_t i = 0; i < job->spec->qd; i++) {
+        job_task_next_or_idle(&job->tasks[i]);
+    }
+}
+
+static void
+job_free(struct job_t *job)
+{
+    for (int op = 0; op < JOB_OP_COUNT; op++) {
+        if (job->stats[op].histogram) {
+            spdk_histogram_data_free(job->stats[op].histogram);
+        }
+    }
+    spdk_free(job->buf);
+    free(job->tasks);
+    free(job->idle_tasks);
+    free(job->zones);
+    free(job);
+}
+
+static void
+jobs_free(struct request_context_t *req_context)
+{
+    struct job_t *job;
+
+    while ((job = TAILQ_FIRST(&req_context->jobs))) {
+        TAILQ_REMOVE(&req_context->jobs, job, link);
+        job_free(job);
+    }
+}
+
+static struct job_t *
+job_alloc(struct request_context_t *req_context, struct job_spec_t *spec, uint32_t clone,
+          uint64_t zone_first, uint64_t num_zones, uint32_t core)
+{
+    struct spdk_bdev_zone_info *info;
+    struct job_zone_t *zone;
+    struct job_t *job;
+    uint64_t buf_size;
+
+    job = calloc(1, sizeof(*job));
+    if (!job) {
+        return NULL;
+    }
+    job->req_context = req_context;
+    job->spec = spec;
+    job->clone = clone;
+    job->core = core;
+    job->num_zones = num_zones;
+    job->bs_blk = spec->bs / g_block_size;
+    job->seed = spdk_get_ticks() ^ (clone << 16) ^ (uint32_t)zone_first;
+    for (int op = 0; op < JOB_OP_COUNT; op++) {
+        job->mix_total += spec->mix.weight[op];
+    }
+
+    buf_size = SPDK_ALIGN_CEIL(spec->bs, g_buf_align);
+    job->zones = calloc(num_zones, sizeof(struct job_zone_t));
+    job->tasks = calloc(spec->qd, sizeof(struct job_task_t));
+    job->idle_tasks = calloc(spec->qd, sizeof(struct job_task_t *));
+    job->buf = spdk_zmalloc(buf_size * spec->qd, g_buf_align, NULL,
+                            spdk_env_get_socket_id(core), SPDK_MALLOC_DMA);
+    if (!job->zones || !job->tasks || !job->idle_tasks || !job->buf) {
+        job_free(job);
+        return NULL;
+    }
+    for (int op = 0; op < JOB_OP_COUNT; op++) {
+        job->stats[op].histogram = spdk_histogram_data_alloc();
+        if (!job->stats[op].histogram) {
+            job_free(job);
+            return NULL;
+        }
+    }
+    memset(job->buf, 0x5a, buf_size * spec->qd);
+    for (uint32_t i = 0; i < spec->qd; i++) {
+        job->tasks[i].job = job;
+        job->tasks[i].buf = (uint8_t *)job->buf + i * buf_size;
+    }
+
+    /* Start from what the device reports, zones that hold data are reset before reuse */
+    for (uint64_t i = 0; i < num_zones; i++) {
+        info = &g_zones[zone_first + i];
+        zone = &job->zones[i];
+        zone->zone_id = info->zone_id;
+        if (info->state == SPDK_BDEV_ZONE_STATE_OFFLINE ||
+            info->state == SPDK_BDEV_ZONE_STATE_READ_ONLY) {
+            continue;
+        }
+        zone->capacity = info->capacity;
+        if (info->state == SPDK_BDEV_ZONE_STATE_FULL) {
+            zone->written = info->capacity;
+        } else if (info->state != SPDK_BDEV_ZONE_STATE_EMPTY) {
+            zone->written = info->write_pointer - info->zone_id;
+        }
+        zone->submitted = zone->written;
+    }
+    return job;
+}
+
+static uint32_t
+job_next_core(uint32_t core)
+{
+    core = spdk_env_get_next_core(core);
+    return core == UINT32_MAX ? spdk_env_get_first_core() : core;
+}
+
+/* Split every job of the file into its clones and start each on its own thread */
+static void
+jobs_start(struct request_context_t *req_context)
+{
+    struct spdk_cpuset cpumask;
+    struct job_spec_t *spec;
+    struct job_t *job;
+    uint64_t zone_count, slice, open_zones = 0;
+    uint32_t max_open = spdk_bdev_get_max_open_zones(req_context->bdev);
+    uint32_t max_active = spdk_bdev_get_max_active_zones(req_context->bdev);
+    uint32_t core = spdk_env_get_current_core();
+    char name[64];
+
+    /* every clone keeps its open_zones open at once, together they must fit the device */
+    for (size_t i = 0; i < g_job_file_data.num_specs; i++) {
+        spec = &g_job_file_data.specs[i];
+        open_zones += (uint64_t)spec->open_zones * spec->numjobs;
+    }
+    if ((max_open && open_zones > max_open) || (max_active && open_zones > max_active)) {
+        SPDK_ERRLOG("jobs keep %lu zones open (open_zones x numjobs), the device allows "
+                    "%u open and %u active zones\n", open_zones, max_open, max_active);
+        goto err;
+    }
+
+    for (size_t i = 0; i < g_job_file_data.num_specs; i++) {
+        spec = &g_job_file_data.specs[i];
+        if (spec->bs % g_block_size) {
+            SPDK_ERRLOG("job %s: bs %lu is not a multiple of the block size %u\n",
+                        spec->name, spec->bs, g_block_size);
+            goto err;
+        }
+        if (spec->zone_first >= g_num_zone) {
+            SPDK_ERRLOG("job %s: zone_first %lu is beyond the last zone #%lu\n",
+                        spec->name, spec->zone_first, g_num_zone - 1);
+            goto err;
+        }
+        /* zone_count 0 means up to the last zone */
+        zone_count = spec->zone_count ? spec->zone_count : g_num_zone - spec->zone_first;
+        zone_count = spdk_min(zone_count, g_num_zone - spec->zone_first);
+        slice = zone_count / spec->numjobs;
+        if (slice == 0) {
+            SPDK_ERRLOG("job %s: %lu zones can't be split over %u jobs\n",
+                        spec->name, zone_count, spec->numjobs);
+            goto err;
+        }
+
+        for (uint32_t clone = 0; clone < spec->numjobs; clone++) {
+            job = job_alloc(req_context, spec, clone, spec->zone_first + clone * slice,
+                            slice, core);
+            if (!job) {
+                SPDK_ERRLOG("Failed to allocate job %s.%u\n", spec->name, clone);
+                goto err;
+            }
+            TAILQ_INSERT_TAIL(&req_context->jobs, job, link);
+            req_context->num_jobs++;
+            core = job_next_core(core);
+        }
+    }
+
+    TAILQ_FOREACH(job, &req_context->jobs, link) {
+        snprintf(name, sizeof(name), "zonejob_%s_%u", job->spec->name, job->clone);
+        spdk_cpuset_zero(&cpumask);
+        spdk_cpuset_set_cpu(&cpumask, job->core, true);
+        job->thread = spdk_thread_create(name, &cpumask);
+        if (!job->thread) {
+            /* the threads already running still report back through job_done */
+            SPDK_ERRLOG("Failed to create thread for job %s.%u\n", job->spec->name, job->clone);
+            req_context->rc = -ENOMEM;
+            break;
+        }
+        req_context->jobs_pending++;
+    }
+    if (req_context->jobs_pending == 0) {
+        goto err;
+    }
+    printf("Starting %u jobs\n", req_context->jobs_pending);
+    TAILQ_FOREACH(job, &req_context->jobs, link) {
+        if (!job->thread) {
+            break;
+        }
+        spdk_thread_send_msg(job->thread, job_start, job);
+    }
+    return;
+
+err:
+    appstop_error(req_context);
+}
+/* job end */
+
+/* get zone info start */
+static void get_zone_info_batch(void *arg);
+
+static void
+get_zone_info_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct request_context_t *req_context = cb_arg;
+    uint64_t num_zones = spdk_min(ZONE_REPORT_BATCH, g_num_zone - req_context->zone_next);
+
+    /* Complete the I/O */
+    spdk_bdev_free_io(bdev_io);
+
+    if (!success) {
+        SPDK_ERRLOG("bdev io get zone info error: %d\n", EIO);
+        appstop_error(req_context);
+        return;
+    }
+
+    req_context->zone_next += num_zones;
+    if (req_context->zone_next < g_num_zone) {
+        get_zone_info_batch(req_context);
+        return;
+    }
+
+    printf("[zone info]\n");
+    printf("num zone: %lu zones\n", g_num_zone);
+    printf("zone size: %lu blocks\n", g_zone_sz_blk);
+    jobs_start(req_context);
+}
+
+static void
+get_zone_info_batch(void *arg)
+{
+    struct request_context_t *req_context = arg;
+    int rc = 0;
+
+    rc = spdk_bdev_get_zone_info(req_context->bdev_desc, req_context->bdev_io_channel,
+                                req_context->zone_next * g_zone_sz_blk,
+                                spdk_min(ZONE_REPORT_BATCH, g_num_zone - req_context->zone_next),
+                                &g_zones[req_context->zone_next], get_zone_info_complete,
+                                req_context);
+
+    if (rc == -ENOMEM) {
+        SPDK_NOTICELOG("Queueing io\n");
+        queue_io_wait_with_cb(req_context, get_zone_info_batch);
+    } else if (rc) {
+        SPDK_ERRLOG("%s error while get zone_info: %d\n", spdk_strerror(-rc), rc);
+        appstop_error(req_context);
+    }
+}
+/* get zone info end */
+
+static void
+bdev_event_cb(enum spdk_bdev_event_type type, struct spdk_bdev *bdev,
+              void *event_ctx)
+{
+    SPDK_NOTICELOG("Unsupported bdev event: type %d\n", type);
+}
+
+static void
+appstart(void *arg)
+{
+    struct request_context_t *req_context = arg;
+    int rc = 0;
+    req_context->bdev = NULL;
+    req_context->bdev_desc = NULL;
+    TAILQ_INIT(&req_context->jobs);
+    g_app_thread = spdk_get_thread();
+
+    SPDK_NOTICELOG("Successfully started the application\n");
+
+    SPDK_NOTICELOG("Opening the bdev %s\n", req_context->bdev_name);
+    rc = spdk_bdev_open_ext(req_context->bdev_name, true, bdev_event_cb, NULL,
+                            &req_context->bdev_desc);
+    if (rc) {
+        SPDK_ERRLOG("Could not open bdev: %s\n", req_context->bdev_name);
+        spdk_app_stop(-1);
+        return;
+    }
+
+    /* A bdev pointer is valid while the bdev is opened */
+    req_context->bdev = spdk_bdev_desc_get_bdev(req_context->bdev_desc);
+
+    SPDK_NOTICELOG("Opening io channel\n");
+    req_context->bdev_io_channel = spdk_bdev_get_io_channel(req_context->bdev_desc);
+    if (req_context->bdev_io_channel == NULL) {
+        SPDK_ERRLOG("Could not create bdev I/O channel!!\n");
+        spdk_bdev_close(req_context->bdev_desc);
+        spdk_app_stop(-1);
+        return;
+    }
+
+    if (!spdk_bdev_is_zoned(req_context->bdev)) {
+        SPDK_ERRLOG("bdev %s is not zoned\n", req_context->bdev_name);
+        appstop_error(req_context);
+        return;
+    }
+
+    g_block_size = spdk_bdev_get_block_size(req_context->bdev);
+    g_buf_align = spdk_bdev_get_buf_align(req_context->bdev);
+    g_zone_sz_blk = spdk_bdev_get_zone_size(req_context->bdev);
+    g_num_zone = spdk_bdev_get_num_zones(req_context->bdev);
+    uint32_t write_unit = spdk_bdev_get_write_unit_size(req_context->bdev);
+    uint32_t max_append = spdk_bdev_get_max_zone_append_size(req_context->bdev);
+    if (max_append) {
+        g_append_blk = spdk_max(max_append / write_unit, 1) * write_unit;
+    }
+
+    g_zones = calloc(g_num_zone, sizeof(struct spdk_bdev_zone_info));
+    if (!g_zones) {
+        SPDK_ERRLOG("Failed to allocate zone table\n");
+        appstop_error(req_context);
+        return;
+    }
+    req_context->zone_next = 0;
+    get_zone_info_batch(req_context);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct spdk_app_opts opts = {};
+    int rc = 0;
+    struct request_context_t req_context = {};
+
+    spdk_app_opts_init(&opts, sizeof(opts));
+    opts.name = "zonejob";
+
+    if ((rc = spdk_app_parse_args(argc, argv, &opts, "b:j:", NULL, parse_arg,
+                                  usage)) != SPDK_APP_PARSE_ARGS_SUCCESS) {
+        exit(rc);
+    }
+    if (!g_job_file) {
+        fprintf(stderr, "A job file is required (-j)\n");
+        usage();
+        exit(1);
+    }
+    if (job_file_load(g_job_file, &g_job_file_data)) {
+        exit(1);
+    }
+    req_context.bdev_name = g_bdev_name;
+
+    rc = spdk_app_start(&opts, appstart, &req_context);
+    if (rc) {
+        SPDK_ERRLOG("ERROR starting application\n");
+    }
+
+    jobs_free(&req_context);
+    for (size_t i = 0; i < g_job_file_data.num_specs; i++) {
+        free(g_job_file_data.specs[i].name);
+    }
+    free(g_zones);
+    spdk_app_fini();
+    return rc;
+}